@@ -21,8 +21,12 @@
 
 #include <assert.h>
 #include <errno.h>
+#include <limits.h>
+#include <stddef.h>
+#include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
 
 // #include "alloc-util.h"
 #include "calendarspec.h"
@@ -31,18 +35,12 @@
 
 #define assert_se assert
 
-/* from basic/fileio.c */
-static int fflush_and_check(FILE *f) {
-        assert(f);
-
-        errno = 0;
-        fflush(f);
-
-        if (ferror(f))
-                return errno ? -errno : -EIO;
-
-        return 0;
-}
+/* from basic/macro.h */
+#define DECIMAL_STR_MAX(type)                                   \
+        (2+(sizeof(type) <= 1 ? 3 :                             \
+            sizeof(type) <= 2 ? 5 :                             \
+            sizeof(type) <= 4 ? 10 :                            \
+            sizeof(type) <= 8 ? 20 : sizeof(int[-2*(sizeof(type) > 8)])))
 
 /* from basic/string-util.h */
 #define strcaseeq(a,b) (strcasecmp((a),(b)) == 0)
@@ -91,81 +89,117 @@ static const char* endswith_no_case(const char *s, const char *postfix) {
 
 #define BITS_WEEKDAYS   127
 
-static void free_chain(CalendarComponent *c) {
-        CalendarComponent *n;
-
-        while (c) {
-                n = c->next;
-                free(c);
-                c = n;
-        }
-}
+/* Room for the string of a spec with n components and a time zone
+ * name not longer than tz_len: the weekdays are at most
+ * "Mon,Wed,Fri,Sun ", a component "2199/229,", and an empty chain "*",
+ * plus the separators of the six chains and the NUL. Values of invalid
+ * specs can be longer, but those are refused anyway. */
+#define CALENDAR_SPEC_FORMAT_ROOM(n, tz_len) (16 + (n) * 9 + 6 + 5 + 1 + (tz_len) + 1)
+#define YEAR_MIN        1970
+#define YEAR_MAX        2199
 
 void calendar_spec_free(CalendarSpec *c) {
 
         if (!c)
                 return;
 
-        free_chain(c->year);
-        free_chain(c->month);
-        free_chain(c->day);
-        free_chain(c->hour);
-        free_chain(c->minute);
-        free_chain(c->second);
-
+        tzfile_free(c->tz);
+        free(c->cache);
         free(c);
 }
 
-static int component_compare(const void *_a, const void *_b) {
-        CalendarComponent * const *a = _a, * const *b = _b;
+/* Allocates the spec together with room for n components, and for
+ * the string of the spec, which is at most format_room long */
+static CalendarSpec *calendar_spec_new(unsigned n, size_t format_room) {
+        CalendarSpec *c;
+
+        c = calloc(1, offsetof(CalendarSpec, components) + n * sizeof(CalendarComponent) + format_room);
+        if (!c)
+                return NULL;
+
+        c->n_components_allocated = n;
+        c->format_room = format_room;
+        return c;
+}
 
-        if ((*a)->value < (*b)->value)
-                return -1;
-        if ((*a)->value > (*b)->value)
-                return 1;
+static int component_compare(const CalendarComponent *a, const CalendarComponent *b) {
+        if (a->value != b->value)
+                return a->value < b->value ? -1 : 1;
 
-        if ((*a)->repeat < (*b)->repeat)
-                return -1;
-        if ((*a)->repeat > (*b)->repeat)
-                return 1;
+        if (a->repeat != b->repeat)
+                return a->repeat < b->repeat ? -1 : 1;
 
         return 0;
 }
 
-static void sort_chain(CalendarComponent **c) {
-        unsigned n = 0, k;
-        CalendarComponent **b, *i, **j, *next;
+/* Links a new component into the chain, which is kept sorted and free
+ * of duplicates. */
+static int insert_component(CalendarSpec *spec, CalendarComponent **c, int value, int repeat) {
+        CalendarComponent *cc, **i;
+        int k = 1;
 
+        assert(spec);
         assert(c);
 
-        for (i = *c; i; i = i->next)
-                n++;
+        if (spec->n_components >= spec->n_components_allocated)
+                return -ENOMEM;
 
-        if (n <= 1)
-                return;
+        cc = spec->components + spec->n_components;
+        cc->value = value;
+        cc->repeat = repeat;
+
+        for (i = c; *i; i = &(*i)->next) {
+                k = component_compare(cc, *i);
+                if (k <= 0)
+                        break;
+        }
+
+        if (k == 0)
+                return 0;
+
+        cc->next = *i;
+        *i = cc;
+        spec->n_components++;
 
-        j = b = alloca(sizeof(CalendarComponent*) * n);
-        for (i = *c; i; i = i->next)
-                *(j++) = i;
+        return 0;
+}
+
+static void sort_chain(CalendarComponent **c) {
+        CalendarComponent *sorted = NULL, *last = NULL, *i, *next, **j;
+        int k;
 
-        qsort(b, n, sizeof(CalendarComponent*), component_compare);
+        assert(c);
 
-        b[n-1]->next = NULL;
-        next = b[n-1];
+        /* Insertion sort, dropping non-unique entries. The chains built
+         * by the parser are sorted already, so usually every entry is
+         * appended right away. */
+        for (i = *c; i; i = next) {
+                next = i->next;
 
-        /* Drop non-unique entries */
-        for (k = n-1; k > 0; k--) {
-                if (b[k-1]->value == next->value &&
-                    b[k-1]->repeat == next->repeat) {
-                        free(b[k-1]);
+                if (last && component_compare(i, last) > 0) {
+                        i->next = NULL;
+                        last->next = i;
+                        last = i;
                         continue;
                 }
 
-                b[k-1]->next = next;
-                next = b[k-1];
+                k = 1;
+                for (j = &sorted; *j; j = &(*j)->next) {
+                        k = component_compare(i, *j);
+                        if (k <= 0)
+                                break;
+                }
+
+                if (k == 0)
+                        continue;
+
+                i->next = *j;
+                *j = i;
+                if (!i->next)
+                        last = i;
         }
 
-        *c = next;
+        *c = sorted;
 }
 
 static void fix_year(CalendarComponent *c) {
@@ -184,6 +218,78 @@ static void fix_year(CalendarComponent *c) {
         }
 }
 
+static uint64_t chain_to_bits(const CalendarComponent *c, int from, int to) {
+        uint64_t bits = 0;
+        int k;
+
+        assert(from >= 0 && to < 64 && from <= to);
+
+        /* No chain means every value of the range matches */
+        if (!c)
+                return (UINT64_MAX >> (63 - to)) & (UINT64_MAX << from);
+
+        for (; c; c = c->next) {
+                if (c->value < from || c->value > to)
+                        continue;
+
+                if (c->repeat <= 0) {
+                        bits |= UINT64_C(1) << c->value;
+                        continue;
+                }
+
+                for (k = c->value; k <= to; k += c->repeat)
+                        bits |= UINT64_C(1) << k;
+        }
+
+        return bits;
+}
+
+static void compile_chains(CalendarSpec *c) {
+        assert(c);
+
+        c->month_bits = (uint32_t) chain_to_bits(c->month, 1, 12);
+        c->day_bits = (uint32_t) chain_to_bits(c->day, 1, 31);
+        c->hour_bits = (uint32_t) chain_to_bits(c->hour, 0, 23);
+        c->minute_bits = chain_to_bits(c->minute, 0, 59);
+        c->second_bits = chain_to_bits(c->second, 0, 59);
+}
+
+#define MONTH_BITS_ALL  UINT32_C(0x1ffe)
+#define DAY_BITS_ALL    UINT32_C(0xfffffffe)
+
+static void compile_week(CalendarSpec *c) {
+        int d, h, m, i;
+
+        memset(c->week_bits, 0, sizeof(c->week_bits));
+
+        c->weekly = !c->year &&
+                c->month_bits == MONTH_BITS_ALL &&
+                c->day_bits == DAY_BITS_ALL &&
+                c->second_bits == 1;
+        if (!c->weekly)
+                return;
+
+        for (d = 0; d < 7; d++) {
+                if (c->weekdays_bits >= 0 && !(c->weekdays_bits & (1 << d)))
+                        continue;
+
+                for (h = 0; h < 24; h++) {
+                        if (!(c->hour_bits & (UINT32_C(1) << h)))
+                                continue;
+
+                        for (m = 0; m < 60; m++) {
+                                if (!(c->minute_bits & (UINT64_C(1) << m)))
+                                        continue;
+
+                                i = d * 1440 + h * 60 + m;
+                                c->week_bits[i / 64] |= UINT64_C(1) << (i % 64);
+                        }
+                }
+        }
+}
+
+static void format_into_room(CalendarSpec *c);
+
 int calendar_spec_normalize(CalendarSpec *c) {
         assert(c);
 
@@ -199,6 +305,13 @@ int calendar_spec_normalize(CalendarSpec *c) {
         sort_chain(&c->minute);
         sort_chain(&c->second);
 
+        compile_chains(c);
+        compile_week(c);
+        format_into_room(c);
+
+        free(c->cache);
+        c->cache = NULL;
+
         return 0;
 }
 
@@ -224,7 +337,7 @@ _pure_ bool calendar_spec_valid(CalendarSpec *c) {
         if (c->weekdays_bits > BITS_WEEKDAYS)
                 return false;
 
-        if (!chain_valid(c->year, 1970, 2199))
+        if (!chain_valid(c->year, YEAR_MIN, YEAR_MAX))
                 return false;
 
         if (!chain_valid(c->month, 1, 12))
@@ -245,7 +358,33 @@ _pure_ bool calendar_spec_valid(CalendarSpec *c) {
         return true;
 }
 
-static void format_weekdays(FILE *f, const CalendarSpec *c) {
+/* Output of the formatting functions. Never writes past the end of
+ * the buffer, but counts the length of the complete string. */
+typedef struct FormatBuffer {
+        char *p;
+        size_t size;
+        size_t n;
+} FormatBuffer;
+
+static void format_putc(FormatBuffer *f, char c) {
+        if (f->n + 1 < f->size)
+                f->p[f->n] = c;
+        f->n++;
+}
+
+static void format_puts(FormatBuffer *f, const char *s) {
+        for (; *s; s++)
+                format_putc(f, *s);
+}
+
+static void format_int(FormatBuffer *f, int width, int value) {
+        char buf[DECIMAL_STR_MAX(int)];
+
+        snprintf(buf, sizeof(buf), "%0*i", width, value);
+        format_puts(f, buf);
+}
+
+static void format_weekdays(FormatBuffer *f, const CalendarSpec *c) {
         static const char *const days[] = {
                 "Mon",
                 "Tue",
@@ -269,19 +408,19 @@ static void format_weekdays(FILE *f, const CalendarSpec *c) {
 
                         if (l < 0) {
                                 if (need_colon)
-                                        fputc(',', f);
+                                        format_putc(f, ',');
                                 else
                                         need_colon = true;
 
-                                fputs(days[x], f);
+                                format_puts(f, days[x]);
                                 l = x;
                         }
 
                 } else if (l >= 0) {
 
                         if (x > l + 1) {
-                                fputc(x > l + 2 ? '-' : ',', f);
-                                fputs(days[x-1], f);
+                                format_putc(f, x > l + 2 ? '-' : ',');
+                                format_puts(f, days[x-1]);
                         }
 
                         l = -1;
@@ -289,98 +428,184 @@ static void format_weekdays(FILE *f, const CalendarSpec *c) {
         }
 
         if (l >= 0 && x > l + 1) {
-                fputc(x > l + 2 ? '-' : ',', f);
-                fputs(days[x-1], f);
+                format_putc(f, x > l + 2 ? '-' : ',');
+                format_puts(f, days[x-1]);
         }
 }
 
-static void format_chain(FILE *f, int space, const CalendarComponent *c) {
+static void format_chain(FormatBuffer *f, int space, const CalendarComponent *c) {
         assert(f);
 
         if (!c) {
-                fputc('*', f);
+                format_putc(f, '*');
                 return;
         }
 
         assert(c->value >= 0);
-        fprintf(f, "%0*i", space, c->value);
+        format_int(f, space, c->value);
 
-        if (c->repeat > 0)
-                fprintf(f, "/%i", c->repeat);
+        if (c->repeat > 0) {
+                format_putc(f, '/');
+                format_int(f, 0, c->repeat);
+        }
 
         if (c->next) {
-                fputc(',', f);
+                format_putc(f, ',');
                 format_chain(f, space, c->next);
         }
 }
 
+/* Formats the spec into buf, and returns the length of the complete
+ * string, even if it did not fit. */
+static size_t format_spec(const CalendarSpec *c, char *buf, size_t size) {
+        FormatBuffer f = {
+                .p = buf,
+                .size = size,
+        };
+
+        if (c->weekdays_bits > 0 && c->weekdays_bits <= BITS_WEEKDAYS) {
+                format_weekdays(&f, c);
+                format_putc(&f, ' ');
+        }
+
+        format_chain(&f, 4, c->year);
+        format_putc(&f, '-');
+        format_chain(&f, 2, c->month);
+        format_putc(&f, '-');
+        format_chain(&f, 2, c->day);
+        format_putc(&f, ' ');
+        format_chain(&f, 2, c->hour);
+        format_putc(&f, ':');
+        format_chain(&f, 2, c->minute);
+        format_putc(&f, ':');
+        format_chain(&f, 2, c->second);
+
+        if (c->utc)
+                format_puts(&f, " UTC");
+        else if (c->tz) {
+                format_putc(&f, ' ');
+                format_puts(&f, tzfile_name(c->tz));
+        }
+
+        if (size > 0)
+                buf[f.n < size ? f.n : size - 1] = 0;
+
+        return f.n;
+}
+
+/* Formats the spec into the room allocated with it, if it fits */
+static void format_into_room(CalendarSpec *c) {
+        char *room = (char *) (c->components + c->n_components_allocated);
+
+        c->formatted = NULL;
+        if (c->format_room > 0 && format_spec(c, room, c->format_room) < c->format_room)
+                c->formatted = room;
+}
+
+const char *calendar_spec_string(const CalendarSpec *c) {
+        assert(c);
+        assert(c->formatted);
+
+        return c->formatted;
+}
+
+size_t calendar_spec_format_max(const CalendarSpec *c) {
+        assert(c);
+
+        if (c->formatted)
+                return strlen(c->formatted) + 1;
+
+        return format_spec(c, NULL, 0) + 1;
+}
+
+int calendar_spec_format(const CalendarSpec *c, char *buf, size_t l) {
+        size_t n;
+
+        assert(c);
+        assert(buf || l == 0);
+
+        if (c->formatted) {
+                n = strlen(c->formatted);
+                if (n >= l)
+                        return -ENOBUFS;
+
+                memcpy(buf, c->formatted, n + 1);
+                return 0;
+        }
+
+        return format_spec(c, buf, l) < l ? 0 : -ENOBUFS;
+}
+
 int calendar_spec_to_string(const CalendarSpec *c, char **p) {
-        char *buf = NULL;
-        size_t sz = 0;
-        FILE *f;
+        char *buf;
+        size_t l;
         int r;
 
         assert(c);
         assert(p);
 
-        f = open_memstream(&buf, &sz);
-        if (!f)
+        l = calendar_spec_format_max(c);
+        buf = malloc(l);
+        if (!buf)
                 return -ENOMEM;
 
-        if (c->weekdays_bits > 0 && c->weekdays_bits <= BITS_WEEKDAYS) {
-                format_weekdays(f, c);
-                fputc(' ', f);
-        }
-
-        format_chain(f, 4, c->year);
-        fputc('-', f);
-        format_chain(f, 2, c->month);
-        fputc('-', f);
-        format_chain(f, 2, c->day);
-        fputc(' ', f);
-        format_chain(f, 2, c->hour);
-        fputc(':', f);
-        format_chain(f, 2, c->minute);
-        fputc(':', f);
-        format_chain(f, 2, c->second);
-
-        if (c->utc)
-                fputs(" UTC", f);
-
-        r = fflush_and_check(f);
+        r = calendar_spec_format(c, buf, l);
         if (r < 0) {
                 free(buf);
-                fclose(f);
                 return r;
         }
 
-        fclose(f);
-
         *p = buf;
         return 0;
 }
 
-static int parse_weekdays(const char **p, CalendarSpec *c) {
-        static const struct {
-                const char *name;
-                const int nr;
-        } day_nr[] = {
-                { "Monday",    0 },
-                { "Mon",       0 },
-                { "Tuesday",   1 },
-                { "Tue",       1 },
-                { "Wednesday", 2 },
-                { "Wed",       2 },
-                { "Thursday",  3 },
-                { "Thu",       3 },
-                { "Friday",    4 },
-                { "Fri",       4 },
-                { "Saturday",  5 },
-                { "Sat",       5 },
-                { "Sunday",    6 },
-                { "Sun",       6 }
+/* Returns the number of the weekday (0 is Monday) named by the first n
+ * characters of p, or -EINVAL. Full names and the three letter
+ * abbreviations are accepted, case does not matter. */
+static int weekday_from_name(const char *p, size_t n) {
+        static const char *const names[] = {
+                "monday",
+                "tuesday",
+                "wednesday",
+                "thursday",
+                "friday",
+                "saturday",
+                "sunday"
         };
+        int d;
+
+        if (n < 3)
+                return -EINVAL;
 
+        switch (p[0] | 0x20) {
+        case 'm':
+                d = 0;
+                break;
+        case 't':
+                d = (p[1] | 0x20) == 'h' ? 3 : 1;
+                break;
+        case 'w':
+                d = 2;
+                break;
+        case 'f':
+                d = 4;
+                break;
+        case 's':
+                d = (p[1] | 0x20) == 'u' ? 6 : 5;
+                break;
+        default:
+                return -EINVAL;
+        }
+
+        if (n != 3 && n != strlen(names[d]))
+                return -EINVAL;
+        if (strncasecmp(p, names[d], n) != 0)
+                return -EINVAL;
+
+        return d;
+}
+
+static int parse_weekdays(const char **p, CalendarSpec *c) {
         int l = -1;
         bool first = true;
 
@@ -389,46 +614,34 @@ static int parse_weekdays(const char **p, CalendarSpec *c) {
         assert(c);
 
         for (;;) {
-                unsigned i;
+                size_t skip;
+                int d;
 
                 if (!first && **p == ' ')
                         return 0;
 
-                for (i = 0; i < ELEMENTSOF(day_nr); i++) {
-                        size_t skip;
-
-                        if (!startswith_no_case(*p, day_nr[i].name))
-                                continue;
-
-                        skip = strlen(day_nr[i].name);
+                skip = strcspn(*p, "-, ");
+                d = weekday_from_name(*p, skip);
 
-                        if ((*p)[skip] != '-' &&
-                            (*p)[skip] != ',' &&
-                            (*p)[skip] != ' ' &&
-                            (*p)[skip] != 0)
-                                return -EINVAL;
-
-                        c->weekdays_bits |= 1 << day_nr[i].nr;
+                /* Couldn't find this prefix, so let's assume the
+                   weekday was not specified and let's continue with
+                   the date */
+                if (d < 0)
+                        return first ? 0 : -EINVAL;
 
-                        if (l >= 0) {
-                                int j;
+                c->weekdays_bits |= 1 << d;
 
-                                if (l > day_nr[i].nr)
-                                        return -EINVAL;
+                if (l >= 0) {
+                        int j;
 
-                                for (j = l + 1; j < day_nr[i].nr; j++)
-                                        c->weekdays_bits |= 1 << j;
-                        }
+                        if (l > d)
+                                return -EINVAL;
 
-                        *p += skip;
-                        break;
+                        for (j = l + 1; j < d; j++)
+                                c->weekdays_bits |= 1 << j;
                 }
 
-                /* Couldn't find this prefix, so let's assume the
-                   weekday was not specified and let's continue with
-                   the date */
-                if (i >= ELEMENTSOF(day_nr))
-                        return first ? 0 : -EINVAL;
+                *p += skip;
 
                 /* We reached the end of the string */
                 if (**p == 0)
@@ -444,7 +657,7 @@ static int parse_weekdays(const char **p, CalendarSpec *c) {
                         if (l >= 0)
                                 return -EINVAL;
 
-                        l = day_nr[i].nr;
+                        l = d;
                 } else
                         l = -1;
 
@@ -453,60 +666,64 @@ static int parse_weekdays(const char **p, CalendarSpec *c) {
         }
 }
 
-static int prepend_component(const char **p, CalendarComponent **c) {
+static int parse_component(const char **p, CalendarSpec *spec, CalendarComponent **c) {
         unsigned long value, repeat = 0;
         char *e = NULL, *ee = NULL;
-        CalendarComponent *cc;
+        int r;
 
         assert(p);
         assert(c);
 
-        errno = 0;
-        value = strtoul(*p, &e, 10);
-        if (errno > 0)
-                return -errno;
-        if (e == *p)
-                return -EINVAL;
-        if ((unsigned long) (int) value != value)
-                return -ERANGE;
+        for (;;) {
+                /* strtoul() would accept a sign and wrap negative numbers */
+                *p += strspn(*p, " \t\n");
+                if (**p < '0' || **p > '9')
+                        return -EINVAL;
 
-        if (*e == '/') {
-                repeat = strtoul(e+1, &ee, 10);
+                errno = 0;
+                value = strtoul(*p, &e, 10);
                 if (errno > 0)
                         return -errno;
-                if (ee == e+1)
+                if (e == *p)
                         return -EINVAL;
-                if ((unsigned long) (int) repeat != repeat)
-                        return -ERANGE;
-                if (repeat <= 0)
+                if ((unsigned long) (int) value != value)
                         return -ERANGE;
 
-                e = ee;
-        }
+                repeat = 0;
+                if (*e == '/') {
+                        if (e[1] < '0' || e[1] > '9')
+                                return -EINVAL;
 
-        if (*e != 0 && *e != ' ' && *e != ',' && *e != '-' && *e != ':')
-                return -EINVAL;
+                        repeat = strtoul(e+1, &ee, 10);
+                        if (errno > 0)
+                                return -errno;
+                        if (ee == e+1)
+                                return -EINVAL;
+                        if ((unsigned long) (int) repeat != repeat)
+                                return -ERANGE;
+                        if (repeat <= 0)
+                                return -ERANGE;
 
-        cc = new0(CalendarComponent, 1);
-        if (!cc)
-                return -ENOMEM;
+                        e = ee;
+                }
 
-        cc->value = value;
-        cc->repeat = repeat;
-        cc->next = *c;
+                if (*e != 0 && *e != ' ' && *e != ',' && *e != '-' && *e != ':')
+                        return -EINVAL;
 
-        *p = e;
-        *c = cc;
+                r = insert_component(spec, c, value, repeat);
+                if (r < 0)
+                        return r;
+
+                *p = e;
+
+                if (*e != ',')
+                        return 0;
 
-        if (*e ==',') {
                 *p += 1;
-                return prepend_component(p, c);
         }
-
-        return 0;
 }
 
-static int parse_chain(const char **p, CalendarComponent **c) {
+static int parse_chain(const char **p, CalendarSpec *spec, CalendarComponent **c) {
         const char *t;
         CalendarComponent *cc = NULL;
         int r;
@@ -522,37 +739,24 @@ static int parse_chain(const char **p, CalendarComponent **c) {
                 return 0;
         }
 
-        r = prepend_component(&t, &cc);
-        if (r < 0) {
-                free_chain(cc);
+        r = parse_component(&t, spec, &cc);
+        if (r < 0)
                 return r;
-        }
 
         *p = t;
         *c = cc;
         return 0;
 }
 
-static int const_chain(int value, CalendarComponent **c) {
-        CalendarComponent *cc = NULL;
-
+static int const_chain(int value, CalendarSpec *spec, CalendarComponent **c) {
         assert(c);
 
-        cc = new0(CalendarComponent, 1);
-        if (!cc)
-                return -ENOMEM;
-
-        cc->value = value;
-        cc->repeat = 0;
-        cc->next = *c;
-
-        *c = cc;
-
-        return 0;
+        return insert_component(spec, c, value, 0);
 }
 
 static int parse_date(const char **p, CalendarSpec *c) {
         const char *t;
+        unsigned mark;
         int r;
         CalendarComponent *first, *second, *third;
 
@@ -565,27 +769,26 @@ static int parse_date(const char **p, CalendarSpec *c) {
         if (*t == 0)
                 return 0;
 
-        r = parse_chain(&t, &first);
+        mark = c->n_components;
+
+        r = parse_chain(&t, c, &first);
         if (r < 0)
                 return r;
 
         /* Already the end? A ':' as separator? In that case this was a time, not a date */
         if (*t == 0 || *t == ':') {
-                free_chain(first);
+                /* Drop what was parsed, it is parsed again as time */
+                c->n_components = mark;
                 return 0;
         }
 
-        if (*t != '-') {
-                free_chain(first);
+        if (*t != '-')
                 return -EINVAL;
-        }
 
         t++;
-        r = parse_chain(&t, &second);
-        if (r < 0) {
-                free_chain(first);
+        r = parse_chain(&t, c, &second);
+        if (r < 0)
                 return r;
-        }
 
         /* Got two parts, hence it's month and day */
         if (*t == ' ' || *t == 0) {
@@ -595,19 +798,13 @@ static int parse_date(const char **p, CalendarSpec *c) {
                 return 0;
         }
 
-        if (*t != '-') {
-                free_chain(first);
-                free_chain(second);
+        if (*t != '-')
                 return -EINVAL;
-        }
 
         t++;
-        r = parse_chain(&t, &third);
-        if (r < 0) {
-                free_chain(first);
-                free_chain(second);
+        r = parse_chain(&t, c, &third);
+        if (r < 0)
                 return r;
-        }
 
         /* Got tree parts, hence it is year, month and day */
         if (*t == ' ' || *t == 0) {
@@ -618,9 +815,6 @@ static int parse_date(const char **p, CalendarSpec *c) {
                 return 0;
         }
 
-        free_chain(first);
-        free_chain(second);
-        free_chain(third);
         return -EINVAL;
 }
 
@@ -644,19 +838,17 @@ static int parse_calendar_time(const char **p, CalendarSpec *c) {
                 goto finish;
         }
 
-        r = parse_chain(&t, &h);
+        r = parse_chain(&t, c, &h);
         if (r < 0)
-                goto fail;
+                return r;
 
-        if (*t != ':') {
-                r = -EINVAL;
-                goto fail;
-        }
+        if (*t != ':')
+                return -EINVAL;
 
         t++;
-        r = parse_chain(&t, &m);
+        r = parse_chain(&t, c, &m);
         if (r < 0)
-                goto fail;
+                return r;
 
         /* Already at the end? Then it's hours and minutes, and seconds are 0 */
         if (*t == 0) {
@@ -666,36 +858,33 @@ static int parse_calendar_time(const char **p, CalendarSpec *c) {
                 goto finish;
         }
 
-        if (*t != ':') {
-                r = -EINVAL;
-                goto fail;
-        }
+        if (*t != ':')
+                return -EINVAL;
 
         t++;
-        r = parse_chain(&t, &s);
+        r = parse_chain(&t, c, &s);
         if (r < 0)
-                goto fail;
+                return r;
 
         /* At the end? Then it's hours, minutes and seconds */
         if (*t == 0)
                 goto finish;
 
-        r = -EINVAL;
-        goto fail;
+        return -EINVAL;
 
 null_hour:
-        r = const_chain(0, &h);
+        r = const_chain(0, c, &h);
         if (r < 0)
-                goto fail;
+                return r;
 
-        r = const_chain(0, &m);
+        r = const_chain(0, c, &m);
         if (r < 0)
-                goto fail;
+                return r;
 
 null_second:
-        r = const_chain(0, &s);
+        r = const_chain(0, c, &s);
         if (r < 0)
-                goto fail;
+                return r;
 
 finish:
         *p = t;
@@ -703,155 +892,229 @@ finish:
         c->minute = m;
         c->second = s;
         return 0;
+}
 
-fail:
-        free_chain(h);
-        free_chain(m);
-        free_chain(s);
-        return r;
+/* The shorthands like "daily". Each sets the fields from the second up
+ * to the given one to their first value, plus the listed months, day
+ * and weekdays. */
+typedef struct CalendarShorthand {
+        const char *name;
+        int weekdays_bits;
+        uint16_t months;
+        int day;
+        enum {
+                UPTO_SECOND,
+                UPTO_MINUTE,
+                UPTO_HOUR,
+        } upto;
+} CalendarShorthand;
+
+static const CalendarShorthand shorthands[] = {
+        { "minutely",      0, 0,                                   0, UPTO_SECOND },
+        { "hourly",        0, 0,                                   0, UPTO_MINUTE },
+        { "daily",         0, 0,                                   0, UPTO_HOUR   },
+        { "weekly",        1, 0,                                   0, UPTO_HOUR   },
+        { "monthly",       0, 0,                                   1, UPTO_HOUR   },
+        { "quarterly",     0, 1 << 1 | 1 << 4 | 1 << 7 | 1 << 10,  1, UPTO_HOUR   },
+        { "semiannually",  0, 1 << 1 | 1 << 7,                     1, UPTO_HOUR   },
+        { "annually",      0, 1 << 1,                              1, UPTO_HOUR   },
+};
+
+/* Looks up a shorthand by its name or one of the aliases, dispatching on
+ * the length and first character before comparing the whole name. */
+static const CalendarShorthand *shorthand_from_name(const char *p) {
+        const char *name;
+        const CalendarShorthand *s;
+
+        switch (strlen(p)) {
+        case 5:
+                s = &shorthands[2];
+                name = "daily";
+                break;
+        case 6:
+                switch (p[0] | 0x20) {
+                case 'h':
+                        s = &shorthands[1];
+                        name = "hourly";
+                        break;
+                case 'w':
+                        s = &shorthands[3];
+                        name = "weekly";
+                        break;
+                case 'y':
+                        s = &shorthands[7];
+                        name = "yearly";
+                        break;
+                default:
+                        return NULL;
+                }
+                break;
+        case 7:
+                switch (p[0] | 0x20) {
+                case 'm':
+                        s = &shorthands[4];
+                        name = "monthly";
+                        break;
+                case 'a':
+                        /* backwards compatibility */
+                        s = &shorthands[7];
+                        name = "anually";
+                        break;
+                default:
+                        return NULL;
+                }
+                break;
+        case 8:
+                switch (p[0] | 0x20) {
+                case 'm':
+                        s = &shorthands[0];
+                        name = "minutely";
+                        break;
+                case 'a':
+                        s = &shorthands[7];
+                        name = "annually";
+                        break;
+                default:
+                        return NULL;
+                }
+                break;
+        case 9:
+                s = &shorthands[5];
+                name = "quarterly";
+                break;
+        case 10:
+                s = &shorthands[6];
+                name = "biannually";
+                break;
+        case 11:
+                s = &shorthands[6];
+                name = "bi-annually";
+                break;
+        case 12:
+                s = &shorthands[6];
+                name = "semiannually";
+                break;
+        case 13:
+                s = &shorthands[6];
+                name = "semi-annually";
+                break;
+        default:
+                return NULL;
+        }
+
+        return strcaseeq(p, name) ? s : NULL;
 }
 
-int calendar_spec_from_string(const char *p, CalendarSpec **spec) {
-        CalendarSpec *c;
-        int r;
-        const char *utc;
+static int apply_shorthand(const CalendarShorthand *s, CalendarSpec *c) {
+        int r, k;
 
-        assert(p);
-        assert(spec);
+        assert(s);
+        assert(c);
 
-        if (isempty(p))
-                return -EINVAL;
+        c->weekdays_bits = s->weekdays_bits;
 
-        c = new0(CalendarSpec, 1);
-        if (!c)
-                return -ENOMEM;
+        for (k = 1; k <= 12; k++)
+                if (s->months & (1 << k)) {
+                        r = const_chain(k, c, &c->month);
+                        if (r < 0)
+                                return r;
+                }
 
-        utc = endswith_no_case(p, " UTC");
-        if (utc) {
-                c->utc = true;
-                p = strndupa(p, utc - p);
+        if (s->day > 0) {
+                r = const_chain(s->day, c, &c->day);
+                if (r < 0)
+                        return r;
         }
 
-        if (strcaseeq(p, "minutely")) {
-                r = const_chain(0, &c->second);
+        switch (s->upto) {
+        case UPTO_HOUR:
+                r = const_chain(0, c, &c->hour);
                 if (r < 0)
-                        goto fail;
-
-        } else if (strcaseeq(p, "hourly")) {
-                r = const_chain(0, &c->minute);
+                        return r;
+                /* fall through */
+        case UPTO_MINUTE:
+                r = const_chain(0, c, &c->minute);
                 if (r < 0)
-                        goto fail;
-                r = const_chain(0, &c->second);
+                        return r;
+                /* fall through */
+        case UPTO_SECOND:
+                r = const_chain(0, c, &c->second);
                 if (r < 0)
-                        goto fail;
+                        return r;
+        }
 
-        } else if (strcaseeq(p, "daily")) {
-                r = const_chain(0, &c->hour);
-                if (r < 0)
-                        goto fail;
-                r = const_chain(0, &c->minute);
-                if (r < 0)
-                        goto fail;
-                r = const_chain(0, &c->second);
-                if (r < 0)
-                        goto fail;
+        return 0;
+}
 
-        } else if (strcaseeq(p, "monthly")) {
-                r = const_chain(1, &c->day);
-                if (r < 0)
-                        goto fail;
-                r = const_chain(0, &c->hour);
-                if (r < 0)
-                        goto fail;
-                r = const_chain(0, &c->minute);
-                if (r < 0)
-                        goto fail;
-                r = const_chain(0, &c->second);
-                if (r < 0)
-                        goto fail;
+static int find_next(const CalendarSpec *spec, CalendarTime *tm, unsigned *budget);
 
-        } else if (strcaseeq(p, "annually") ||
-                   strcaseeq(p, "yearly") ||
-                   strcaseeq(p, "anually") /* backwards compatibility */ ) {
+/* Rejects specs like "*-02-30" which no civil time matches, by searching
+ * for the first match in the supported range of years. */
+static int check_can_match(const CalendarSpec *c) {
+        CalendarTime t = {
+                .year = YEAR_MIN,
+                .month = 1,
+                .day = 1,
+        };
+        unsigned budget = CALENDAR_SEARCH_BUDGET_DEFAULT;
+        int r;
 
-                r = const_chain(1, &c->month);
-                if (r < 0)
-                        goto fail;
-                r = const_chain(1, &c->day);
-                if (r < 0)
-                        goto fail;
-                r = const_chain(0, &c->hour);
-                if (r < 0)
-                        goto fail;
-                r = const_chain(0, &c->minute);
-                if (r < 0)
-                        goto fail;
-                r = const_chain(0, &c->second);
-                if (r < 0)
-                        goto fail;
+        r = find_next(c, &t, &budget);
+        if (r == -ENOENT)
+                return -EDOM;
+        if (r == -ETIME)
+                return 0;
 
-        } else if (strcaseeq(p, "weekly")) {
+        return r;
+}
 
-                c->weekdays_bits = 1;
+int calendar_spec_from_string(const char *p, CalendarSpec **spec) {
+        const CalendarShorthand *shorthand;
+        CalendarSpec *c;
+        int r;
+        const char *utc;
 
-                r = const_chain(0, &c->hour);
-                if (r < 0)
-                        goto fail;
-                r = const_chain(0, &c->minute);
-                if (r < 0)
-                        goto fail;
-                r = const_chain(0, &c->second);
-                if (r < 0)
-                        goto fail;
+        assert(p);
+        assert(spec);
 
-        } else if (strcaseeq(p, "quarterly")) {
+        if (isempty(p))
+                return -EINVAL;
 
-                r = const_chain(1, &c->month);
-                if (r < 0)
-                        goto fail;
-                r = const_chain(4, &c->month);
-                if (r < 0)
-                        goto fail;
-                r = const_chain(7, &c->month);
-                if (r < 0)
-                        goto fail;
-                r = const_chain(10, &c->month);
-                if (r < 0)
-                        goto fail;
-                r = const_chain(1, &c->day);
-                if (r < 0)
-                        goto fail;
-                r = const_chain(0, &c->hour);
-                if (r < 0)
-                        goto fail;
-                r = const_chain(0, &c->minute);
-                if (r < 0)
-                        goto fail;
-                r = const_chain(0, &c->second);
-                if (r < 0)
-                        goto fail;
+        /* A chain needs one component per value, and the values of a
+         * chain are separated by ','. There are six chains, so the
+         * components never outnumber the ',' by more than six. The
+         * shorthands need up to eight. */
+        {
+                unsigned n = 8;
+                const char *i;
 
-        } else if (strcaseeq(p, "biannually") ||
-                   strcaseeq(p, "bi-annually") ||
-                   strcaseeq(p, "semiannually") ||
-                   strcaseeq(p, "semi-annually")) {
+                for (i = p; (i = strchr(i, ',')); i++)
+                        n++;
 
-                r = const_chain(1, &c->month);
-                if (r < 0)
-                        goto fail;
-                r = const_chain(7, &c->month);
-                if (r < 0)
-                        goto fail;
-                r = const_chain(1, &c->day);
-                if (r < 0)
-                        goto fail;
-                r = const_chain(0, &c->hour);
-                if (r < 0)
-                        goto fail;
-                r = const_chain(0, &c->minute);
-                if (r < 0)
-                        goto fail;
-                r = const_chain(0, &c->second);
+                c = calendar_spec_new(n, CALENDAR_SPEC_FORMAT_ROOM(n, strlen(p)));
+        }
+        if (!c)
+                return -ENOMEM;
+
+        utc = endswith_no_case(p, " UTC");
+        if (utc) {
+                c->utc = true;
+                p = strndupa(p, utc - p);
+        } else {
+                const char *tz;
+
+                /* A trailing time zone name like "Europe/Berlin". If the
+                 * last word does not name a time zone, leave it to the
+                 * parser below to complain. */
+                tz = strrchr(p, ' ');
+                if (tz && tzfile_name_is_valid(tz + 1) &&
+                    tzfile_load(tz + 1, &c->tz) >= 0)
+                        p = strndupa(p, tz - p);
+        }
+
+        shorthand = shorthand_from_name(p);
+        if (shorthand) {
+                r = apply_shorthand(shorthand, c);
                 if (r < 0)
                         goto fail;
 
@@ -883,6 +1146,10 @@ int calendar_spec_from_string(const char *p, CalendarSpec **spec) {
                 goto fail;
         }
 
+        r = check_can_match(c);
+        if (r < 0)
+                goto fail;
+
         *spec = c;
         return 0;
 
@@ -934,148 +1201,1439 @@ static int find_matching_component(const CalendarComponent *c, int *val) {
         return r;
 }
 
-static bool tm_out_of_bounds(const struct tm *tm, bool utc) {
-        struct tm t;
-        assert(tm);
+/* Like find_matching_component(), but on the compiled bitmask: the next
+ * matching value is the lowest set bit at or above *val. */
+static int find_matching_bit(uint64_t bits, int *val) {
+        int d;
 
-        t = *tm;
+        assert(val);
 
-        if (mktime_or_timegm(&t, utc) == (time_t) -1)
-                return true;
+        if (*val < 0)
+                *val = 0;
+        if (*val >= 64)
+                return -ENOENT;
 
-        /* Did any normalization take place? If so, it was out of bounds before */
-        return
-                t.tm_year != tm->tm_year ||
-                t.tm_mon != tm->tm_mon ||
-                t.tm_mday != tm->tm_mday ||
-                t.tm_hour != tm->tm_hour ||
-                t.tm_min != tm->tm_min ||
-                t.tm_sec != tm->tm_sec;
+        bits &= UINT64_MAX << *val;
+        if (bits == 0)
+                return -ENOENT;
+
+        d = __builtin_ctzll(bits);
+
+        if (d == *val)
+                return 0;
+
+        *val = d;
+        return 1;
 }
 
-static bool matches_weekday(int weekdays_bits, const struct tm *tm, bool utc) {
-        struct tm t;
-        int k;
+/* The reverse of find_matching_component(): finds the largest matching
+ * value at or below *val. */
+static int find_matching_component_prev(const CalendarComponent *c, int *val) {
+        int d = -1;
+        bool d_set = false;
+        int r;
 
-        if (weekdays_bits < 0 || weekdays_bits >= BITS_WEEKDAYS)
-                return true;
+        assert(val);
 
-        t = *tm;
-        if (mktime_or_timegm(&t, utc) == (time_t) -1)
-                return false;
+        if (!c)
+                return 0;
+
+        for (; c; c = c->next) {
+                int k;
+
+                if (c->value > *val)
+                        continue;
+
+                if (c->repeat > 0)
+                        k = c->value + c->repeat * ((*val - c->value) / c->repeat);
+                else
+                        k = c->value;
+
+                if (!d_set || k > d) {
+                        d = k;
+                        d_set = true;
+                }
+        }
+
+        if (!d_set)
+                return -ENOENT;
+
+        r = *val != d;
+        *val = d;
+        return r;
+}
+
+/* The reverse of find_matching_bit(): the highest set bit at or below
+ * *val. */
+static int find_matching_bit_prev(uint64_t bits, int *val) {
+        int d;
+
+        assert(val);
+
+        if (*val < 0)
+                return -ENOENT;
+        if (*val < 63)
+                bits &= (UINT64_C(2) << *val) - 1;
+
+        if (bits == 0)
+                return -ENOENT;
+
+        d = 63 - __builtin_clzll(bits);
+
+        if (d == *val)
+                return 0;
+
+        *val = d;
+        return 1;
+}
+
+/* Carry over fields which got incremented past the end of their range.
+ * find_next() never increments by more than one, and always resets
+ * the smaller fields, so a single pass is enough. */
+static void calendar_time_carry(CalendarTime *c) {
+        assert(c);
+
+        if (c->second >= 60) {
+                c->second = 0;
+                c->minute++;
+        }
+        if (c->minute >= 60) {
+                c->minute = 0;
+                c->hour++;
+        }
+        if (c->hour >= 24) {
+                c->hour = 0;
+                c->day++;
+        }
+        if (c->month <= 12 && c->day > days_in_month(c->year, c->month)) {
+                c->day = 1;
+                c->month++;
+        }
+        if (c->month > 12) {
+                c->month = 1;
+                c->year++;
+        }
+}
+
+/* The days of the given month which match both the day and the weekday
+ * fields of the spec, bit n for day n. The weekdays of the month repeat
+ * every seven days, starting with the weekday of the first, so the
+ * weekday field is rotated to start there and repeated over the
+ * month. */
+static uint32_t month_day_bits(const CalendarSpec *spec, int year, int month) {
+        uint64_t week;
+        uint32_t bits;
+        int w;
+
+        bits = spec->day_bits & (uint32_t) ((UINT64_C(2) << days_in_month(year, month)) - 2);
+        if (bits == 0 || spec->weekdays_bits < 0 || spec->weekdays_bits >= BITS_WEEKDAYS)
+                return bits;
+
+        w = weekday_from_days(days_from_civil(year, month, 1));
+        week = ((spec->weekdays_bits >> w) | (spec->weekdays_bits << (7 - w))) & BITS_WEEKDAYS;
+        week |= week << 7;
+        week |= week << 14;
+        week |= week << 28;
+
+        return bits & (uint32_t) (week << 1);
+}
+
+/* The first set bit of the week bitmap at or after minute m, wrapping
+ * around at the end of the week. The result is not reduced, i.e. it is
+ * in m ... m + CALENDAR_MINUTES_PER_WEEK - 1. */
+static int week_find_next_bit(const uint64_t *bits, int m) {
+        uint64_t x;
+        int w;
+
+        x = bits[m / 64] & (~UINT64_C(0) << (m % 64));
+        for (w = m / 64; w < CALENDAR_WEEK_WORDS * 2; ) {
+                if (x)
+                        return (w / CALENDAR_WEEK_WORDS) * CALENDAR_MINUTES_PER_WEEK +
+                                (w % CALENDAR_WEEK_WORDS) * 64 + __builtin_ctzll(x);
+
+                w++;
+                x = bits[w % CALENDAR_WEEK_WORDS];
+        }
+
+        /* Never reached, specs which never match are refused */
+        return -1;
+}
+
+static int find_next_weekly(const CalendarSpec *spec, CalendarTime *tm, unsigned *budget) {
+        CalendarTime c;
+        int64_t days;
+        int m, k, minutes;
+
+        if (*budget == 0)
+                return -ETIME;
+        (*budget)--;
+
+        c = *tm;
+        calendar_time_carry(&c);
+
+        /* A cursor within a minute continues with the next one */
+        days = days_from_civil(c.year, c.month, c.day);
+        minutes = c.hour * 60 + c.minute + (c.second > 0);
+        m = weekday_from_days(days) * 1440 + minutes;
+
+        k = week_find_next_bit(spec->week_bits, m);
+        if (k < 0)
+                return -ENOENT;
+
+        minutes += k - m;
+        days += minutes / 1440;
+        minutes %= 1440;
 
-        k = t.tm_wday == 0 ? 6 : t.tm_wday - 1;
-        return (weekdays_bits & (1 << k));
+        civil_from_days(days, &c.year, &c.month, &c.day);
+        if (c.year > YEAR_MAX)
+                return -ENOENT;
+
+        c.hour = minutes / 60;
+        c.minute = minutes % 60;
+        c.second = 0;
+
+        *tm = c;
+        return 0;
 }
 
-static int find_next(const CalendarSpec *spec, struct tm *tm) {
-        struct tm c;
+static int find_next(const CalendarSpec *spec, CalendarTime *tm, unsigned *budget) {
+        CalendarTime c;
         int r;
 
         assert(spec);
         assert(tm);
+        assert(budget);
+
+        if (spec->weekly)
+                return find_next_weekly(spec, tm, budget);
 
         c = *tm;
 
         for (;;) {
-                /* Normalize the current date */
-                mktime_or_timegm(&c, spec->utc);
-                c.tm_isdst = -1;
+                if (*budget == 0)
+                        return -ETIME;
+                (*budget)--;
 
-                c.tm_year += 1900;
-                r = find_matching_component(spec->year, &c.tm_year);
-                c.tm_year -= 1900;
+                calendar_time_carry(&c);
 
+                r = find_matching_component(spec->year, &c.year);
                 if (r > 0) {
-                        c.tm_mon = 0;
-                        c.tm_mday = 1;
-                        c.tm_hour = c.tm_min = c.tm_sec = 0;
+                        c.month = 1;
+                        c.day = 1;
+                        c.hour = c.minute = c.second = 0;
                 }
-                if (r < 0 || tm_out_of_bounds(&c, spec->utc))
+                if (r < 0)
                         return r;
+                if (c.year > YEAR_MAX)
+                        return -ENOENT;
 
-                c.tm_mon += 1;
-                r = find_matching_component(spec->month, &c.tm_mon);
-                c.tm_mon -= 1;
-
+                r = find_matching_bit(spec->month_bits, &c.month);
                 if (r > 0) {
-                        c.tm_mday = 1;
-                        c.tm_hour = c.tm_min = c.tm_sec = 0;
+                        c.day = 1;
+                        c.hour = c.minute = c.second = 0;
+                }
+                if (r < 0) {
+                        c.year++;
+                        c.month = 1;
+                        c.day = 1;
+                        c.hour = c.minute = c.second = 0;
+                        continue;
+                }
+
+                r = find_matching_bit(month_day_bits(spec, c.year, c.month), &c.day);
+                if (r > 0)
+                        c.hour = c.minute = c.second = 0;
+                if (r < 0) {
+                        c.month++;
+                        c.day = 1;
+                        c.hour = c.minute = c.second = 0;
+                        continue;
                 }
-                if (r < 0 || tm_out_of_bounds(&c, spec->utc)) {
-                        c.tm_year ++;
-                        c.tm_mon = 0;
-                        c.tm_mday = 1;
-                        c.tm_hour = c.tm_min = c.tm_sec = 0;
+
+                r = find_matching_bit(spec->hour_bits, &c.hour);
+                if (r > 0)
+                        c.minute = c.second = 0;
+                if (r < 0) {
+                        c.day++;
+                        c.hour = c.minute = c.second = 0;
                         continue;
                 }
 
-                r = find_matching_component(spec->day, &c.tm_mday);
+                r = find_matching_bit(spec->minute_bits, &c.minute);
                 if (r > 0)
-                        c.tm_hour = c.tm_min = c.tm_sec = 0;
-                if (r < 0 || tm_out_of_bounds(&c, spec->utc)) {
-                        c.tm_mon ++;
-                        c.tm_mday = 1;
-                        c.tm_hour = c.tm_min = c.tm_sec = 0;
+                        c.second = 0;
+                if (r < 0) {
+                        c.hour++;
+                        c.minute = c.second = 0;
+                        continue;
+                }
+
+                r = find_matching_bit(spec->second_bits, &c.second);
+                if (r < 0) {
+                        c.minute++;
+                        c.second = 0;
                         continue;
                 }
 
-                if (!matches_weekday(spec->weekdays_bits, &c, spec->utc)) {
-                        c.tm_mday++;
-                        c.tm_hour = c.tm_min = c.tm_sec = 0;
+                *tm = c;
+                return 0;
+        }
+}
+
+/* The reverse of calendar_time_carry(), for fields which got
+ * decremented below the start of their range by find_prev(). */
+static void calendar_time_borrow(CalendarTime *c) {
+        assert(c);
+
+        if (c->second < 0) {
+                c->second = 59;
+                c->minute--;
+        }
+        if (c->minute < 0) {
+                c->minute = 59;
+                c->hour--;
+        }
+        if (c->hour < 0) {
+                c->hour = 23;
+                c->day--;
+        }
+        if (c->day < 1) {
+                c->month--;
+                if (c->month < 1) {
+                        c->month = 12;
+                        c->year--;
+                }
+                c->day = days_in_month(c->year, c->month);
+        }
+}
+
+#define CALENDAR_TIME_END_OF_DAY(c)                             \
+        do {                                                    \
+                (c).hour = 23;                                  \
+                (c).minute = (c).second = 59;                   \
+        } while (false)
+
+/* Finds the latest civil time at or before *tm which matches the spec,
+ * walking the fields like find_next() does, just backwards. */
+static int find_prev(const CalendarSpec *spec, CalendarTime *tm, unsigned *budget) {
+        CalendarTime c;
+        int r;
+
+        assert(spec);
+        assert(tm);
+        assert(budget);
+
+        c = *tm;
+
+        for (;;) {
+                if (*budget == 0)
+                        return -ETIME;
+                (*budget)--;
+
+                calendar_time_borrow(&c);
+
+                if (c.year < YEAR_MIN)
+                        return -ENOENT;
+
+                r = find_matching_component_prev(spec->year, &c.year);
+                if (r > 0) {
+                        c.month = 12;
+                        c.day = 31;
+                        CALENDAR_TIME_END_OF_DAY(c);
+                }
+                if (r < 0 || c.year < YEAR_MIN)
+                        return -ENOENT;
+
+                r = find_matching_bit_prev(spec->month_bits, &c.month);
+                if (r > 0) {
+                        c.day = days_in_month(c.year, c.month);
+                        CALENDAR_TIME_END_OF_DAY(c);
+                }
+                if (r < 0) {
+                        c.year--;
+                        c.month = 12;
+                        c.day = 31;
+                        CALENDAR_TIME_END_OF_DAY(c);
                         continue;
                 }
 
-                r = find_matching_component(spec->hour, &c.tm_hour);
+                r = find_matching_bit_prev(month_day_bits(spec, c.year, c.month), &c.day);
                 if (r > 0)
-                        c.tm_min = c.tm_sec = 0;
-                if (r < 0 || tm_out_of_bounds(&c, spec->utc)) {
-                        c.tm_mday ++;
-                        c.tm_hour = c.tm_min = c.tm_sec = 0;
+                        CALENDAR_TIME_END_OF_DAY(c);
+                if (r < 0) {
+                        c.day = 0;
+                        CALENDAR_TIME_END_OF_DAY(c);
                         continue;
                 }
 
-                r = find_matching_component(spec->minute, &c.tm_min);
+                r = find_matching_bit_prev(spec->hour_bits, &c.hour);
                 if (r > 0)
-                        c.tm_sec = 0;
-                if (r < 0 || tm_out_of_bounds(&c, spec->utc)) {
-                        c.tm_hour ++;
-                        c.tm_min = c.tm_sec = 0;
+                        c.minute = c.second = 59;
+                if (r < 0) {
+                        c.day--;
+                        CALENDAR_TIME_END_OF_DAY(c);
                         continue;
                 }
 
-                r = find_matching_component(spec->second, &c.tm_sec);
-                if (r < 0 || tm_out_of_bounds(&c, spec->utc)) {
-                        c.tm_min ++;
-                        c.tm_sec = 0;
+                r = find_matching_bit_prev(spec->minute_bits, &c.minute);
+                if (r > 0)
+                        c.second = 59;
+                if (r < 0) {
+                        c.hour--;
+                        c.minute = c.second = 59;
                         continue;
                 }
 
+                r = find_matching_bit_prev(spec->second_bits, &c.second);
+                if (r < 0) {
+                        c.minute--;
+                        c.second = 59;
+                        continue;
+                }
 
                 *tm = c;
                 return 0;
         }
 }
 
-int calendar_spec_next_usec(const CalendarSpec *spec, usec_t usec, usec_t *next) {
+static void calendar_time_from_seconds(int64_t t, CalendarTime *ret) {
+        int64_t days, secs;
+
+        days = t / 86400;
+        secs = t % 86400;
+        if (secs < 0) {
+                secs += 86400;
+                days--;
+        }
+
+        civil_from_days(days, &ret->year, &ret->month, &ret->day);
+        ret->hour = (int) (secs / 3600);
+        ret->minute = (int) (secs / 60 % 60);
+        ret->second = (int) (secs % 60);
+}
+
+static int64_t calendar_time_to_seconds(const CalendarTime *c) {
+        return days_from_civil(c->year, c->month, c->day) * 86400 +
+                c->hour * 3600 + c->minute * 60 + c->second;
+}
+
+/* The zone a spec is evaluated in: its own, or the one of ctx, or
+ * without both the local time zone of the C library. */
+static CalendarZone calendar_zone_resolve(const CalendarSpec *spec, const CalendarEvalCtx *ctx) {
+        if (spec->utc || spec->tz)
+                return (CalendarZone) { .utc = spec->utc, .tz = spec->tz };
+
+        if (ctx)
+                return ctx->zone;
+
+        return (CalendarZone) {};
+}
+
+/* Converts a point in time into the civil time of the zone. Without a
+ * TZif zone this is the only place, besides calendar_time_to_time_t(),
+ * which asks the C library about the local time zone. */
+static int calendar_time_from_time_t(const CalendarZone *zone, time_t t, CalendarTime *ret) {
         struct tm tm;
-        time_t t;
-        int r;
 
-        assert(spec);
-        assert(next);
+        assert(zone);
+        assert(ret);
 
-        t = (time_t) (usec / USEC_PER_SEC) + 1;
-        assert_se(localtime_or_gmtime_r(&t, &tm, spec->utc));
+        if (zone->utc) {
+                calendar_time_from_seconds(t, ret);
+                return 0;
+        }
 
-        r = find_next(spec, &tm);
-        if (r < 0)
-                return r;
+        if (zone->tz) {
+                calendar_time_from_seconds(t + tzfile_get_offset(zone->tz, t, NULL), ret);
+                return 0;
+        }
 
-        t = mktime_or_timegm(&tm, spec->utc);
-        if (t == (time_t) -1)
+        if (!localtime_r(&t, &tm))
                 return -EINVAL;
 
-        *next = (usec_t) t * USEC_PER_SEC;
+        *ret = (CalendarTime) {
+                .year = tm.tm_year + 1900,
+                .month = tm.tm_mon + 1,
+                .day = tm.tm_mday,
+                .hour = tm.tm_hour,
+                .minute = tm.tm_min,
+                .second = tm.tm_sec,
+        };
+
+        /* Leap seconds are matched as the last second of the minute */
+        if (ret->second > 59)
+                ret->second = 59;
+
+        return 0;
+}
+
+static bool tm_matches_calendar_time(const struct tm *tm, const CalendarTime *c) {
+        return
+                tm->tm_year + 1900 == c->year &&
+                tm->tm_mon + 1 == c->month &&
+                tm->tm_mday == c->day &&
+                tm->tm_hour == c->hour &&
+                tm->tm_min == c->minute &&
+                tm->tm_sec == c->second;
+}
+
+static int mktime_calendar_time(const CalendarTime *c, int isdst, time_t *ret, bool *ret_dst) {
+        struct tm tm = {
+                .tm_year = c->year - 1900,
+                .tm_mon = c->month - 1,
+                .tm_mday = c->day,
+                .tm_hour = c->hour,
+                .tm_min = c->minute,
+                .tm_sec = c->second,
+                .tm_isdst = isdst,
+        };
+        time_t t;
+
+        t = mktime(&tm);
+        if (t == (time_t) -1 || !tm_matches_calendar_time(&tm, c))
+                return -ENOENT;
+
+        *ret = t;
+        if (ret_dst)
+                *ret_dst = tm.tm_isdst > 0;
         return 0;
 }
+
+/* Converts a civil time back into the earliest point in time which is
+ * not before not_before. Returns -ENOENT if the civil time does not
+ * exist in the local time zone (i.e. it falls into a DST gap), or only
+ * exists before not_before. */
+static int calendar_time_to_time_t(const CalendarZone *zone, const CalendarTime *c, time_t not_before, time_t *ret) {
+        time_t t, d;
+        bool dst;
+        int r;
+
+        assert(zone);
+        assert(c);
+        assert(ret);
+
+        if (zone->utc) {
+                t = (time_t) calendar_time_to_seconds(c);
+                if (t < not_before)
+                        return -ENOENT;
+
+                *ret = t;
+                return 0;
+        }
+
+        if (zone->tz) {
+                int64_t u;
+
+                r = tzfile_local_to_utc(zone->tz, calendar_time_to_seconds(c), not_before, &u);
+                if (r < 0)
+                        return r;
+
+                *ret = (time_t) u;
+                return 0;
+        }
+
+        r = mktime_calendar_time(c, -1, &t, &dst);
+        if (r < 0) {
+                /* mktime() might have guessed the wrong DST state */
+                if (mktime_calendar_time(c, 0, &t, NULL) < 0 &&
+                    mktime_calendar_time(c, 1, &t, NULL) < 0)
+                        return -ENOENT;
+                dst = false;
+        }
+
+        /* In the hour which is repeated at the end of DST the civil time
+         * exists twice, the first time with DST. Which one mktime() picks
+         * depends on its internal state, so look for the other one if the
+         * DST one might have been missed, or if the one we got is too
+         * early. */
+        if ((!dst && daylight) || t < not_before) {
+                if (mktime_calendar_time(c, !dst, &d, NULL) >= 0 && d >= not_before &&
+                    (t < not_before || d < t))
+                        t = d;
+        }
+
+        if (t < not_before)
+                return -ENOENT;
+
+        *ret = t;
+        return 0;
+}
+
+/* The reverse of calendar_time_to_time_t(): the latest point in time
+ * with the given civil time which is not after not_after. */
+static int calendar_time_to_time_t_last(const CalendarZone *zone, const CalendarTime *c, time_t not_after, time_t *ret) {
+        time_t t = 0, d;
+        bool found = false;
+
+        assert(zone);
+        assert(c);
+        assert(ret);
+
+        if (zone->utc) {
+                t = (time_t) calendar_time_to_seconds(c);
+                if (t > not_after)
+                        return -ENOENT;
+
+                *ret = t;
+                return 0;
+        }
+
+        if (zone->tz) {
+                int64_t u;
+                int r;
+
+                r = tzfile_local_to_utc_last(zone->tz, calendar_time_to_seconds(c), not_after, &u);
+                if (r < 0)
+                        return r;
+
+                *ret = (time_t) u;
+                return 0;
+        }
+
+        /* Ask for both DST states, in the repeated hour both exist */
+        if (mktime_calendar_time(c, 0, &d, NULL) >= 0 && d <= not_after) {
+                t = d;
+                found = true;
+        }
+        if (mktime_calendar_time(c, 1, &d, NULL) >= 0 && d <= not_after && (!found || d > t)) {
+                t = d;
+                found = true;
+        }
+
+        if (!found)
+                return -ENOENT;
+
+        *ret = t;
+        return 0;
+}
+
+/* Offset of the civil time of the zone against UTC at the given point
+ * in time, in seconds. */
+static long calendar_zone_get_offset(const CalendarZone *zone, time_t t) {
+        struct tm tm;
+
+        assert(zone);
+
+        if (zone->utc)
+                return 0;
+
+        if (zone->tz)
+                return tzfile_get_offset(zone->tz, t, NULL);
+
+        if (!localtime_r(&t, &tm))
+                return 0;
+
+        return tm.tm_gmtoff;
+}
+
+/* Moves c out of the DST gap it is in, to the first existing civil time
+ * after it (direction 1) or the last one before it (direction -1). The
+ * day next to c is bisected, gaps are always shorter than that. */
+static int skip_gap(const CalendarZone *zone, CalendarTime *c, int direction, unsigned *budget) {
+        int64_t gap, exists, mid;
+        CalendarTime x;
+        time_t t;
+
+        gap = calendar_time_to_seconds(c);
+        exists = gap + direction * 86400;
+
+        while (exists - gap > 1 || gap - exists > 1) {
+                if (*budget == 0)
+                        return -ETIME;
+                (*budget)--;
+
+                mid = gap + (exists - gap) / 2;
+                calendar_time_from_seconds(mid, &x);
+                if (calendar_time_to_time_t(zone, &x, -TIME_T_MAX, &t) >= 0)
+                        exists = mid;
+                else
+                        gap = mid;
+        }
+
+        calendar_time_from_seconds(exists, c);
+        return 0;
+}
+
+static bool calendar_time_exists(const CalendarZone *zone, const CalendarTime *c) {
+        time_t t;
+
+        return calendar_time_to_time_t(zone, c, -TIME_T_MAX, &t) >= 0;
+}
+
+/* Local time goes backwards when DST ends, so shortly before that, the
+ * civil times from the one DST ends at up to the one of t come again
+ * after t. If that is the case, returns true and the point in time DST
+ * ends at. */
+static bool calendar_zone_repeats_ahead(const CalendarZone *zone, time_t t, time_t *ret) {
+        long offset, o;
+        time_t lo, hi, mid;
+
+        assert(zone);
+        assert(ret);
+
+        if (zone->utc)
+                return false;
+
+        offset = calendar_zone_get_offset(zone, t);
+        o = calendar_zone_get_offset(zone, t + 86400);
+        if (o >= offset || calendar_zone_get_offset(zone, t + (offset - o)) >= offset)
+                return false;
+
+        lo = t;
+        hi = t + (offset - o);
+        while (hi - lo > 1) {
+                mid = lo + (hi - lo) / 2;
+                if (calendar_zone_get_offset(zone, mid) < offset)
+                        hi = mid;
+                else
+                        lo = mid;
+        }
+
+        *ret = hi;
+        return true;
+}
+
+static int find_prev_time_t(const CalendarSpec *spec, const CalendarZone *zone, CalendarTime c, time_t not_after, unsigned *budget, time_t *ret) {
+        int r;
+
+        for (;;) {
+                r = find_prev(spec, &c, budget);
+                if (r < 0)
+                        return r;
+
+                r = calendar_time_to_time_t_last(zone, &c, not_after, ret);
+                if (r != -ENOENT)
+                        return r;
+
+                /* This civil time does not exist, continue right before it,
+                 * or before the whole DST gap */
+                if (calendar_time_exists(zone, &c))
+                        c.second--;
+                else {
+                        r = skip_gap(zone, &c, -1, budget);
+                        if (r < 0)
+                                return r;
+                }
+        }
+}
+
+int calendar_spec_prev_usec_ctx(const CalendarSpec *spec, const CalendarEvalCtx *ctx,
+                                usec_t usec, usec_t *prev) {
+        unsigned budget = CALENDAR_SEARCH_BUDGET_DEFAULT;
+        CalendarZone zone;
+        CalendarTime c;
+        time_t t, u, v;
+        long offset, o;
+        int r, q;
+
+        assert(spec);
+        assert(prev);
+
+        zone = calendar_zone_resolve(spec, ctx);
+
+        t = (time_t) (usec / USEC_PER_SEC);
+        r = calendar_time_from_time_t(&zone, t, &c);
+        if (r < 0)
+                return r;
+
+        r = find_prev_time_t(spec, &zone, c, t, &budget, &u);
+        if (r < 0 && r != -ENOENT)
+                return r;
+
+        /* Local time goes backwards when DST ends, so shortly after
+         * that, points in time before t can have a later civil time
+         * than t itself. These are not seen by the search above. */
+        offset = calendar_zone_get_offset(&zone, t);
+        o = calendar_zone_get_offset(&zone, t - 86400);
+        if (o > offset && calendar_zone_get_offset(&zone, t - (o - offset)) > offset) {
+                calendar_time_from_seconds(calendar_time_to_seconds(&c) + (o - offset), &c);
+
+                q = find_prev_time_t(spec, &zone, c, t, &budget, &v);
+                if (q < 0 && q != -ENOENT)
+                        return q;
+                if (q >= 0 && (r < 0 || v > u)) {
+                        u = v;
+                        r = 0;
+                }
+        }
+        if (r < 0)
+                return r;
+
+        *prev = (usec_t) u * USEC_PER_SEC;
+        return 0;
+}
+
+int calendar_spec_prev_usec(const CalendarSpec *spec, usec_t usec, usec_t *prev) {
+        return calendar_spec_prev_usec_ctx(spec, NULL, usec, prev);
+}
+
+int calendar_window_locate(const CalendarSpec *spec, usec_t duration, usec_t usec, usec_t *start) {
+        usec_t s;
+        int r;
+
+        assert(spec);
+        assert(start);
+
+        /* The first start after usec - duration is either in the past,
+         * then usec is inside its window, or it is the next window. */
+        r = calendar_spec_next_usec(spec, usec > duration ? usec - duration : 0, &s);
+        if (r < 0)
+                return r;
+
+        *start = s;
+        return s <= usec;
+}
+
+int calendar_spec_iter_init_ctx(CalendarSpecIter *i, const CalendarSpec *spec,
+                                const CalendarEvalCtx *ctx, usec_t usec) {
+        int r;
+
+        assert(i);
+        assert(spec);
+
+        i->zone = calendar_zone_resolve(spec, ctx);
+        i->not_before = (time_t) (usec / USEC_PER_SEC) + 1;
+
+        r = calendar_time_from_time_t(&i->zone, i->not_before, &i->cursor);
+        if (r < 0)
+                return r;
+
+        i->spec = spec;
+        i->offset = 0;
+        i->exact = true;
+        i->budget = CALENDAR_SEARCH_BUDGET_DEFAULT;
+        i->iterations = 0;
+
+        return 0;
+}
+
+int calendar_spec_iter_init(CalendarSpecIter *i, const CalendarSpec *spec, usec_t usec) {
+        return calendar_spec_iter_init_ctx(i, spec, NULL, usec);
+}
+
+/* The first elapse time among the civil times which come again after
+ * DST ended at transition, and which are before the civil time of
+ * not_before. */
+static int iter_step_repeated(CalendarSpecIter *i, time_t transition, unsigned *budget,
+                              CalendarTime *ret_cursor, time_t *ret) {
+        CalendarTime c, end;
+        int r;
+
+        r = calendar_time_from_time_t(&i->zone, transition, &c);
+        if (r < 0)
+                return r;
+
+        r = calendar_time_from_time_t(&i->zone, i->not_before, &end);
+        if (r < 0)
+                return r;
+
+        r = find_next(i->spec, &c, budget);
+        if (r < 0)
+                return r;
+        if (calendar_time_to_seconds(&c) >= calendar_time_to_seconds(&end))
+                return -ENOENT;
+
+        r = calendar_time_to_time_t(&i->zone, &c, transition, ret);
+        if (r < 0)
+                return r;
+
+        *ret_cursor = c;
+        return 0;
+}
+
+static int iter_step(CalendarSpecIter *i, unsigned *budget, time_t *ret) {
+        CalendarTime c;
+        time_t u = 0, v, transition;
+        long offset = 0;
+        int r, q;
+
+        for (;;) {
+                r = find_next(i->spec, &i->cursor, budget);
+                if (r == -ENOENT && !i->exact) {
+                        /* Civil times before the cursor might come
+                         * again, see below */
+                        r = calendar_time_from_time_t(&i->zone, i->not_before, &i->cursor);
+                        if (r < 0)
+                                return r;
+
+                        i->exact = true;
+                        continue;
+                }
+                if (r == -ENOENT)
+                        break;
+                if (r < 0)
+                        return r;
+
+                r = calendar_time_to_time_t(&i->zone, &i->cursor, i->not_before, &u);
+                if (r == -ENOENT) {
+                        /* This civil time does not exist, continue right after
+                         * it, or after the whole DST gap */
+                        if (calendar_time_exists(&i->zone, &i->cursor))
+                                i->cursor.second++;
+                        else {
+                                r = skip_gap(&i->zone, &i->cursor, 1, budget);
+                                if (r < 0)
+                                        return r;
+                        }
+                        continue;
+                }
+                if (r < 0)
+                        return r;
+
+                /* The cursor was advanced in civil time since the last
+                 * result. That is only the civil time of not_before if
+                 * the UTC offset did not change in between, otherwise
+                 * start over from the converted not_before. */
+                offset = (long) (calendar_time_to_seconds(&i->cursor) - (int64_t) u);
+                if (i->exact || offset == i->offset)
+                        break;
+
+                r = calendar_time_from_time_t(&i->zone, i->not_before, &i->cursor);
+                if (r < 0)
+                        return r;
+
+                i->exact = true;
+        }
+
+        /* The search starting at the civil time of not_before misses
+         * the civil times before it which come again at the end of DST */
+        if (i->exact && calendar_zone_repeats_ahead(&i->zone, i->not_before, &transition)) {
+                q = iter_step_repeated(i, transition, budget, &c, &v);
+                if (q < 0 && q != -ENOENT)
+                        return q;
+                if (q >= 0 && (r < 0 || v < u)) {
+                        i->cursor = c;
+                        offset = (long) (calendar_time_to_seconds(&c) - (int64_t) v);
+                        u = v;
+                        r = 0;
+                }
+        }
+        if (r < 0)
+                return r;
+
+        *ret = u;
+
+        i->not_before = u + 1;
+        i->offset = offset;
+        i->exact = false;
+        i->cursor.second++;
+
+        return 0;
+}
+
+int calendar_spec_iter_next(CalendarSpecIter *i, usec_t *next) {
+        unsigned budget;
+        time_t u;
+        int r;
+
+        assert(i);
+        assert(i->spec);
+        assert(next);
+
+        budget = i->budget;
+        r = iter_step(i, &budget, &u);
+        i->iterations = i->budget - budget;
+        if (r < 0)
+                return r;
+
+        *next = (usec_t) u * USEC_PER_SEC;
+        return 0;
+}
+
+static int next_usec_budget(const CalendarSpec *spec, const CalendarEvalCtx *ctx, usec_t usec,
+                            unsigned budget, usec_t *next, unsigned *ret_iterations) {
+        CalendarSpecIter i;
+        int r;
+
+        assert(spec);
+        assert(next);
+
+        r = calendar_spec_iter_init_ctx(&i, spec, ctx, usec);
+        if (r < 0)
+                return r;
+
+        i.budget = budget;
+        r = calendar_spec_iter_next(&i, next);
+        if (ret_iterations)
+                *ret_iterations = i.iterations;
+
+        return r;
+}
+
+int calendar_spec_next_usec_budget(const CalendarSpec *spec, usec_t usec, unsigned budget,
+                                   usec_t *next, unsigned *ret_iterations) {
+        return next_usec_budget(spec, NULL, usec, budget, next, ret_iterations);
+}
+
+int calendar_spec_next_usec(const CalendarSpec *spec, usec_t usec, usec_t *next) {
+        return next_usec_budget(spec, NULL, usec, CALENDAR_SEARCH_BUDGET_DEFAULT, next, NULL);
+}
+
+int calendar_spec_next_usec_ctx(const CalendarSpec *spec, const CalendarEvalCtx *ctx,
+                                usec_t usec, usec_t *next) {
+        return next_usec_budget(spec, ctx, usec, CALENDAR_SEARCH_BUDGET_DEFAULT, next, NULL);
+}
+
+void calendar_spec_batch_free(CalendarSpecBatch *b) {
+        if (!b)
+                return;
+
+        free(b->specs);
+        free(b->weekly);
+        free(b->week_words);
+        free(b->used_words);
+        free(b);
+}
+
+int calendar_spec_batch_new(CalendarSpec *const *specs, size_t n, CalendarSpecBatch **ret) {
+        CalendarSpecBatch *b;
+        size_t k, w, nw;
+
+        assert(specs || n == 0);
+        assert(ret);
+
+        b = new0(CalendarSpecBatch, 1);
+        if (!b)
+                return -ENOMEM;
+
+        b->n_specs = n;
+        b->specs = new0(const CalendarSpec*, n ?: 1);
+        b->weekly = new0(size_t, n ?: 1);
+        if (!b->specs || !b->weekly) {
+                calendar_spec_batch_free(b);
+                return -ENOMEM;
+        }
+
+        for (k = 0; k < n; k++) {
+                b->specs[k] = specs[k];
+                if (specs[k]->weekly)
+                        b->weekly[b->n_weekly++] = k;
+        }
+
+        nw = b->n_weekly;
+        b->week_words = new0(uint64_t, CALENDAR_WEEK_WORDS * nw ?: 1);
+        b->used_words = new0(uint64_t, CALENDAR_USED_WORDS * nw ?: 1);
+        if (!b->week_words || !b->used_words) {
+                calendar_spec_batch_free(b);
+                return -ENOMEM;
+        }
+
+        for (k = 0; k < nw; k++)
+                for (w = 0; w < CALENDAR_WEEK_WORDS; w++) {
+                        uint64_t x = specs[b->weekly[k]]->week_bits[w];
+
+                        b->week_words[w * nw + k] = x;
+                        if (x != 0)
+                                b->used_words[w / 64 * nw + k] |= UINT64_C(1) << (w % 64);
+                }
+
+        *ret = b;
+        return 0;
+}
+
+/* The first word at or after word w in which the map of weekly spec k
+ * has a bit set, wrapping around once, found in the map of used words.
+ * Like week_find_next_bit() the result is not reduced. */
+static int batch_find_next_word(const CalendarSpecBatch *b, size_t k, int w) {
+        size_t nw = b->n_weekly;
+        uint64_t x;
+        int u;
+
+        x = b->used_words[(size_t) (w / 64) * nw + k] & (~UINT64_C(0) << (w % 64));
+        for (u = w / 64; u < CALENDAR_USED_WORDS * 2; ) {
+                if (x)
+                        return (u / CALENDAR_USED_WORDS) * CALENDAR_WEEK_WORDS +
+                                (u % CALENDAR_USED_WORDS) * 64 + __builtin_ctzll(x);
+
+                u++;
+                x = b->used_words[(size_t) (u % CALENDAR_USED_WORDS) * nw + k];
+        }
+
+        return -1;
+}
+
+/* The zones in which specs share conversions: the default one and UTC.
+ * Specs with their own zone have their own TZFile, which converts
+ * without locks anyway. */
+enum {
+        BATCH_ZONE_DEFAULT,
+        BATCH_ZONE_UTC,
+        _BATCH_ZONE_SHARED,
+        BATCH_ZONE_OWN = _BATCH_ZONE_SHARED,
+};
+
+/* Civil times most weekly specs elapse at are few, e.g. full hours, so
+ * their conversion to UTC is remembered. */
+#define BATCH_MEMO_SIZE 1024
+
+typedef struct BatchMemo {
+        int64_t local;
+        time_t t;
+        int r;
+        bool valid;
+} BatchMemo;
+
+typedef struct BatchState {
+        const CalendarEvalCtx *ctx;
+        time_t not_before;
+
+        CalendarTime cursor[_BATCH_ZONE_SHARED];
+        bool have_cursor[_BATCH_ZONE_SHARED];
+
+        /* 0 if not known yet, 1 if not, 2 if civil times repeat soon */
+        uint8_t repeats[_BATCH_ZONE_SHARED];
+
+        BatchMemo *memo;
+} BatchState;
+
+static int batch_zone(const CalendarSpec *spec, const CalendarZone *zone) {
+        if (spec->tz)
+                return BATCH_ZONE_OWN;
+
+        return zone->utc && !zone->tz ? BATCH_ZONE_UTC : BATCH_ZONE_DEFAULT;
+}
+
+/* The civil time of not_before in the zone of the spec */
+static int batch_cursor(BatchState *s, const CalendarSpec *spec, CalendarZone *ret_zone, CalendarTime *ret) {
+        CalendarZone zone;
+        int z, r;
+
+        zone = calendar_zone_resolve(spec, s->ctx);
+        z = batch_zone(spec, &zone);
+
+        if (z != BATCH_ZONE_OWN && s->have_cursor[z])
+                *ret = s->cursor[z];
+        else {
+                r = calendar_time_from_time_t(&zone, s->not_before, ret);
+                if (r < 0)
+                        return r;
+
+                if (z != BATCH_ZONE_OWN) {
+                        s->cursor[z] = *ret;
+                        s->have_cursor[z] = true;
+                }
+        }
+
+        *ret_zone = zone;
+        return 0;
+}
+
+static int batch_time_to_time_t(BatchState *s, const CalendarSpec *spec, const CalendarZone *zone,
+                                const CalendarTime *c, time_t *ret) {
+        BatchMemo *m;
+        int64_t local;
+
+        if (batch_zone(spec, zone) != BATCH_ZONE_DEFAULT || !s->memo)
+                return calendar_time_to_time_t(zone, c, s->not_before, ret);
+
+        local = calendar_time_to_seconds(c);
+        m = &s->memo[(uint64_t) (local / 60) % BATCH_MEMO_SIZE];
+        if (!m->valid || m->local != local) {
+                m->local = local;
+                m->r = calendar_time_to_time_t(zone, c, s->not_before, &m->t);
+                m->valid = true;
+        }
+
+        *ret = m->t;
+        return m->r;
+}
+
+/* Whether civil times after not_before come again shortly after it at
+ * the end of DST, see iter_step() */
+static bool batch_repeats_ahead(BatchState *s, const CalendarSpec *spec, const CalendarZone *zone) {
+        time_t t;
+        int z;
+
+        z = batch_zone(spec, zone);
+        if (z == BATCH_ZONE_OWN)
+                return calendar_zone_repeats_ahead(zone, s->not_before, &t);
+
+        if (s->repeats[z] == 0)
+                s->repeats[z] = calendar_zone_repeats_ahead(zone, s->not_before, &t) ? 2 : 1;
+
+        return s->repeats[z] == 2;
+}
+
+static int batch_next_slow(BatchState *s, const CalendarSpec *spec, usec_t *ret) {
+        CalendarSpecIter i = {
+                .spec = spec,
+                .not_before = s->not_before,
+                .exact = true,
+                .budget = CALENDAR_SEARCH_BUDGET_DEFAULT,
+        };
+        int r;
+
+        r = batch_cursor(s, spec, &i.zone, &i.cursor);
+        if (r < 0)
+                return r;
+
+        return calendar_spec_iter_next(&i, ret);
+}
+
+/* The same as the first step of iter_step() with find_next_weekly(),
+ * with the week map looked up in the batch. */
+static int batch_next_weekly(BatchState *s, const CalendarSpecBatch *b, size_t k, usec_t *ret) {
+        const CalendarSpec *spec = b->specs[b->weekly[k]];
+        size_t nw = b->n_weekly;
+        CalendarZone zone;
+        CalendarTime c;
+        int64_t days, minutes;
+        uint64_t x;
+        time_t t;
+        int m, w, p, r;
+
+        r = batch_cursor(s, spec, &zone, &c);
+        if (r < 0)
+                return r;
+
+        if (batch_repeats_ahead(s, spec, &zone))
+                return batch_next_slow(s, spec, ret);
+
+        days = days_from_civil(c.year, c.month, c.day);
+        minutes = c.hour * 60 + c.minute + (c.second > 0);
+        m = weekday_from_days(days) * 1440 + (int) minutes;
+
+        /* Most often the next minute is in the same word, otherwise
+         * the used words tell where it is */
+        w = m / 64;
+        x = b->week_words[(size_t) w * nw + k] & (~UINT64_C(0) << (m % 64));
+        if (x == 0) {
+                w = batch_find_next_word(b, k, w + 1);
+                if (w < 0)
+                        return -ENOENT;
+                x = b->week_words[(size_t) (w % CALENDAR_WEEK_WORDS) * nw + k];
+        }
+        p = (w / CALENDAR_WEEK_WORDS) * CALENDAR_MINUTES_PER_WEEK +
+                (w % CALENDAR_WEEK_WORDS) * 64 + __builtin_ctzll(x);
+
+        minutes += p - m;
+        days += minutes / 1440;
+        minutes %= 1440;
+
+        civil_from_days(days, &c.year, &c.month, &c.day);
+        if (c.year > YEAR_MAX)
+                return -ENOENT;
+
+        c.hour = (int) (minutes / 60);
+        c.minute = (int) (minutes % 60);
+        c.second = 0;
+
+        r = batch_time_to_time_t(s, spec, &zone, &c, &t);
+        if (r == -ENOENT) /* in a DST gap, leave it to the general search */
+                return batch_next_slow(s, spec, ret);
+        if (r < 0)
+                return r;
+
+        *ret = (usec_t) t * USEC_PER_SEC;
+        return 0;
+}
+
+int calendar_spec_next_usec_many(const CalendarSpecBatch *b, const CalendarEvalCtx *ctx,
+                                 usec_t usec, usec_t *next, int *ret_errors) {
+        BatchState s = {
+                .ctx = ctx,
+                .not_before = (time_t) (usec / USEC_PER_SEC) + 1,
+        };
+        size_t k, i;
+        int r;
+
+        assert(b);
+        assert(next);
+
+        /* Without memory for the memo, just convert every time */
+        if (b->n_weekly > 1)
+                s.memo = new0(BatchMemo, BATCH_MEMO_SIZE);
+
+        for (k = 0, i = 0; k < b->n_specs; k++) {
+                if (i < b->n_weekly && b->weekly[i] == k)
+                        r = batch_next_weekly(&s, b, i++, &next[k]);
+                else
+                        r = batch_next_slow(&s, b->specs[k], &next[k]);
+                if (r < 0)
+                        next[k] = USEC_INFINITY;
+                if (ret_errors)
+                        ret_errors[k] = r < 0 ? r : 0;
+        }
+
+        free(s.memo);
+        return 0;
+}
+
+/* Bumped whenever the elapse times of all specs might have changed,
+ * caches of older generations are rebuilt on next use */
+static uint64_t cache_generation = 0;
+
+void calendar_spec_cache_invalidate_all(void) {
+        cache_generation++;
+}
+
+static int cache_build(const CalendarSpec *spec, usec_t usec, CalendarCache **ret) {
+        CalendarSpecIter i;
+        CalendarCache *c, *shrunk;
+        usec_t t, horizon;
+        int r;
+
+        c = malloc(offsetof(CalendarCache, times) + CALENDAR_CACHE_TIMES_MAX * sizeof(usec_t));
+        if (!c)
+                return -ENOMEM;
+
+        horizon = usec > USEC_INFINITY - CALENDAR_CACHE_HORIZON ? USEC_INFINITY - 1 : usec + CALENDAR_CACHE_HORIZON;
+
+        c->generation = cache_generation;
+        c->from = usec;
+        c->until = horizon;
+        c->n_times = 0;
+
+        r = calendar_spec_iter_init(&i, spec, usec);
+        while (r >= 0) {
+                r = calendar_spec_iter_next(&i, &t);
+                if (r == -ENOENT) {
+                        /* Complete, there are no later elapse times */
+                        c->until = USEC_INFINITY;
+                        r = 0;
+                        break;
+                }
+                if (r < 0 || t > horizon)
+                        break;
+
+                c->times[c->n_times++] = t;
+                if (c->n_times >= CALENDAR_CACHE_TIMES_MAX) {
+                        c->until = t;
+                        break;
+                }
+        }
+        if (r < 0) {
+                free(c);
+                return r;
+        }
+
+        shrunk = realloc(c, offsetof(CalendarCache, times) + (c->n_times > 0 ? c->n_times : 1) * sizeof(usec_t));
+        *ret = shrunk ?: c;
+        return 0;
+}
+
+int calendar_spec_cache_next(CalendarSpec *spec, usec_t usec, usec_t *next) {
+        const CalendarCache *c;
+        size_t lo, hi, mid;
+        usec_t key;
+        int r;
+
+        assert(spec);
+        assert(next);
+
+        if (!spec->cache || spec->cache->generation != cache_generation ||
+            usec < spec->cache->from || usec >= spec->cache->until) {
+                CalendarCache *n;
+
+                r = cache_build(spec, usec, &n);
+                if (r < 0)
+                        return r;
+
+                free(spec->cache);
+                spec->cache = n;
+        }
+
+        c = spec->cache;
+
+        /* Elapse times are full seconds, and the next one is at least
+         * one second after the second usec is in */
+        key = usec - usec % USEC_PER_SEC;
+
+        lo = 0;
+        hi = c->n_times;
+        while (lo < hi) {
+                mid = lo + (hi - lo) / 2;
+                if (c->times[mid] > key)
+                        hi = mid;
+                else
+                        lo = mid + 1;
+        }
+
+        if (lo < c->n_times) {
+                *next = c->times[lo];
+                return 0;
+        }
+
+        /* Nothing up to until, which is beyond the table */
+        if (c->until == USEC_INFINITY)
+                return -ENOENT;
+
+        return calendar_spec_next_usec(spec, c->until, next);
+}
+
+/* Without $TZ glibc falls back to /etc/localtime, and to UTC if that
+ * does not exist either. The name of the zone is taken from the target
+ * of the symlink, if it points into a zoneinfo directory. */
+static int load_localtime(TZFile **ret) {
+        char target[PATH_MAX];
+        const char *name = NULL, *z;
+        ssize_t l;
+        int r;
+
+        l = readlink("/etc/localtime", target, sizeof(target) - 1);
+        if (l > 0) {
+                target[l] = 0;
+                z = strstr(target, "zoneinfo/");
+                if (z && tzfile_name_is_valid(z + strlen("zoneinfo/")))
+                        name = z + strlen("zoneinfo/");
+        }
+
+        r = tzfile_load_path("/etc/localtime", name ?: "localtime", ret);
+        if (r == -ENOENT) {
+                *ret = NULL;
+                return 0;
+        }
+
+        return r;
+}
+
+int calendar_eval_ctx_new(const char *name, CalendarEvalCtx **ret) {
+        CalendarEvalCtx *ctx;
+        TZFile *tz = NULL;
+        int r;
+
+        assert(ret);
+
+        if (!name) {
+                name = getenv("TZ");
+                if (name && name[0] == ':')
+                        name++;
+        }
+
+        if (!name)
+                r = load_localtime(&tz);
+        else if (isempty(name) || strcaseeq(name, "UTC"))
+                r = 0;
+        else if (name[0] == '/')
+                r = tzfile_load_path(name, NULL, &tz);
+        else
+                r = tzfile_load(name, &tz);
+        if (r < 0)
+                return r;
+
+        ctx = new0(CalendarEvalCtx, 1);
+        if (!ctx) {
+                tzfile_free(tz);
+                return -ENOMEM;
+        }
+
+        ctx->tz = tz;
+        ctx->zone = (CalendarZone) { .utc = !tz, .tz = tz };
+
+        *ret = ctx;
+        return 0;
+}
+
+void calendar_eval_ctx_free(CalendarEvalCtx *ctx) {
+        if (!ctx)
+                return;
+
+        tzfile_free(ctx->tz);
+        free(ctx);
+}
+
+const char *calendar_eval_ctx_timezone(const CalendarEvalCtx *ctx) {
+        assert(ctx);
+
+        return ctx->tz ? tzfile_name(ctx->tz) : "UTC";
+}
@@ -25,7 +25,9 @@
  * time, a la cron */
 
 #include <stdbool.h>
+#include <stdint.h>
 #include "time-util.h"
+#include "tzfile.h"
 // #include "util.h"
 
 typedef struct CalendarComponent {
@@ -35,10 +37,35 @@ typedef struct CalendarComponent {
         struct CalendarComponent *next;
 } CalendarComponent;
 
+/* Memoized elapse times of a spec, see calendar_spec_cache_next() */
+typedef struct CalendarCache {
+        uint64_t generation;
+
+        /* All elapse times after from, up to and including until */
+        usec_t from;
+        usec_t until;
+
+        size_t n_times;
+        usec_t times[];
+} CalendarCache;
+
+/* How far ahead the elapse times are memoized, and at most how many */
+#define CALENDAR_CACHE_HORIZON USEC_PER_YEAR
+#define CALENDAR_CACHE_TIMES_MAX 4096U
+
+#define CALENDAR_MINUTES_PER_WEEK 10080
+#define CALENDAR_WEEK_WORDS ((CALENDAR_MINUTES_PER_WEEK + 63) / 64)
+#define CALENDAR_USED_WORDS ((CALENDAR_WEEK_WORDS + 63) / 64)
+
 typedef struct CalendarSpec {
         int weekdays_bits;
         bool utc;
 
+        /* Time zone given explicitly as suffix of the spec, e.g.
+         * "Sat 02:00 Europe/Berlin". If set, it is used for all
+         * conversions instead of the local time zone of the process. */
+        TZFile *tz;
+
         CalendarComponent *year;
         CalendarComponent *month;
         CalendarComponent *day;
@@ -46,14 +73,171 @@ typedef struct CalendarSpec {
         CalendarComponent *hour;
         CalendarComponent *minute;
         CalendarComponent *second;
+
+        /* Compiled form of the chains above, filled in by
+         * calendar_spec_normalize(). Bit n is set if value n
+         * matches, repetitions are expanded up to the end of the
+         * range of the field. */
+        uint64_t second_bits;
+        uint64_t minute_bits;
+        uint32_t hour_bits;
+        uint32_t day_bits;
+        uint32_t month_bits;
+
+        /* Set if only the weekday, hour and minute fields are
+         * restricted and the second is 0, which is the case for
+         * almost all maintenance windows. Then week_bits has bit n
+         * set if the minute n of the week matches, counted from
+         * Monday 00:00, and find_next() is a scan of it. */
+        bool weekly;
+        uint64_t week_bits[CALENDAR_WEEK_WORDS];
+
+        /* Built on demand by calendar_spec_cache_next(), dropped
+         * when the spec is normalized again */
+        CalendarCache *cache;
+
+        /* The spec as string, formatted by calendar_spec_normalize()
+         * into room allocated after the components */
+        const char *formatted;
+        size_t format_room;
+
+        /* Storage of the components of all chains above, allocated
+         * together with the spec itself, so that a spec is a single
+         * block of memory. */
+        unsigned n_components;
+        unsigned n_components_allocated;
+        CalendarComponent components[];
 } CalendarSpec;
 
+/* A broken down civil time, all fields in their natural ranges, i.e.
+ * months and days are counted from 1 and years are not offset. */
+typedef struct CalendarTime {
+        int year;
+        int month;
+        int day;
+        int hour;
+        int minute;
+        int second;
+} CalendarTime;
+
+/* The time zone in which the civil times of a spec are evaluated: UTC,
+ * a zone loaded from a TZif file, or, if neither is set, the local time
+ * zone of the C library. */
+typedef struct CalendarZone {
+        bool utc;
+        const TZFile *tz;
+} CalendarZone;
+
+/* Snapshot of the time zone in which specs without explicit time zone
+ * are evaluated. It is not modified after creation, so one context can
+ * be shared by any number of threads, and evaluating with it never
+ * touches the TZ state of the C library or its locks. */
+typedef struct CalendarEvalCtx {
+        CalendarZone zone;
+        TZFile *tz;
+} CalendarEvalCtx;
+
+/* Enumerates the elapse times of a spec in ascending order. The broken
+ * down cursor is kept between the steps, so the time is only converted
+ * back to civil time if the UTC offset changed in between. Yields the
+ * same times as repeated calls of calendar_spec_next_usec(). */
+typedef struct CalendarSpecIter {
+        const CalendarSpec *spec;
+        CalendarZone zone;
+        CalendarTime cursor;
+        time_t not_before;
+        long offset;
+        bool exact;
+
+        /* Limit of search steps per call of calendar_spec_iter_next(),
+         * and the steps used by the last call */
+        unsigned budget;
+        unsigned iterations;
+} CalendarSpecIter;
+
+/* Upper bound of search steps for finding a single elapse time. A step
+ * moves the search at least to the next month with a matching day, or
+ * halves the span searched for the end of a DST gap. Specs which never
+ * match are rejected when parsing, and the others need less than a
+ * hundred steps, e.g. for Feb 29 falling on a Monday. */
+#define CALENDAR_SEARCH_BUDGET_DEFAULT 1024U
+
 void calendar_spec_free(CalendarSpec *c);
 
 int calendar_spec_normalize(CalendarSpec *spec);
 bool calendar_spec_valid(CalendarSpec *spec);
 
 int calendar_spec_to_string(const CalendarSpec *spec, char **p);
+/* Formatting without allocation: the string of the spec kept with it,
+ * the size of a buffer it fits into, including the NUL, and a copy
+ * into such a buffer, which fails with -ENOBUFS if it is too small. */
+const char *calendar_spec_string(const CalendarSpec *spec);
+size_t calendar_spec_format_max(const CalendarSpec *spec);
+int calendar_spec_format(const CalendarSpec *spec, char *buf, size_t l);
 int calendar_spec_from_string(const char *p, CalendarSpec **spec);
 
 int calendar_spec_next_usec(const CalendarSpec *spec, usec_t usec, usec_t *next);
+/* Like calendar_spec_next_usec(), but gives up with -ETIME after budget
+ * search steps. Returns the steps used in ret_iterations. */
+int calendar_spec_next_usec_budget(const CalendarSpec *spec, usec_t usec, unsigned budget,
+                                   usec_t *next, unsigned *ret_iterations);
+int calendar_spec_prev_usec(const CalendarSpec *spec, usec_t usec, usec_t *prev);
+
+/* Finds the window of the given duration, starting at an elapse time of
+ * spec, which contains usec. Returns 1 and its start if there is one,
+ * otherwise 0 and the start of the next window. */
+int calendar_window_locate(const CalendarSpec *spec, usec_t duration, usec_t usec, usec_t *start);
+
+int calendar_spec_iter_init(CalendarSpecIter *i, const CalendarSpec *spec, usec_t usec);
+int calendar_spec_iter_next(CalendarSpecIter *i, usec_t *next);
+
+/* Like calendar_spec_next_usec(), but answers from a table of the
+ * elapse times of the next year, which is built on first use and
+ * attached to the spec. The table is rebuilt when usec leaves it, or
+ * after calendar_spec_cache_invalidate_all(), which has to be called
+ * when the local time zone changed. The spec is modified, so this must
+ * not be used from several threads on the same spec. */
+int calendar_spec_cache_next(CalendarSpec *spec, usec_t usec, usec_t *next);
+void calendar_spec_cache_invalidate_all(void);
+
+/* Specs compiled for evaluation all at once. The week maps of the
+ * weekly specs are stored as struct of arrays: word w of the map of the
+ * k-th weekly spec is week_words[w * n_weekly + k]. Bit w of its
+ * used_words is set if that word is not 0, so the next matching minute
+ * is found with two lookups. The specs are referenced, not copied. */
+typedef struct CalendarSpecBatch {
+        size_t n_specs;
+        const CalendarSpec **specs;
+
+        size_t n_weekly;
+        size_t *weekly;
+        uint64_t *week_words;
+        uint64_t *used_words;
+} CalendarSpecBatch;
+
+int calendar_spec_batch_new(CalendarSpec *const *specs, size_t n, CalendarSpecBatch **ret);
+void calendar_spec_batch_free(CalendarSpecBatch *b);
+
+/* Like calendar_spec_next_usec() for every spec of the batch, with
+ * the conversion of usec into civil time shared between the specs in
+ * the same zone. next[k] is USEC_INFINITY if spec k has no next elapse
+ * time, and the error is stored in ret_errors[k], if not NULL. Returns
+ * only errors of the batch itself. */
+int calendar_spec_next_usec_many(const CalendarSpecBatch *b, const CalendarEvalCtx *ctx,
+                                 usec_t usec, usec_t *next, int *ret_errors);
+
+/* Takes a snapshot of the given time zone, or if name is NULL, of
+ * the local one as configured by $TZ or /etc/localtime. */
+int calendar_eval_ctx_new(const char *name, CalendarEvalCtx **ret);
+void calendar_eval_ctx_free(CalendarEvalCtx *ctx);
+const char *calendar_eval_ctx_timezone(const CalendarEvalCtx *ctx);
+
+/* Like the functions above, but specs without explicit time zone are
+ * evaluated in the time zone of ctx instead of the local one of the
+ * process. ctx may be NULL. */
+int calendar_spec_iter_init_ctx(CalendarSpecIter *i, const CalendarSpec *spec,
+                                const CalendarEvalCtx *ctx, usec_t usec);
+int calendar_spec_next_usec_ctx(const CalendarSpec *spec, const CalendarEvalCtx *ctx,
+                                usec_t usec, usec_t *next);
+int calendar_spec_prev_usec_ctx(const CalendarSpec *spec, const CalendarEvalCtx *ctx,
+                                usec_t usec, usec_t *prev);
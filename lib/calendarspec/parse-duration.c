@@ -16,196 +16,257 @@
 #include <errno.h>
 #include <ctype.h>
 #include <string.h>
-#include <stdlib.h>
-#include <limits.h>
+#include <strings.h>
 #include "parse-duration.h"
 
-/* True if the arithmetic type T is signed.  */
-#define TYPE_SIGNED(t) (! ((t) 0 < (t) -1))
-
-#define TYPE_MAXIMUM(t)                                                 \
-  ((t) (! TYPE_SIGNED (t)                                               \
-        ? (t) -1                                                        \
-        : ((((t) 1 << (sizeof (t) * CHAR_BIT - 2)) - 1) * 2 + 1)))
-
-#define SEC_PER_MIN 60
-#define SEC_PER_HR (SEC_PER_MIN * 60)
-
-#define MAX_DURATION TYPE_MAXIMUM(time_t)
-
-/* Wrapper around strtoul that does not require a cast.  */
-static unsigned long
-str_const_to_ul (const char *str, const char **ppz, int base)
+/* Units of systemd style time spans.  They are case insensitive, so
+   unlike systemd "M" is a minute, as "1H 30M" always was.  */
+static const struct
 {
-  return strtoul (str, (char **)ppz, base);
+  const char *suffix;
+  usec_t usec;
+} units[] = {
+  { "us",      1 },
+  { "usec",    1 },
+  { "ms",      USEC_PER_MSEC },
+  { "msec",    USEC_PER_MSEC },
+  { "s",       USEC_PER_SEC },
+  { "sec",     USEC_PER_SEC },
+  { "second",  USEC_PER_SEC },
+  { "seconds", USEC_PER_SEC },
+  { "m",       USEC_PER_MINUTE },
+  { "min",     USEC_PER_MINUTE },
+  { "minute",  USEC_PER_MINUTE },
+  { "minutes", USEC_PER_MINUTE },
+  { "h",       USEC_PER_HOUR },
+  { "hr",      USEC_PER_HOUR },
+  { "hour",    USEC_PER_HOUR },
+  { "hours",   USEC_PER_HOUR },
+  { "d",       USEC_PER_DAY },
+  { "day",     USEC_PER_DAY },
+  { "days",    USEC_PER_DAY },
+  { "w",       USEC_PER_WEEK },
+  { "week",    USEC_PER_WEEK },
+  { "weeks",   USEC_PER_WEEK },
+};
+
+/* A number as written, the integer part and the digits after the
+   decimal point.  */
+typedef struct
+{
+  usec_t val;
+  const char *frac;
+  size_t n_frac;
+  size_t n_digits;
+} number;
+
+static const char *
+skip_space (const char *pz)
+{
+  while (isspace ((unsigned char)*pz))
+    pz++;
+  return pz;
 }
 
-/* Returns BASE + VAL * SCALE, interpreting BASE = BAD_TIME
-   with errno set as an error situation, and returning BAD_TIME
-   with errno set in an error situation.  */
-static time_t
-scale_n_add (time_t base, time_t val, int scale)
+/* Parses [digits][.digits] with at least one digit.  */
+static int
+parse_number (const char **ppz, number *ret)
 {
-  if (base == BAD_TIME)
-    {
-      if (errno == 0)
-        errno = EINVAL;
-      return BAD_TIME;
-    }
+  const char *pz = *ppz;
+
+  *ret = (number) {};
 
-  if (val > MAX_DURATION / scale)
+  for (; isdigit ((unsigned char)*pz); pz++, ret->n_digits++)
     {
-      errno = ERANGE;
-      return BAD_TIME;
+      if (ret->val > (USEC_INFINITY - 9) / 10)
+        return -ERANGE;
+      ret->val = ret->val * 10 + (usec_t)(*pz - '0');
     }
 
-  val *= scale;
-  if (base > MAX_DURATION - val)
+  if (*pz == '.')
     {
-      errno = ERANGE;
-      return BAD_TIME;
+      ret->frac = ++pz;
+      while (isdigit ((unsigned char)*pz))
+        pz++;
+      ret->n_frac = pz - ret->frac;
     }
 
-  return base + val;
+  if (ret->n_digits == 0 && ret->n_frac == 0)
+    return -EINVAL;
+
+  *ppz = pz;
+  return 0;
 }
 
-/* Parses a value and returns BASE + value * SCALE, interpreting
-   BASE = BAD_TIME with errno set as an error situation, and returning
-   BAD_TIME with errno set in an error situation.  */
-static time_t
-parse_scaled_value (time_t base, const char **ppz, const char *endp, int scale)
+/* Adds NUM * SCALE to *RES.  Digits of the fraction beyond the
+   resolution of SCALE are ignored.  USEC_INFINITY is never a valid
+   result, it means "not set" for the callers.  */
+static int
+scale_n_add (usec_t *res, const number *num, usec_t scale)
 {
-  const char *pz = *ppz;
-  time_t val;
+  usec_t val, frac_part = 0;
 
-  if (base == BAD_TIME)
-    return base;
+  if (num->val > (USEC_INFINITY - 1) / scale)
+    return -ERANGE;
+  val = num->val * scale;
 
-  errno = 0;
-  val = str_const_to_ul (pz, &pz, 10);
-  if (errno != 0)
-    return BAD_TIME;
-  while (isspace ((unsigned char)*pz))
-    pz++;
-  if (pz != endp)
+  /* the fraction is less than SCALE, but can still overflow VAL */
+  for (size_t i = 0; i < num->n_frac && scale >= 10; i++)
     {
-      errno = EINVAL;
-      return BAD_TIME;
+      scale /= 10;
+      frac_part += (usec_t)(num->frac[i] - '0') * scale;
     }
 
-  *ppz = pz;
-  return scale_n_add (base, val, scale);
+  if (frac_part > USEC_INFINITY - 1 - val)
+    return -ERANGE;
+  val += frac_part;
+
+  if (val >= USEC_INFINITY - *res)
+    return -ERANGE;
+  *res += val;
+
+  return 0;
 }
 
-/* Parses the syntax HH:MM[:SS].
-   PS points into the string, after "HH", before ":MM[:SS]".  */
-static time_t
-parse_hour_minute_second (const char *pz, const char *ps)
+static usec_t
+lookup_unit (const char *pz, size_t len)
 {
-  time_t res = 0;
-
-  res = parse_scaled_value (0, &pz, ps, SEC_PER_HR);
+  for (size_t i = 0; i < sizeof (units) / sizeof (units[0]); i++)
+    if (strlen (units[i].suffix) == len
+        && strncasecmp (units[i].suffix, pz, len) == 0)
+      return units[i].usec;
 
-  pz++;
-  ps = strchr (pz, ':');
-  if (ps == NULL)
-    ps = pz + strlen (pz);
+  return 0;
+}
 
-  res = parse_scaled_value (res, &pz, ps, SEC_PER_MIN);
+/* Parses the syntax HH:MM[:SS[.frac]].  PZ points after "HH:".  */
+static int
+parse_hour_minute_second (const char *pz, const number *hours, usec_t *ret)
+{
+  usec_t res = 0;
+  number num;
+  int r;
+
+  if (hours->n_frac > 0)
+    return -EINVAL;
+  r = scale_n_add (&res, hours, USEC_PER_HOUR);
+  if (r < 0)
+    return r;
+
+  pz = skip_space (pz);
+  r = parse_number (&pz, &num);
+  if (r < 0)
+    return r;
+  if (num.n_frac > 0)
+    return -EINVAL;
+  r = scale_n_add (&res, &num, USEC_PER_MINUTE);
+  if (r < 0)
+    return r;
+
+  pz = skip_space (pz);
+  if (*pz == ':')
+    {
+      pz = skip_space (pz + 1);
+      r = parse_number (&pz, &num);
+      if (r < 0)
+        return r;
+      r = scale_n_add (&res, &num, USEC_PER_SEC);
+      if (r < 0)
+        return r;
+      pz = skip_space (pz);
+    }
 
-  /* No seconds specified */
-  if (*pz == '\0')
-    return res;
+  if (*pz != '\0')
+    return -EINVAL;
 
-  pz++;
-  ps = pz + strlen (pz);
-  return parse_scaled_value (res, &pz, ps, 1);
+  *ret = res;
+  return 0;
 }
 
 /* Parses the syntax HHMMSS.  */
-static time_t
-parse_hourminutesecond (const char *in_pz)
+static int
+parse_hourminutesecond (const char *pz, usec_t *ret)
 {
-  time_t res = 0;
-  char   buf[4];
-  const char *pz;
+  static const usec_t scale[] = { USEC_PER_HOUR, USEC_PER_MINUTE, USEC_PER_SEC };
+  usec_t res = 0;
 
-  if (strlen (in_pz) != 6)
-    {
-      errno = EINVAL;
-      return BAD_TIME;
-    }
+  for (size_t i = 0; i < 3; i++, pz += 2)
+    res += (usec_t)((pz[0] - '0') * 10 + pz[1] - '0') * scale[i];
 
-  memcpy (buf, in_pz, 2);
-  buf[2] = '\0';
-  pz = buf;
-  res = parse_scaled_value (0, &pz, buf + 2, SEC_PER_HR);
-
-  memcpy (buf, in_pz + 2, 2);
-  buf[2] = '\0';
-  pz =   buf;
-  res = parse_scaled_value (res, &pz, buf + 2, SEC_PER_MIN);
-
-  memcpy (buf, in_pz + 4, 2);
-  buf[2] = '\0';
-  pz =   buf;
-  return parse_scaled_value (res, &pz, buf + 2, 1);
+  *ret = res;
+  return 0;
 }
 
-/* Parses the syntax hh H mm M ss S.  */
-static time_t
-parse_HMS (const char *pz)
+/* Parses duration (hours, minutes, seconds) in one pass: the
+   separator after the first number decides about the syntax.  */
+int
+parse_duration_usec (const char *pz, usec_t *ret)
 {
-  time_t res = 0;
-  const char *ps = strpbrk (pz, "Hh");
-  if (ps != NULL)
-    {
-      res = parse_scaled_value (0, &pz, ps, SEC_PER_HR);
-      pz++;
-    }
+  const char *start;
+  usec_t res = 0;
+  number num;
+  int r;
 
-  ps = strpbrk (pz, "Mm");
-  if (ps != NULL)
-    {
-      res = parse_scaled_value (res, &pz, ps, SEC_PER_MIN);
-      pz++;
-    }
+  pz = skip_space (pz);
+  start = pz;
 
-  ps = strpbrk (pz, "Ss");
-  if (ps != NULL)
+  r = parse_number (&pz, &num);
+  if (r < 0)
+    return r;
+  pz = skip_space (pz);
+
+  if (*pz == ':') /* HH:MM[:SS] format */
+    return parse_hour_minute_second (pz + 1, &num, ret);
+
+  if (*pz == '\0') /* Its a HHMMSS format: */
     {
-      res = parse_scaled_value (res, &pz, ps, 1);
-      pz++;
+      if (num.n_digits != 6 || num.n_frac > 0)
+        return -EINVAL;
+      return parse_hourminutesecond (start, ret);
     }
 
-  while (isspace ((unsigned char)*pz))
-    pz++;
-
-  if (*pz != '\0')
+  /* Sequence of <number> <unit>, e.g. "1h 30min" or "1H30M" */
+  for (;;)
     {
-      errno = EINVAL;
-      return BAD_TIME;
+      const char *unit = pz;
+      usec_t scale;
+
+      while (isalpha ((unsigned char)*pz))
+        pz++;
+      scale = lookup_unit (unit, pz - unit);
+      if (scale == 0)
+        return -EINVAL;
+
+      r = scale_n_add (&res, &num, scale);
+      if (r < 0)
+        return r;
+
+      pz = skip_space (pz);
+      if (*pz == '\0')
+        break;
+
+      r = parse_number (&pz, &num);
+      if (r < 0)
+        return r;
+      pz = skip_space (pz);
     }
 
-  return res;
+  *ret = res;
+  return 0;
 }
 
-/* Parses duration (hours, minutes, seconds).  */
 time_t
 parse_duration (const char *pz)
 {
-  const char *ps;
-  time_t  res = BAD_TIME;
+  usec_t usec;
+  int r;
 
-  while (isspace ((unsigned char)*pz))
-    pz++;
-
-  if ((ps = strchr (pz, ':')) != NULL) /* HH:MM[:SS] format */
-    res = parse_hour_minute_second (pz, ps);
-  else if (strpbrk (pz, "HMShms") != NULL) /* H,M or S suffix */
-    res = parse_HMS (pz);
-  else /* Its a HHMMSS format: */
-    res = parse_hourminutesecond (pz);
+  r = parse_duration_usec (pz, &usec);
+  if (r < 0)
+    {
+      errno = -r;
+      return BAD_TIME;
+    }
 
-  return res;
+  return (time_t)(usec / USEC_PER_SEC);
 }
@@ -20,6 +20,8 @@
    hhmmss
    hh:mm:ss
    hh H mm M ss S
+
+   ==== and systemd style time spans, e.g. "1h 30min", "250ms" or "2w".
 */
 
 #ifndef _PARSE_DURATION_H
@@ -27,9 +29,17 @@
 
 #include <time.h>
 
+#include "time-util.h"
+
 /* Return value when a duration cannot be parsed. */
 #define BAD_TIME	((time_t)~0)
 
+/* Stores the duration in microseconds in RET.  Returns 0, -EINVAL
+   if the string is not a duration or -ERANGE if it does not fit.  */
+int parse_duration_usec (const char *, usec_t *ret);
+
+/* Like parse_duration_usec(), but returns whole seconds or BAD_TIME
+   with errno set.  */
 time_t parse_duration (const char *);
 
 #endif /* _PARSE_DURATION_H */
@@ -56,6 +56,60 @@ struct tm *localtime_or_gmtime_r(const time_t *t, struct tm *tm, bool utc) {
         return utc ? gmtime_r(t, tm) : localtime_r(t, tm);
 }
 
+/* Civil calendar arithmetic, see Howard Hinnant's "chrono-Compatible
+ * Low-Level Date Algorithms". Days are counted from 1970-01-01. */
+int64_t days_from_civil(int y, int m, int d) {
+        int64_t era, yoe, doy, doe;
+
+        y -= m <= 2;
+        era = (y >= 0 ? y : y - 399) / 400;
+        yoe = y - era * 400;
+        doy = (153 * (m + (m > 2 ? -3 : 9)) + 2) / 5 + d - 1;
+        doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+
+        return era * 146097 + doe - 719468;
+}
+
+void civil_from_days(int64_t z, int *y, int *m, int *d) {
+        int64_t era, doe, yoe, doy, mp;
+
+        assert(y);
+        assert(m);
+        assert(d);
+
+        z += 719468;
+        era = (z >= 0 ? z : z - 146096) / 146097;
+        doe = z - era * 146097;
+        yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;
+        doy = doe - (365 * yoe + yoe / 4 - yoe / 100);
+        mp = (5 * doy + 2) / 153;
+
+        *d = (int) (doy - (153 * mp + 2) / 5 + 1);
+        *m = (int) (mp < 10 ? mp + 3 : mp - 9);
+        *y = (int) (yoe + era * 400 + (*m <= 2));
+}
+
+/* 0 is Monday */
+int weekday_from_days(int64_t z) {
+        /* 1970-01-01 was a Thursday */
+        return (int) (z >= -3 ? (z + 3) % 7 : 6 - (-z - 4) % 7);
+}
+
+bool is_leap_year(int y) {
+        return (y % 4 == 0 && y % 100 != 0) || y % 400 == 0;
+}
+
+int days_in_month(int y, int m) {
+        static const int days[] = { 31, 28, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31 };
+
+        assert(m >= 1 && m <= 12);
+
+        if (m == 2 && is_leap_year(y))
+                return 29;
+
+        return days[m - 1];
+}
+
 static char *format_timestamp_internal(char *buf, size_t l, usec_t t, bool utc) {
         struct tm tm;
         time_t sec;
@@ -79,3 +133,7 @@ char *format_timestamp(char *buf, size_t l, usec_t t) {
         return format_timestamp_internal(buf, l, t, false);
 }
 
+
+char *format_timestamp_utc(char *buf, size_t l, usec_t t) {
+        return format_timestamp_internal(buf, l, t, true);
+}
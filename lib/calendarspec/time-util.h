@@ -129,6 +129,12 @@ clockid_t clock_boottime_or_monotonic(void);
 
 int get_timezone(char **timezone);
 
+int64_t days_from_civil(int y, int m, int d);
+void civil_from_days(int64_t z, int *y, int *m, int *d);
+int weekday_from_days(int64_t z);
+bool is_leap_year(int y);
+int days_in_month(int y, int m);
+
 time_t mktime_or_timegm(struct tm *tm, bool utc);
 struct tm *localtime_or_gmtime_r(const time_t *t, struct tm *tm, bool utc);
 
@@ -0,0 +1,683 @@
+//SPDX-License-Identifier: LGPL-2.1-or-later
+
+#include <assert.h>
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "time-util.h"
+#include "tzfile.h"
+
+#define TZDIR_DEFAULT   "/usr/share/zoneinfo"
+#define TZFILE_SIZE_MAX (1024 * 1024)
+#define TZNAME_MAX_LEN  255
+
+typedef struct TZTransition {
+        int64_t at;
+        int32_t offset;
+        bool dst;
+} TZTransition;
+
+/* One of the two dates of a POSIX TZ rule */
+typedef struct TZRuleDate {
+        char kind;              /* 'J': Julian day 1..365 ignoring Feb 29,
+                                   'D': day 0..365, 'M': Mm.w.d */
+        int month;
+        int week;
+        int day;
+        int32_t time;           /* seconds after local midnight */
+} TZRuleDate;
+
+/* The POSIX TZ string from the footer of version 2+ files, it describes
+ * local time after the last transition of the table. */
+typedef struct TZRule {
+        int32_t std_offset;
+        int32_t dst_offset;
+        bool has_dst;
+        TZRuleDate start;
+        TZRuleDate end;
+} TZRule;
+
+struct TZFile {
+        char *name;
+
+        int32_t initial_offset;
+        bool initial_dst;
+
+        bool has_rule;
+        TZRule rule;
+
+        size_t n_transitions;
+        TZTransition transitions[];
+};
+
+typedef struct TZHeader {
+        char version;
+        uint32_t isutcnt;
+        uint32_t isstdcnt;
+        uint32_t leapcnt;
+        uint32_t timecnt;
+        uint32_t typecnt;
+        uint32_t charcnt;
+} TZHeader;
+
+#define TZ_HEADER_SIZE 44
+
+static uint32_t be32(const uint8_t *p) {
+        return (uint32_t) p[0] << 24 | (uint32_t) p[1] << 16 | (uint32_t) p[2] << 8 | p[3];
+}
+
+static int64_t be64(const uint8_t *p) {
+        return (int64_t) ((uint64_t) be32(p) << 32 | be32(p + 4));
+}
+
+static int parse_header(const uint8_t *p, size_t n, TZHeader *h) {
+        assert(p);
+        assert(h);
+
+        if (n < TZ_HEADER_SIZE || memcmp(p, "TZif", 4) != 0)
+                return -EBADMSG;
+
+        *h = (TZHeader) {
+                .version = (char) p[4],
+                .isutcnt = be32(p + 20),
+                .isstdcnt = be32(p + 24),
+                .leapcnt = be32(p + 28),
+                .timecnt = be32(p + 32),
+                .typecnt = be32(p + 36),
+                .charcnt = be32(p + 40),
+        };
+
+        if (h->typecnt == 0 || h->typecnt > 256 || h->charcnt == 0)
+                return -EBADMSG;
+        if (h->isutcnt != 0 && h->isutcnt != h->typecnt)
+                return -EBADMSG;
+        if (h->isstdcnt != 0 && h->isstdcnt != h->typecnt)
+                return -EBADMSG;
+
+        return 0;
+}
+
+static uint64_t data_size(const TZHeader *h, size_t time_size) {
+        return
+                (uint64_t) h->timecnt * time_size +
+                (uint64_t) h->timecnt +
+                (uint64_t) h->typecnt * 6 +
+                (uint64_t) h->charcnt +
+                (uint64_t) h->leapcnt * (time_size + 4) +
+                (uint64_t) h->isstdcnt +
+                (uint64_t) h->isutcnt;
+}
+
+static int parse_rule_name(const char **p) {
+        const char *s = *p;
+        size_t l = 0;
+
+        if (*s == '<') {
+                s = strchr(s, '>');
+                if (!s)
+                        return -EINVAL;
+                *p = s + 1;
+                return 0;
+        }
+
+        while (isalpha((unsigned char) s[l]))
+                l++;
+        if (l < 3)
+                return -EINVAL;
+
+        *p = s + l;
+        return 0;
+}
+
+/* [+-]hh[:mm[:ss]], hours may go up to 167 for the transition times */
+static int parse_rule_time(const char **p, int32_t *ret) {
+        const char *s = *p;
+        int32_t sign = 1, v = 0;
+        int i;
+
+        if (*s == '+' || *s == '-') {
+                if (*s == '-')
+                        sign = -1;
+                s++;
+        }
+
+        for (i = 0; i < 3; i++) {
+                int32_t n = 0;
+                int digits = 0;
+
+                if (i > 0) {
+                        if (*s != ':')
+                                break;
+                        s++;
+                }
+
+                while (isdigit((unsigned char) *s) && digits < 3) {
+                        n = n * 10 + (*s - '0');
+                        s++;
+                        digits++;
+                }
+                if (digits == 0)
+                        return -EINVAL;
+                if (i == 0 ? n > 167 : n > 59)
+                        return -EINVAL;
+
+                v += n * (i == 0 ? 3600 : i == 1 ? 60 : 1);
+        }
+
+        *p = s;
+        *ret = sign * v;
+        return 0;
+}
+
+static int parse_rule_number(const char **p, int min, int max, int *ret) {
+        const char *s = *p;
+        int n = 0;
+
+        if (!isdigit((unsigned char) *s))
+                return -EINVAL;
+
+        while (isdigit((unsigned char) *s)) {
+                n = n * 10 + (*s - '0');
+                if (n > max)
+                        return -EINVAL;
+                s++;
+        }
+        if (n < min)
+                return -EINVAL;
+
+        *p = s;
+        *ret = n;
+        return 0;
+}
+
+static int parse_rule_date(const char **p, TZRuleDate *d) {
+        const char *s = *p;
+        int r;
+
+        *d = (TZRuleDate) {
+                .time = 2 * 3600,
+        };
+
+        if (*s == 'M') {
+                s++;
+                d->kind = 'M';
+                r = parse_rule_number(&s, 1, 12, &d->month);
+                if (r < 0)
+                        return r;
+                if (*s++ != '.')
+                        return -EINVAL;
+                r = parse_rule_number(&s, 1, 5, &d->week);
+                if (r < 0)
+                        return r;
+                if (*s++ != '.')
+                        return -EINVAL;
+                r = parse_rule_number(&s, 0, 6, &d->day);
+        } else if (*s == 'J') {
+                s++;
+                d->kind = 'J';
+                r = parse_rule_number(&s, 1, 365, &d->day);
+        } else {
+                d->kind = 'D';
+                r = parse_rule_number(&s, 0, 365, &d->day);
+        }
+        if (r < 0)
+                return r;
+
+        if (*s == '/') {
+                s++;
+                r = parse_rule_time(&s, &d->time);
+                if (r < 0)
+                        return r;
+        }
+
+        *p = s;
+        return 0;
+}
+
+static int parse_rule(const char *s, TZRule *rule) {
+        int32_t offset;
+        int r;
+
+        assert(s);
+        assert(rule);
+
+        *rule = (TZRule) {};
+
+        r = parse_rule_name(&s);
+        if (r < 0)
+                return r;
+        r = parse_rule_time(&s, &offset);
+        if (r < 0)
+                return r;
+
+        /* POSIX counts offsets west of Greenwich */
+        rule->std_offset = -offset;
+        rule->dst_offset = rule->std_offset;
+
+        if (*s == 0)
+                return 0;
+
+        rule->has_dst = true;
+
+        r = parse_rule_name(&s);
+        if (r < 0)
+                return r;
+
+        if (*s != 0 && *s != ',') {
+                r = parse_rule_time(&s, &offset);
+                if (r < 0)
+                        return r;
+                rule->dst_offset = -offset;
+        } else
+                rule->dst_offset = rule->std_offset + 3600;
+
+        if (*s == 0)
+                /* No rule given, the C library uses the US rules then */
+                s = ",M3.2.0,M11.1.0";
+
+        if (*s++ != ',')
+                return -EINVAL;
+        r = parse_rule_date(&s, &rule->start);
+        if (r < 0)
+                return r;
+        if (*s++ != ',')
+                return -EINVAL;
+        r = parse_rule_date(&s, &rule->end);
+        if (r < 0)
+                return r;
+
+        return *s == 0 ? 0 : -EINVAL;
+}
+
+/* Local time of the given rule date in the given year, in seconds since
+ * the epoch as if local time was UTC */
+static int64_t rule_date_to_local(const TZRuleDate *d, int year) {
+        int64_t days;
+
+        switch (d->kind) {
+
+        case 'J':
+                days = days_from_civil(year, 1, 1) + d->day - 1;
+                if (d->day >= 60 && is_leap_year(year))
+                        days++;
+                break;
+
+        case 'D':
+                days = days_from_civil(year, 1, 1) + d->day;
+                break;
+
+        default: {
+                int first, dim, mday;
+
+                /* Mm.w.d: day d (0 is Sunday) of week w of month m,
+                 * week 5 is the last one */
+                first = (weekday_from_days(days_from_civil(year, d->month, 1)) + 1) % 7;
+                dim = days_in_month(year, d->month);
+
+                mday = 1 + (d->day - first + 7) % 7 + (d->week - 1) * 7;
+                while (mday > dim)
+                        mday -= 7;
+
+                days = days_from_civil(year, d->month, mday);
+                break;
+        }
+        }
+
+        return days * 86400 + d->time;
+}
+
+static int32_t rule_get_offset(const TZRule *rule, int64_t t, bool *ret_dst) {
+        int64_t start, end, days;
+        int year, month, day;
+        bool dst;
+
+        if (!rule->has_dst) {
+                if (ret_dst)
+                        *ret_dst = false;
+                return rule->std_offset;
+        }
+
+        days = (t + rule->std_offset) / 86400;
+        if ((t + rule->std_offset) % 86400 < 0)
+                days--;
+        civil_from_days(days, &year, &month, &day);
+
+        start = rule_date_to_local(&rule->start, year) - rule->std_offset;
+        end = rule_date_to_local(&rule->end, year) - rule->dst_offset;
+
+        if (start < end)
+                dst = t >= start && t < end;
+        else
+                /* Southern hemisphere, DST spans the turn of the year */
+                dst = t < end || t >= start;
+
+        if (ret_dst)
+                *ret_dst = dst;
+        return dst ? rule->dst_offset : rule->std_offset;
+}
+
+static int read_full_file(const char *path, uint8_t **ret, size_t *ret_size) {
+        struct stat st;
+        uint8_t *buf;
+        size_t n = 0;
+        int fd, r;
+
+        fd = open(path, O_RDONLY|O_CLOEXEC|O_NOCTTY);
+        if (fd < 0)
+                return -errno;
+
+        if (fstat(fd, &st) < 0) {
+                r = -errno;
+                goto fail;
+        }
+        if (S_ISDIR(st.st_mode)) {
+                r = -EISDIR;
+                goto fail;
+        }
+        if (!S_ISREG(st.st_mode)) {
+                r = -EBADMSG;
+                goto fail;
+        }
+        if (st.st_size > TZFILE_SIZE_MAX) {
+                r = -EFBIG;
+                goto fail;
+        }
+
+        buf = malloc((size_t) st.st_size + 1);
+        if (!buf) {
+                r = -ENOMEM;
+                goto fail;
+        }
+
+        while (n < (size_t) st.st_size) {
+                ssize_t k;
+
+                k = read(fd, buf + n, (size_t) st.st_size - n);
+                if (k < 0) {
+                        if (errno == EINTR)
+                                continue;
+                        r = -errno;
+                        free(buf);
+                        goto fail;
+                }
+                if (k == 0)
+                        break;
+                n += (size_t) k;
+        }
+
+        close(fd);
+
+        buf[n] = 0;
+        *ret = buf;
+        *ret_size = n;
+        return 0;
+
+fail:
+        close(fd);
+        return r;
+}
+
+static int tzfile_parse(const uint8_t *p, size_t n, const char *name, TZFile **ret) {
+        const uint8_t *data, *times, *idx, *types, *end;
+        size_t time_size = 4, name_len;
+        TZHeader h;
+        TZFile *tz;
+        uint32_t i;
+        int r;
+
+        r = parse_header(p, n, &h);
+        if (r < 0)
+                return r;
+
+        if (h.version >= '2') {
+                uint64_t skip = TZ_HEADER_SIZE + data_size(&h, 4);
+
+                /* Skip the 32bit data, the 64bit one follows */
+                if (skip > n)
+                        return -EBADMSG;
+                p += skip;
+                n -= skip;
+
+                r = parse_header(p, n, &h);
+                if (r < 0)
+                        return r;
+                time_size = 8;
+        }
+
+        if (data_size(&h, time_size) > n - TZ_HEADER_SIZE)
+                return -EBADMSG;
+
+        data = p + TZ_HEADER_SIZE;
+        times = data;
+        idx = times + (size_t) h.timecnt * time_size;
+        types = idx + h.timecnt;
+        end = data + data_size(&h, time_size);
+
+        name_len = strlen(name);
+        tz = malloc(sizeof(TZFile) + sizeof(TZTransition) * h.timecnt + name_len + 1);
+        if (!tz)
+                return -ENOMEM;
+
+        *tz = (TZFile) {
+                .initial_offset = (int32_t) be32(types),
+                .initial_dst = types[4] != 0,
+                .n_transitions = h.timecnt,
+        };
+        tz->name = (char *) (tz->transitions + h.timecnt);
+        memcpy(tz->name, name, name_len + 1);
+
+        for (i = 0; i < h.timecnt; i++) {
+                const uint8_t *tt;
+
+                if (idx[i] >= h.typecnt)
+                        goto fail;
+
+                tt = types + idx[i] * 6;
+                tz->transitions[i] = (TZTransition) {
+                        .at = time_size == 8 ? be64(times + i * 8) : (int32_t) be32(times + i * 4),
+                        .offset = (int32_t) be32(tt),
+                        .dst = tt[4] != 0,
+                };
+
+                if (i > 0 && tz->transitions[i].at <= tz->transitions[i-1].at)
+                        goto fail;
+        }
+
+        /* The footer: a POSIX TZ string enclosed in newlines */
+        if (time_size == 8 && end < p + n && *end == '\n') {
+                const char *rule = (const char *) end + 1;
+                char *nl;
+
+                nl = memchr(rule, '\n', (size_t) (p + n - (const uint8_t *) rule));
+                if (nl && nl > rule && nl - rule <= TZNAME_MAX_LEN) {
+                        char buf[nl - rule + 1];
+
+                        memcpy(buf, rule, nl - rule);
+                        buf[nl - rule] = 0;
+                        tz->has_rule = parse_rule(buf, &tz->rule) >= 0;
+                }
+        }
+
+        *ret = tz;
+        return 0;
+
+fail:
+        free(tz);
+        return -EBADMSG;
+}
+
+int tzfile_load_path(const char *path, const char *name, TZFile **ret) {
+        uint8_t *buf = NULL;
+        size_t n = 0;
+        int r;
+
+        assert(path);
+        assert(ret);
+
+        r = read_full_file(path, &buf, &n);
+        if (r < 0)
+                return r;
+
+        r = tzfile_parse(buf, n, name ?: path, ret);
+        free(buf);
+        return r;
+}
+
+bool tzfile_name_is_valid(const char *name) {
+        const char *p;
+
+        if (!name || !isalpha((unsigned char) name[0]))
+                return false;
+
+        if (strlen(name) > TZNAME_MAX_LEN)
+                return false;
+
+        for (p = name; *p; p++) {
+                if (isalnum((unsigned char) *p) || strchr("/_+-", *p))
+                        continue;
+                return false;
+        }
+
+        if (strstr(name, "//") || name[strlen(name) - 1] == '/')
+                return false;
+
+        return true;
+}
+
+int tzfile_load(const char *name, TZFile **ret) {
+        const char *dir;
+        size_t l;
+
+        assert(name);
+        assert(ret);
+
+        if (!tzfile_name_is_valid(name))
+                return -EINVAL;
+
+        dir = getenv("TZDIR");
+        if (!dir || dir[0] != '/')
+                dir = TZDIR_DEFAULT;
+
+        l = strlen(dir) + 1 + strlen(name) + 1;
+        char path[l];
+        strcpy(stpcpy(stpcpy(path, dir), "/"), name);
+
+        return tzfile_load_path(path, name, ret);
+}
+
+void tzfile_free(TZFile *tz) {
+        free(tz);
+}
+
+const char *tzfile_name(const TZFile *tz) {
+        assert(tz);
+        return tz->name;
+}
+
+int32_t tzfile_get_offset(const TZFile *tz, int64_t t, bool *ret_dst) {
+        const TZTransition *tr;
+        size_t lo, hi;
+
+        assert(tz);
+
+        if (tz->n_transitions == 0 || t < tz->transitions[0].at) {
+                if (tz->n_transitions == 0 && tz->has_rule)
+                        return rule_get_offset(&tz->rule, t, ret_dst);
+
+                if (ret_dst)
+                        *ret_dst = tz->initial_dst;
+                return tz->initial_offset;
+        }
+
+        if (tz->has_rule && t >= tz->transitions[tz->n_transitions - 1].at)
+                return rule_get_offset(&tz->rule, t, ret_dst);
+
+        /* Find the last transition at or before t */
+        lo = 0;
+        hi = tz->n_transitions;
+        while (hi - lo > 1) {
+                size_t m = lo + (hi - lo) / 2;
+
+                if (tz->transitions[m].at <= t)
+                        lo = m;
+                else
+                        hi = m;
+        }
+
+        tr = tz->transitions + lo;
+        if (ret_dst)
+                *ret_dst = tr->dst;
+        return tr->offset;
+}
+
+/* Returns the (up to two) points in time with the given local time,
+ * the earlier one first. */
+static unsigned local_to_utc_candidates(const TZFile *tz, int64_t local, int64_t ret[static 2]) {
+        int32_t o[2], x;
+        unsigned i, n = 0;
+
+        /* Offsets are always less than a day, so the offsets in effect a
+         * day before and a day after are the only candidates. The larger
+         * offset gives the earlier point in time. */
+        o[0] = tzfile_get_offset(tz, local - 86400, NULL);
+        o[1] = tzfile_get_offset(tz, local + 86400, NULL);
+        if (o[0] < o[1]) {
+                x = o[0];
+                o[0] = o[1];
+                o[1] = x;
+        }
+
+        for (i = 0; i < 2; i++) {
+                int64_t u;
+
+                if (i > 0 && o[i] == o[0])
+                        break;
+
+                u = local - o[i];
+                if (tzfile_get_offset(tz, u, NULL) != o[i])
+                        continue;
+
+                ret[n++] = u;
+        }
+
+        return n;
+}
+
+int tzfile_local_to_utc(const TZFile *tz, int64_t local, int64_t not_before, int64_t *ret) {
+        int64_t u[2];
+        unsigned i, n;
+
+        assert(tz);
+        assert(ret);
+
+        n = local_to_utc_candidates(tz, local, u);
+        for (i = 0; i < n; i++)
+                if (u[i] >= not_before) {
+                        *ret = u[i];
+                        return 0;
+                }
+
+        return -ENOENT;
+}
+
+int tzfile_local_to_utc_last(const TZFile *tz, int64_t local, int64_t not_after, int64_t *ret) {
+        int64_t u[2];
+        unsigned n;
+
+        assert(tz);
+        assert(ret);
+
+        n = local_to_utc_candidates(tz, local, u);
+        while (n > 0)
+                if (u[--n] <= not_after) {
+                        *ret = u[n];
+                        return 0;
+                }
+
+        return -ENOENT;
+}
@@ -0,0 +1,34 @@
+//SPDX-License-Identifier: LGPL-2.1-or-later
+
+#pragma once
+
+/* A time zone loaded from a TZif file (RFC 8536), usually from
+ * /usr/share/zoneinfo. The transition table is read once and kept in
+ * memory, so converting between UTC and local time never touches the
+ * TZ environment variable or the locks of the C library. A TZFile is
+ * not modified after loading and can be shared between threads. */
+
+#include <stdbool.h>
+#include <stdint.h>
+
+typedef struct TZFile TZFile;
+
+int tzfile_load(const char *name, TZFile **ret);
+int tzfile_load_path(const char *path, const char *name, TZFile **ret);
+void tzfile_free(TZFile *tz);
+
+bool tzfile_name_is_valid(const char *name);
+const char *tzfile_name(const TZFile *tz);
+
+/* Offset of local time against UTC in seconds east of Greenwich */
+int32_t tzfile_get_offset(const TZFile *tz, int64_t t, bool *ret_dst);
+
+/* Returns the earliest point in time not before not_before, which has
+ * the given local time (in seconds since the epoch as if local time
+ * was UTC). -ENOENT if there is none, i.e. the local time falls into a
+ * gap or only exists before not_before. */
+int tzfile_local_to_utc(const TZFile *tz, int64_t local, int64_t not_before, int64_t *ret);
+
+/* Like tzfile_local_to_utc(), but returns the latest point in time not
+ * after not_after. */
+int tzfile_local_to_utc_last(const TZFile *tz, int64_t local, int64_t not_after, int64_t *ret);
@@ -0,0 +1,496 @@
+//SPDX-License-Identifier: GPL-2.0-or-later
+
+/* Copyright (c) 2025 Thorsten Kukuk
+   Author: Thorsten Kukuk <kukuk@suse.com>
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License along
+   with this program; if not, see <http://www.gnu.org/licenses/>. */
+
+#include <ctype.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "basics.h"
+#include "common.h"
+#include "parse-duration.h"
+
+/* Returns the only elapse time of an absolute calendar spec like
+   "2025-12-24 12:00". */
+static int
+absolute_usec(const CalendarSpec *spec, usec_t *ret)
+{
+  usec_t t, u;
+  int r;
+
+  r = calendar_spec_next_usec(spec, 0, &t);
+  if (r < 0)
+    return r;
+  r = calendar_spec_next_usec(spec, t, &u);
+  if (r != -ENOENT)
+    return r < 0 ? r : -EINVAL;
+
+  *ret = t;
+  return 0;
+}
+
+static int
+blackout_from_string(const char *str, RM_Blackout *ret)
+{
+  _cleanup_(freep) char *start = NULL;
+  const char *p;
+  int r;
+
+  *ret = (RM_Blackout) {};
+
+  if ((p = strstr(str, "..")) != NULL)
+    {
+      const char *e = p;
+      usec_t begin, end;
+
+      while (e > str && isspace((unsigned char)e[-1]))
+	e--;
+      start = strndup(str, e - str);
+      if (start == NULL)
+	return -ENOMEM;
+
+      p += 2;
+      while (isspace((unsigned char)*p))
+	p++;
+
+      r = calendar_spec_from_string(start, &ret->start);
+      if (r == 0)
+	r = calendar_spec_from_string(p, &ret->end);
+      if (r == 0)
+	r = absolute_usec(ret->start, &begin);
+      if (r == 0)
+	r = absolute_usec(ret->end, &end);
+      if (r == 0 && end <= begin)
+	r = -EINVAL;
+    }
+  else
+    {
+      /* the last " for " separates the duration, the time zone of
+	 the calendar spec could contain it, too */
+      const char *q = str;
+
+      p = NULL;
+      while ((q = strstr(q, " for ")) != NULL)
+	p = q++;
+      if (p == NULL)
+	return -EINVAL;
+
+      start = strndup(str, p - str);
+      if (start == NULL)
+	return -ENOMEM;
+
+      r = calendar_spec_from_string(start, &ret->start);
+      if (r == 0 && (parse_duration_usec(p + 5, &ret->duration) < 0 ||
+		     ret->duration == 0))
+	r = -EINVAL;
+    }
+
+  if (r < 0)
+    {
+      calendar_spec_free(ret->start);
+      calendar_spec_free(ret->end);
+      *ret = (RM_Blackout) {};
+    }
+
+  return r;
+}
+
+int
+rm_blackouts_from_string(const char *str, RM_Blackout **ret, size_t *ret_n)
+{
+  RM_Blackout *blackouts;
+  size_t n = 0;
+  int r;
+
+  if (str == NULL || *str == '\0')
+    return -EINVAL;
+
+  blackouts = calloc(rm_list_count_items(str), sizeof(RM_Blackout));
+  if (blackouts == NULL)
+    return -ENOMEM;
+
+  for (const char *p = str;;)
+    {
+      _cleanup_(freep) char *item = NULL;
+
+      r = rm_list_next_item(&p, &item);
+      if (r < 0)
+	goto fail;
+      if (r == 0)
+	break;
+
+      r = blackout_from_string(item, &blackouts[n]);
+      if (r < 0)
+	goto fail;
+      n++;
+    }
+
+  *ret = blackouts;
+  *ret_n = n;
+
+  return 0;
+
+ fail:
+  rm_blackouts_free(blackouts, n);
+  return r;
+}
+
+size_t
+rm_blackout_format_max(const RM_Blackout *blackout)
+{
+  size_t l = calendar_spec_format_max(blackout->start);
+
+  if (blackout->end)
+    return l + strlen("..") + calendar_spec_format_max(blackout->end) - 1;
+
+  return l + strlen(" for ") + RM_DURATION_STRING_MAX - 1;
+}
+
+int
+rm_blackout_format(const RM_Blackout *blackout, char *buf, size_t size)
+{
+  char duration[RM_DURATION_STRING_MAX];
+  int r;
+
+  if (blackout->end)
+    r = snprintf(buf, size, "%s..%s", calendar_spec_string(blackout->start),
+		 calendar_spec_string(blackout->end));
+  else
+    {
+      r = rm_duration_format(blackout->duration, duration, sizeof(duration));
+      if (r < 0)
+	return r;
+      r = snprintf(buf, size, "%s for %s",
+		   calendar_spec_string(blackout->start), duration);
+    }
+
+  if (r < 0 || (size_t) r >= size)
+    return -ENOBUFS;
+
+  return 0;
+}
+
+int
+rm_blackout_to_string(const RM_Blackout *blackout, char **ret)
+{
+  _cleanup_(freep) char *str = NULL;
+  size_t size = rm_blackout_format_max(blackout);
+  int r;
+
+  str = malloc(size);
+  if (str == NULL)
+    return -ENOMEM;
+
+  r = rm_blackout_format(blackout, str, size);
+  if (r < 0)
+    return r;
+
+  *ret = TAKE_PTR(str);
+
+  return 0;
+}
+
+int
+rm_blackouts_to_string(const RM_Blackout *blackouts, size_t n, char **ret)
+{
+  _cleanup_(freep) char *res = NULL;
+  int r;
+
+  for (size_t i = 0; i < n; i++)
+    {
+      _cleanup_(freep) char *item = NULL;
+
+      r = rm_blackout_to_string(&blackouts[i], &item);
+      if (r < 0)
+	return r;
+      r = rm_list_append(&res, item);
+      if (r < 0)
+	return r;
+    }
+
+  *ret = TAKE_PTR(res);
+
+  return 0;
+}
+
+void
+rm_blackouts_free(RM_Blackout *blackouts, size_t n)
+{
+  if (blackouts == NULL)
+    return;
+
+  for (size_t i = 0; i < n; i++)
+    {
+      calendar_spec_free(blackouts[i].start);
+      calendar_spec_free(blackouts[i].end);
+    }
+  free(blackouts);
+}
+
+/* The index contains the blackout periods of all entries between from
+   and until, sorted and merged, so that neither the starts nor the ends
+   overlap and a time can be looked up with a binary search. Recurring
+   blackouts are expanded for RM_BLACKOUT_HORIZON, the index is rebuilt
+   if a lookup goes beyond the first half of it. */
+
+static int
+add_interval(RM_BlackoutIndex *idx, size_t *allocated, usec_t start, usec_t end)
+{
+  if (idx->n >= RM_BLACKOUT_INTERVALS_MAX)
+    return -E2BIG;
+
+  if (idx->n >= *allocated)
+    {
+      size_t m = *allocated ? *allocated * 2 : 16;
+      RM_Interval *p = reallocarray(idx->intervals, m, sizeof(RM_Interval));
+
+      if (p == NULL)
+	return -ENOMEM;
+      idx->intervals = p;
+      *allocated = m;
+    }
+
+  idx->intervals[idx->n++] = (RM_Interval) {start, end};
+
+  return 0;
+}
+
+static int
+interval_compare(const void *a, const void *b)
+{
+  const RM_Interval *x = a, *y = b;
+
+  if (x->start != y->start)
+    return x->start < y->start ? -1 : 1;
+  return 0;
+}
+
+static int
+index_build(RM_BlackoutIndex *idx, const RM_Blackout *blackouts, size_t n,
+	    usec_t from)
+{
+  size_t allocated = 0;
+  usec_t until = from + RM_BLACKOUT_HORIZON;
+  int r;
+
+  rm_blackout_index_free(idx);
+
+  for (size_t i = 0; i < n; i++)
+    {
+      const RM_Blackout *b = &blackouts[i];
+
+      if (b->end)
+	{
+	  usec_t begin, end;
+
+	  r = absolute_usec(b->start, &begin);
+	  if (r == 0)
+	    r = absolute_usec(b->end, &end);
+	  if (r < 0)
+	    goto fail;
+	  if (end > from && begin < until)
+	    {
+	      r = add_interval(idx, &allocated, begin, end);
+	      if (r < 0)
+		goto fail;
+	    }
+	}
+      else
+	{
+	  usec_t duration = b->duration;
+	  CalendarSpecIter iter;
+	  usec_t start;
+	  size_t first = idx->n;
+	  unsigned steps = 0;
+
+	  r = calendar_spec_iter_init(&iter, b->start,
+				      from > duration ? from - duration : 0);
+	  while (r == 0 && (r = calendar_spec_iter_next(&iter, &start)) == 0 &&
+		 start < until)
+	    {
+	      if (++steps > RM_BLACKOUT_STEPS_MAX)
+		{
+		  r = -E2BIG;
+		  break;
+		}
+
+	      /* The starts of one spec are ascending, merge overlapping
+		 periods already here, e.g. "minutely for 5m" */
+	      if (idx->n > first && start <= idx->intervals[idx->n - 1].end)
+		idx->intervals[idx->n - 1].end = start + duration;
+	      else
+		r = add_interval(idx, &allocated, start, start + duration);
+	    }
+	  if (r < 0 && r != -ENOENT)
+	    goto fail;
+	}
+    }
+
+  if (idx->n > 0)
+    {
+      size_t m = 0;
+
+      qsort(idx->intervals, idx->n, sizeof(RM_Interval), interval_compare);
+      for (size_t i = 1; i < idx->n; i++)
+	{
+	  if (idx->intervals[i].start <= idx->intervals[m].end)
+	    {
+	      if (idx->intervals[i].end > idx->intervals[m].end)
+		idx->intervals[m].end = idx->intervals[i].end;
+	    }
+	  else
+	    idx->intervals[++m] = idx->intervals[i];
+	}
+      idx->n = m + 1;
+    }
+
+  idx->from = from;
+  idx->until = until;
+
+  return 0;
+
+ fail:
+  rm_blackout_index_free(idx);
+  return r;
+}
+
+int
+rm_blackout_index_lookup(RM_BlackoutIndex *idx, const RM_Blackout *blackouts,
+			 size_t n, usec_t usec, usec_t *ret_allowed,
+			 usec_t *ret_until)
+{
+  unsigned builds = 0;
+  int r;
+
+  for (;;)
+    {
+      size_t lo = 0, hi;
+
+      if (idx->until == 0 || usec < idx->from ||
+	  usec >= idx->from + RM_BLACKOUT_HORIZON / 2)
+	{
+	  /* a blackout which lasts for years is a configuration error */
+	  if (++builds > 4)
+	    return -ETIME;
+
+	  r = index_build(idx, blackouts, n, usec);
+	  if (r < 0)
+	    return r;
+	}
+
+      /* first period which ends after usec */
+      hi = idx->n;
+      while (lo < hi)
+	{
+	  size_t mid = lo + (hi - lo) / 2;
+
+	  if (idx->intervals[mid].end <= usec)
+	    lo = mid + 1;
+	  else
+	    hi = mid;
+	}
+
+      if (lo < idx->n && idx->intervals[lo].start <= usec)
+	{
+	  /* blacked out, the end of the period is allowed, as the
+	     periods are merged. If it is beyond the index, look again
+	     there. */
+	  usec = idx->intervals[lo].end;
+	  if (usec >= idx->from + RM_BLACKOUT_HORIZON / 2)
+	    continue;
+	  lo++;
+	}
+
+      *ret_allowed = usec;
+      if (ret_until)
+	*ret_until = lo < idx->n ? idx->intervals[lo].start : USEC_INFINITY;
+      return 0;
+    }
+}
+
+void
+rm_blackout_index_free(RM_BlackoutIndex *idx)
+{
+  idx->intervals = mfree(idx->intervals);
+  idx->n = 0;
+  idx->from = idx->until = 0;
+}
+
+/* Upper bound of blackout periods a window is skipped for, if every
+   window is blacked out there is no next window for years anyway. */
+#define NEXT_WINDOW_STEPS_MAX 1024
+
+int
+rm_next_allowed_window(const RM_MaintWindow *windows, size_t n_windows,
+		       RM_BlackoutIndex *idx, const RM_Blackout *blackouts,
+		       size_t n_blackouts, usec_t usec,
+		       usec_t *ret_start, usec_t *ret_end)
+{
+  _cleanup_(rm_window_queue_free) RM_WindowQueue queue = {};
+  int r;
+
+  r = rm_window_queue_init(&queue, windows, n_windows, usec);
+  if (r < 0)
+    return r;
+
+  for (unsigned i = 0; i < NEXT_WINDOW_STEPS_MAX; i++)
+    {
+      usec_t start, end, allowed, until;
+      size_t window;
+
+      if (!rm_window_queue_peek(&queue, &start, &window))
+	return -ENOENT;
+
+      /* the longest durations would overflow */
+      if (windows[window].duration < USEC_INFINITY - start)
+	end = start + windows[window].duration;
+      else
+	end = USEC_INFINITY;
+      if (start < usec)
+	start = usec;
+
+      r = rm_blackout_index_lookup(idx, blackouts, n_blackouts, start,
+				   &allowed, &until);
+      if (r < 0)
+	return r;
+
+      if (allowed < end)
+	{
+	  *ret_start = allowed;
+	  *ret_end = until < end ? until : end;
+	  return 0;
+	}
+
+      /* The whole time between start and allowed is blacked out, so
+	 all windows ending before are, too. Continue with the windows
+	 containing allowed or after it, instead of stepping through
+	 them one by one. */
+      if (allowed > end)
+	{
+	  rm_window_queue_free(&queue);
+	  r = rm_window_queue_init(&queue, windows, n_windows, allowed);
+	  usec = allowed;
+	}
+      else
+	r = rm_window_queue_advance(&queue);
+      if (r < 0)
+	return r;
+    }
+
+  return -ETIME;
+}
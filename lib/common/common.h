@@ -25,10 +25,151 @@ extern int mkdir_p(const char *path, mode_t mode);
 
 /* config file related functions */
 #define RM_GROUP "rebootmgr"
+/* timer-accuracy, the time the reboot timer may elapse late */
+#define RM_TIMER_ACCURACY_DEFAULT USEC_PER_MINUTE
+#define RM_TIMER_ACCURACY_MAX USEC_PER_HOUR
 extern int load_config(RM_CTX *ctx);
+/* like load_config(), but reads only the given file */
+extern int load_config_file(RM_CTX *ctx, const char *path);
+/* reboot-retries, the attempts to reboot again after a failure */
+#define RM_REBOOT_RETRIES_DEFAULT 1
+#define RM_REBOOT_RETRIES_MAX 10
+/* Returns the next step after the attempts-th attempt to reboot with
+   method, of which up to retries may fail before falling back or
+   giving up. */
+extern RM_RebootAction rm_reboot_next_action(bool success, unsigned attempts,
+					     unsigned retries,
+					     RM_RebootMethod method,
+					     bool soft_reboot_fallback);
+/* The delay before the next attempt after attempts failed ones, which
+   doubles from RM_REBOOT_RETRY_DELAY up to RM_REBOOT_RETRY_DELAY_MAX */
+#define RM_REBOOT_RETRY_DELAY (10 * USEC_PER_SEC)
+#define RM_REBOOT_RETRY_DELAY_MAX (5 * USEC_PER_MINUTE)
+extern usec_t rm_reboot_retry_delay(unsigned attempts);
 extern int save_config(RM_RebootStrategy reboot_strategy,
-            	       CalendarSpec *maint_window_start,
-                       time_t maint_window_duration);
+		       const RM_MaintWindow *maint_windows,
+		       size_t n_maint_windows);
+
+/* maintenance windows, window-start and window-duration are lists
+   separated by RM_LIST_SEPARATOR. A single duration applies to all
+   windows. */
+extern int rm_durations_from_string(const char *str, usec_t **ret,
+				    size_t *ret_n);
+extern int rm_windows_from_string(const char *str, const usec_t *durations,
+				  size_t n_durations, RM_MaintWindow **ret,
+				  size_t *ret_n);
+extern int rm_windows_set_durations(RM_MaintWindow *windows, size_t n,
+				    const usec_t *durations,
+				    size_t n_durations);
+extern int rm_windows_to_string(const RM_MaintWindow *windows, size_t n,
+				char **ret_start, char **ret_duration);
+extern void rm_windows_free(RM_MaintWindow *windows, size_t n);
+
+/* Windows ordered by the start of their next occurrence. A window
+   which contains the time the queue was set up for is returned with
+   its start in the past. The next starts are taken from the
+   occurrence cache of the calendar specs. */
+typedef struct {
+  usec_t start;
+  size_t window;
+} RM_WindowQueueEntry;
+
+typedef struct {
+  const RM_MaintWindow *windows;
+  RM_WindowQueueEntry *entries;
+  size_t n;
+} RM_WindowQueue;
+
+extern int rm_window_queue_init(RM_WindowQueue *q,
+				const RM_MaintWindow *windows, size_t n,
+				usec_t usec);
+extern bool rm_window_queue_peek(const RM_WindowQueue *q, usec_t *ret_start,
+				 size_t *ret_window);
+extern int rm_window_queue_advance(RM_WindowQueue *q);
+extern void rm_window_queue_free(RM_WindowQueue *q);
+
+/* blackouts, a list of "<calendar spec> for <duration>" and
+   "<date>..<date>" entries separated by RM_LIST_SEPARATOR */
+#define RM_BLACKOUT_HORIZON USEC_PER_YEAR
+/* Limits for expanding the blackouts over the horizon, a blackout
+   which needs more, e.g. "*:*:* for 2s", is rejected with -E2BIG. */
+#define RM_BLACKOUT_INTERVALS_MAX 65536
+#define RM_BLACKOUT_STEPS_MAX (1U << 20)
+extern int rm_blackouts_from_string(const char *str, RM_Blackout **ret,
+				    size_t *ret_n);
+/* Size of the string of a blackout, including the NUL */
+extern size_t rm_blackout_format_max(const RM_Blackout *blackout);
+extern int rm_blackout_format(const RM_Blackout *blackout, char *buf,
+			      size_t size);
+extern int rm_blackout_to_string(const RM_Blackout *blackout, char **ret);
+extern int rm_blackouts_to_string(const RM_Blackout *blackouts, size_t n,
+				  char **ret);
+extern void rm_blackouts_free(RM_Blackout *blackouts, size_t n);
+/* Returns the first time at or after usec which is not blacked out,
+   and the start of the next blackout after it. */
+extern int rm_blackout_index_lookup(RM_BlackoutIndex *idx,
+				    const RM_Blackout *blackouts, size_t n,
+				    usec_t usec, usec_t *ret_allowed,
+				    usec_t *ret_until);
+extern void rm_blackout_index_free(RM_BlackoutIndex *idx);
+/* Returns the allowed part of the first maintenance window, which is
+   not completely blacked out, at or after usec. */
+extern int rm_next_allowed_window(const RM_MaintWindow *windows,
+				  size_t n_windows, RM_BlackoutIndex *idx,
+				  const RM_Blackout *blackouts,
+				  size_t n_blackouts, usec_t usec,
+				  usec_t *ret_start, usec_t *ret_end);
+
+/* timer units to avoid, a list of "<name>.timer [for <margin>]"
+   entries separated by RM_LIST_SEPARATOR */
+#define RM_TIMER_MARGIN_DEFAULT USEC_PER_HOUR
+/* The directories with unit files, highest priority first, NULL
+   terminated */
+extern const char *const rm_unit_dirs[];
+extern int rm_avoid_timers_from_string(const char *str,
+				       RM_AvoidTimer **ret, size_t *ret_n);
+extern int rm_avoid_timers_to_string(const RM_AvoidTimer *timers, size_t n,
+				     char **ret);
+extern void rm_avoid_timers_free(RM_AvoidTimer *timers, size_t n);
+/* Returns 1 and the template "foo@.timer" of an instance like
+   "foo@bar.timer", or 0 if name is no instance. */
+extern int rm_unit_template(const char *name, char **ret);
+/* Returns true if the entry name of a unit directory configures one of
+   the timers: the unit, its template or their drop-in directories. */
+extern bool rm_avoid_timers_match(const RM_AvoidTimer *timers, size_t n,
+				  const char *name);
+/* Replaces the last n_timer_blackouts entries of blackouts with a
+   blackout after each elapse time of the timers, whose unit files are
+   read below root, or / if it is NULL. Timers which are not installed, specs
+   which cannot be parsed and timers which would block all reboots are
+   skipped with a warning. */
+extern int rm_timer_blackouts_update(const char *root,
+				     const RM_AvoidTimer *timers, size_t n,
+				     RM_Blackout **blackouts,
+				     size_t *n_blackouts,
+				     size_t *n_timer_blackouts);
+
+/* The pending reboot request, which a restarted rebootmgrd restores */
+#define RM_STATE_FILE RM_VARLINK_SOCKET_DIR"/state"
+/* The pending reboot of ctx. A reboot without timer is already
+   executed and not pending anymore: a soft-reboot keeps /run, and the
+   restarted rebootmgrd must not reboot again. */
+extern void rm_state_get(const RM_CTX *ctx, RM_State *ret);
+/* Writes the state atomically, or removes the file if no reboot is
+   requested */
+extern int rm_state_save(const char *path, const RM_State *state);
+/* Returns -ENOENT without a state file and -EBADMSG if it is
+   invalid */
+extern int rm_state_load(const char *path, RM_State *ret);
+
+/* reboot through logind on the system bus */
+#define RM_LOGIND_SERVICE "org.freedesktop.login1"
+#define RM_LOGIND_PATH    "/org/freedesktop/login1"
+#define RM_LOGIND_MANAGER "org.freedesktop.login1.Manager"
+/* Returns 0 if logind answers on bus */
+extern int rm_bus_check_logind(sd_bus *bus);
+/* Asks logind to start a reboot or soft-reboot of the given method */
+extern int rm_bus_reboot(sd_bus *bus, RM_RebootMethod method);
 
 /* logging */
 #include <syslog.h>
@@ -37,8 +178,18 @@ extern void log_init (void);
 extern void log_msg (int priority, const char *fmt, ...);
 
 /* various functions to convert to/from strings */ 
+#define RM_LIST_SEPARATOR ';'
+/* Returns 1 and the next item of a RM_LIST_SEPARATOR separated list
+   with the surrounding whitespace removed, 0 at the end of the list
+   or -EINVAL if an item is empty. */
+int rm_list_next_item(const char **p, char **ret);
+size_t rm_list_count_items(const char *str);
+int rm_list_append(char **str, const char *item);
 const char *bool_to_str(bool var);
-int rm_duration_to_string(time_t duration, const char **ret);
+/* "hhh:mm:ss.ffffff", with the hours of the largest usec_t */
+#define RM_DURATION_STRING_MAX (10 + 6 + 7 + 1)
+int rm_duration_format(usec_t duration, char *buf, size_t size);
+int rm_duration_to_string(usec_t duration, const char **ret);
 int rm_string_to_strategy(const char *str_strategy, RM_RebootStrategy *ret);
 int rm_strategy_to_str(RM_RebootStrategy strategy, const char **ret);
 int rm_status_to_str(RM_RebootStatus status, RM_RebootMethod method,
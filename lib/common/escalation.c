@@ -0,0 +1,50 @@
+//SPDX-License-Identifier: GPL-2.0-or-later
+
+/* Copyright (c) 2025 Thorsten Kukuk
+   Author: Thorsten Kukuk <kukuk@suse.com>
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License along
+   with this program; if not, see <http://www.gnu.org/licenses/>. */
+
+#include <stdlib.h>
+
+#include "basics.h"
+#include "common.h"
+
+RM_RebootAction
+rm_reboot_next_action(bool success, unsigned attempts, unsigned retries,
+		      RM_RebootMethod method, bool soft_reboot_fallback)
+{
+  if (success)
+    return RM_REBOOTACTION_DONE;
+
+  /* the first attempt is not a retry */
+  if (attempts <= retries)
+    return RM_REBOOTACTION_RETRY;
+
+  if (method == RM_REBOOTMETHOD_SOFT && soft_reboot_fallback)
+    return RM_REBOOTACTION_FALLBACK;
+
+  return RM_REBOOTACTION_GIVE_UP;
+}
+
+usec_t
+rm_reboot_retry_delay(unsigned attempts)
+{
+  usec_t delay = RM_REBOOT_RETRY_DELAY;
+
+  for (unsigned i = 1; i < attempts && delay < RM_REBOOT_RETRY_DELAY_MAX; i++)
+    delay *= 2;
+
+  return delay < RM_REBOOT_RETRY_DELAY_MAX ? delay : RM_REBOOT_RETRY_DELAY_MAX;
+}
@@ -19,6 +19,7 @@
 #include "config.h"
 
 #include <errno.h>
+#include <stdlib.h>
 #include <string.h>
 #include <libeconf.h>
 
@@ -36,98 +37,294 @@ open_config_file(econf_file **key_file)
 			  "conf", "=", "#");
 }
 
-int
-load_config(RM_CTX *ctx)
+/* Applies the settings of the configuration to ctx. Settings
+   missing in the configuration keep their current values. */
+static int
+apply_config(RM_CTX *ctx, econf_file *key_file)
 {
-  _cleanup_(econf_freeFilep) econf_file *key_file = NULL;
+  _cleanup_(freep) char *str_start = NULL, *str_duration = NULL, *str_strategy = NULL;
+  _cleanup_(freep) char *str_blackout = NULL, *str_avoid_timers = NULL;
+  _cleanup_(freep) char *str_accuracy = NULL;
+  uint64_t retries = 0;
+  bool fallback = false;
+  bool has_retries, has_fallback;
   econf_err error;
   int r;
 
-  error = open_config_file(&key_file);
-  if (error)
+  error = econf_getStringValue(key_file, RM_GROUP, "window-start", &str_start);
+  if (error && error != ECONF_NOKEY)
     {
-      /* ignore if there is no configuration file at all */
-      if (error == ECONF_NOFILE)
-	return 0;
+      log_msg(LOG_ERR, "ERROR (econf): cannot get key 'window-start': %s",
+	      econf_errString(error));
+      return -1;
+    }
+  error = econf_getStringValue(key_file, RM_GROUP, "window-duration", &str_duration);
+  if (error && error != ECONF_NOKEY)
+    {
+      log_msg(LOG_ERR, "ERROR (econf): cannot get key 'window-duration': %s",
+	      econf_errString(error));
+      return -1;
+    }
 
-      log_msg(LOG_ERR, "econf_readConfig: %s\n",
+  error = econf_getStringValue(key_file, RM_GROUP, "strategy", &str_strategy);
+  if (error && error != ECONF_NOKEY)
+    {
+      log_msg(LOG_ERR, "ERROR (econf): cannot get key 'strategy': %s",
 	      econf_errString(error));
       return -1;
     }
 
-  if (key_file == NULL) /* can this happen? */
-      log_msg(LOG_ERR, "Cannot load 'rebootmgrd.conf'");
-  else
+  error = econf_getStringValue(key_file, RM_GROUP, "blackout", &str_blackout);
+  if (error && error != ECONF_NOKEY)
     {
-      _cleanup_(freep) char *str_start = NULL, *str_duration = NULL, *str_strategy = NULL;
+      log_msg(LOG_ERR, "ERROR (econf): cannot get key 'blackout': %s",
+	      econf_errString(error));
+      return -1;
+    }
 
-      error = econf_getStringValue(key_file, RM_GROUP, "window-start", &str_start);
-      if (error && error != ECONF_NOKEY)
+  error = econf_getStringValue(key_file, RM_GROUP, "avoid-timers", &str_avoid_timers);
+  if (error && error != ECONF_NOKEY)
+    {
+      log_msg(LOG_ERR, "ERROR (econf): cannot get key 'avoid-timers': %s",
+	      econf_errString(error));
+      return -1;
+    }
+
+  error = econf_getStringValue(key_file, RM_GROUP, "timer-accuracy", &str_accuracy);
+  if (error && error != ECONF_NOKEY)
+    {
+      log_msg(LOG_ERR, "ERROR (econf): cannot get key 'timer-accuracy': %s",
+	      econf_errString(error));
+      return -1;
+    }
+
+  error = econf_getUInt64Value(key_file, RM_GROUP, "reboot-retries", &retries);
+  if (error && error != ECONF_NOKEY)
+    {
+      log_msg(LOG_ERR, "ERROR (econf): cannot get key 'reboot-retries': %s",
+	      econf_errString(error));
+      return -1;
+    }
+  has_retries = (error == ECONF_SUCCESS);
+  if (has_retries && retries > RM_REBOOT_RETRIES_MAX)
+    {
+      log_msg(LOG_ERR, "ERROR: reboot-retries (%llu) is larger than %u",
+	      (unsigned long long)retries, RM_REBOOT_RETRIES_MAX);
+      return -1;
+    }
+
+  error = econf_getBoolValue(key_file, RM_GROUP, "soft-reboot-fallback", &fallback);
+  if (error && error != ECONF_NOKEY)
+    {
+      log_msg(LOG_ERR, "ERROR (econf): cannot get key 'soft-reboot-fallback': %s",
+	      econf_errString(error));
+      return -1;
+    }
+  has_fallback = (error == ECONF_SUCCESS);
+
+  usec_t accuracy = 0;
+  if (str_accuracy != NULL &&
+      (parse_duration_usec(str_accuracy, &accuracy) < 0 ||
+       accuracy > RM_TIMER_ACCURACY_MAX))
+    {
+      log_msg(LOG_ERR, "ERROR: cannot parse timer-accuracy (%s), at most one hour is allowed",
+	      str_accuracy);
+      return -1;
+    }
+
+  RM_RebootStrategy new_strategy = RM_REBOOTSTRATEGY_UNKNOWN;
+  if (str_strategy != NULL)
+    {
+      r = rm_string_to_strategy(str_strategy, &new_strategy);
+      if (r < 0)
 	{
-	  log_msg(LOG_ERR, "ERROR (econf): cannot get key 'window-start': %s",
-		  econf_errString(error));
+	  log_msg(LOG_ERR, "ERROR: cannot parse strategy (%s): %s",
+		  str_strategy, strerror(-r));
 	  return -1;
 	}
-      error = econf_getStringValue(key_file, RM_GROUP, "window-duration", &str_duration);
-      if (error && error != ECONF_NOKEY)
+    }
+
+  _cleanup_(freep) usec_t *durations = NULL;
+  size_t n_durations = 0;
+  if (str_duration != NULL)
+    {
+      r = rm_durations_from_string(str_duration, &durations, &n_durations);
+      if (r < 0)
 	{
-	  log_msg(LOG_ERR, "ERROR (econf): cannot get key 'window-duration': %s",
-		  econf_errString(error));
+	  log_msg(LOG_ERR, "ERROR: cannot parse window-duration (%s)",
+		  str_duration);
 	  return -1;
 	}
+    }
+
+  RM_MaintWindow *new_windows = NULL;
+  size_t n_new_windows = 0;
+  if (str_start != NULL)
+    {
+      const usec_t unset = USEC_INFINITY;
 
-      error = econf_getStringValue(key_file, RM_GROUP, "strategy", &str_strategy);
-      if (error && error != ECONF_NOKEY)
+      r = rm_windows_from_string(str_start, &unset, 1,
+				 &new_windows, &n_new_windows);
+      if (r == -EDOM)
+	{
+	  log_msg(LOG_ERR, "ERROR: window-start (%s) never elapses",
+		  str_start);
+	  return -1;
+	}
+      if (r < 0)
 	{
-	  log_msg(LOG_ERR, "ERROR (econf): cannot get key 'strategy': %s",
-		  econf_errString(error));
+	  log_msg(LOG_ERR, "ERROR: cannot parse window-start (%s): %s",
+		  str_start, strerror(-r));
 	  return -1;
 	}
 
-      RM_RebootStrategy new_strategy = RM_REBOOTSTRATEGY_UNKNOWN;
-      if (str_strategy != NULL)
+      /* Without a new window-duration keep the current ones */
+      if (durations == NULL && ctx->n_maint_windows > 0)
+	for (size_t i = 0; i < n_new_windows; i++)
+	  new_windows[i].duration =
+	    ctx->maint_windows[ctx->n_maint_windows == n_new_windows ? i : 0].duration;
+    }
+
+  if (durations != NULL)
+    {
+      /* Without a new window-start the current windows get the
+	 durations, which is done below together with the other
+	 changes */
+      if (new_windows != NULL)
+	r = rm_windows_set_durations(new_windows, n_new_windows,
+				     durations, n_durations);
+      else
+	r = (n_durations == 1 || n_durations == ctx->n_maint_windows) ? 0 : -ERANGE;
+      if (r < 0)
 	{
-	  r = rm_string_to_strategy(str_strategy, &new_strategy);
-	  if (r < 0)
-	    {
-	      log_msg(LOG_ERR, "ERROR: cannot parse strategy (%s): %s",
-		      str_strategy, strerror(-r));
-	      return -1;
-	    }
+	  log_msg(LOG_ERR, "ERROR: window-duration (%s) does not match the number of maintenance windows",
+		  str_duration);
+	  rm_windows_free(new_windows, n_new_windows);
+	  return -1;
 	}
+    }
 
-      CalendarSpec *new_start = NULL;
-      if (str_start != NULL)
+  RM_Blackout *new_blackouts = NULL;
+  size_t n_new_blackouts = 0;
+  if (str_blackout != NULL)
+    {
+      r = rm_blackouts_from_string(str_blackout, &new_blackouts,
+				   &n_new_blackouts);
+      if (r == 0)
 	{
-	  r = calendar_spec_from_string(str_start, &new_start);
+	  /* Expand the blackouts once, so that too dense or endless
+	     ones are rejected already here */
+	  RM_BlackoutIndex idx = {};
+	  usec_t allowed;
+
+	  r = rm_blackout_index_lookup(&idx, new_blackouts, n_new_blackouts,
+				       now(CLOCK_REALTIME), &allowed, NULL);
+	  rm_blackout_index_free(&idx);
 	  if (r < 0)
-	    {
-	      log_msg(LOG_ERR, "ERROR: cannot parse window-start (%s): %s",
-		      str_start, strerror(-r));
-	      return -1;
-	    }
+	    rm_blackouts_free(new_blackouts, n_new_blackouts);
 	}
-
-      time_t new_duration = BAD_TIME;
-      if (str_duration != NULL)
+      if (r < 0)
 	{
-	  if ((new_duration = parse_duration(str_duration)) == BAD_TIME)
-	    {
-	      log_msg(LOG_ERR, "ERROR: cannot parse window-duration (%s)",
-		      str_duration);
-	      return -1;
-	    }
+	  log_msg(LOG_ERR, "ERROR: cannot parse blackout (%s): %s",
+		  str_blackout, r == -EDOM ? "never elapses" :
+		  r == -ETIME ? "does not end" : strerror(-r));
+	  rm_windows_free(new_windows, n_new_windows);
+	  return -1;
 	}
+    }
 
-      if (new_strategy != RM_REBOOTSTRATEGY_UNKNOWN)
-	ctx->reboot_strategy = new_strategy;
-      if (new_start != NULL)
+  RM_AvoidTimer *new_timers = NULL;
+  size_t n_new_timers = 0;
+  if (str_avoid_timers != NULL)
+    {
+      r = rm_avoid_timers_from_string(str_avoid_timers, &new_timers,
+				      &n_new_timers);
+      if (r < 0)
 	{
-	  calendar_spec_free(ctx->maint_window_start);
-	  ctx->maint_window_start = new_start;
+	  log_msg(LOG_ERR, "ERROR: cannot parse avoid-timers (%s): %s",
+		  str_avoid_timers, strerror(-r));
+	  rm_windows_free(new_windows, n_new_windows);
+	  rm_blackouts_free(new_blackouts, n_new_blackouts);
+	  return -1;
 	}
-      if (new_duration != BAD_TIME)
-	ctx->maint_window_duration = new_duration;
     }
+
+  if (new_strategy != RM_REBOOTSTRATEGY_UNKNOWN)
+    ctx->reboot_strategy = new_strategy;
+  if (str_accuracy != NULL)
+    ctx->timer_accuracy = accuracy;
+  if (has_retries)
+    ctx->reboot_retries = retries;
+  if (has_fallback)
+    ctx->soft_reboot_fallback = fallback;
+  if (new_blackouts != NULL)
+    {
+      /* the blackouts of the timers are added again by the caller
+	 with rm_timer_blackouts_update() */
+      rm_blackouts_free(ctx->blackouts, ctx->n_blackouts);
+      rm_blackout_index_free(&ctx->blackout_index);
+      ctx->blackouts = new_blackouts;
+      ctx->n_blackouts = n_new_blackouts;
+      ctx->n_timer_blackouts = 0;
+    }
+  if (new_timers != NULL)
+    {
+      rm_avoid_timers_free(ctx->avoid_timers, ctx->n_avoid_timers);
+      ctx->avoid_timers = new_timers;
+      ctx->n_avoid_timers = n_new_timers;
+    }
+  if (new_windows != NULL)
+    {
+      rm_windows_free(ctx->maint_windows, ctx->n_maint_windows);
+      ctx->maint_windows = new_windows;
+      ctx->n_maint_windows = n_new_windows;
+    }
+  else if (durations != NULL)
+    rm_windows_set_durations(ctx->maint_windows, ctx->n_maint_windows,
+			     durations, n_durations);
   return 0;
 }
+
+int
+load_config(RM_CTX *ctx)
+{
+  _cleanup_(econf_freeFilep) econf_file *key_file = NULL;
+  econf_err error;
+
+  error = open_config_file(&key_file);
+  if (error)
+    {
+      /* ignore if there is no configuration file at all */
+      if (error == ECONF_NOFILE)
+	return 0;
+
+      log_msg(LOG_ERR, "econf_readConfig: %s\n",
+	      econf_errString(error));
+      return -1;
+    }
+
+  if (key_file == NULL) /* can this happen? */
+    {
+      log_msg(LOG_ERR, "Cannot load 'rebootmgrd.conf'");
+      return 0;
+    }
+
+  return apply_config(ctx, key_file);
+}
+
+int
+load_config_file(RM_CTX *ctx, const char *path)
+{
+  _cleanup_(econf_freeFilep) econf_file *key_file = NULL;
+  econf_err error;
+
+  error = econf_readFile(&key_file, path, "=", "#");
+  if (error)
+    {
+      log_msg(LOG_ERR, "econf_readFile: %s\n",
+	      econf_errString(error));
+      return -1;
+    }
+
+  return apply_config(ctx, key_file);
+}
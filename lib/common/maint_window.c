@@ -0,0 +1,287 @@
+//SPDX-License-Identifier: GPL-2.0-or-later
+
+/* Copyright (c) 2025 Thorsten Kukuk
+   Author: Thorsten Kukuk <kukuk@suse.com>
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License along
+   with this program; if not, see <http://www.gnu.org/licenses/>. */
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "basics.h"
+#include "common.h"
+#include "parse-duration.h"
+
+int
+rm_durations_from_string(const char *str, usec_t **ret, size_t *ret_n)
+{
+  _cleanup_(freep) usec_t *durations = NULL;
+  size_t n = 0;
+  int r;
+
+  if (str == NULL || *str == '\0')
+    return -EINVAL;
+
+  durations = calloc(rm_list_count_items(str), sizeof(usec_t));
+  if (durations == NULL)
+    return -ENOMEM;
+
+  for (const char *p = str;;)
+    {
+      _cleanup_(freep) char *item = NULL;
+
+      r = rm_list_next_item(&p, &item);
+      if (r < 0)
+	return r;
+      if (r == 0)
+	break;
+
+      r = parse_duration_usec(item, &durations[n++]);
+      if (r < 0)
+	return r;
+    }
+
+  *ret = TAKE_PTR(durations);
+  *ret_n = n;
+
+  return 0;
+}
+
+int
+rm_windows_from_string(const char *str, const usec_t *durations,
+		       size_t n_durations, RM_MaintWindow **ret,
+		       size_t *ret_n)
+{
+  RM_MaintWindow *windows;
+  size_t n = 0;
+  int r;
+
+  if (str == NULL || *str == '\0')
+    return -EINVAL;
+
+  size_t n_items = rm_list_count_items(str);
+  if (n_durations != 1 && n_durations != n_items)
+    return -ERANGE;
+
+  windows = calloc(n_items, sizeof(RM_MaintWindow));
+  if (windows == NULL)
+    return -ENOMEM;
+
+  for (const char *p = str;;)
+    {
+      _cleanup_(freep) char *item = NULL;
+
+      r = rm_list_next_item(&p, &item);
+      if (r < 0)
+	goto fail;
+      if (r == 0)
+	break;
+
+      r = calendar_spec_from_string(item, &windows[n].start);
+      if (r < 0)
+	goto fail;
+      windows[n].duration = durations[n_durations == 1 ? 0 : n];
+      n++;
+    }
+
+  *ret = windows;
+  *ret_n = n;
+
+  return 0;
+
+ fail:
+  rm_windows_free(windows, n);
+  return r;
+}
+
+int
+rm_windows_set_durations(RM_MaintWindow *windows, size_t n,
+			 const usec_t *durations, size_t n_durations)
+{
+  if (n_durations != 1 && n_durations != n)
+    return -ERANGE;
+
+  for (size_t i = 0; i < n; i++)
+    windows[i].duration = durations[n_durations == 1 ? 0 : i];
+
+  return 0;
+}
+
+void
+rm_windows_free(RM_MaintWindow *windows, size_t n)
+{
+  if (windows == NULL)
+    return;
+
+  for (size_t i = 0; i < n; i++)
+    calendar_spec_free(windows[i].start);
+  free(windows);
+}
+
+int
+rm_windows_to_string(const RM_MaintWindow *windows, size_t n,
+		     char **ret_start, char **ret_duration)
+{
+  _cleanup_(freep) char *start_str = NULL;
+  _cleanup_(freep) char *duration_str = NULL;
+  int r;
+
+  for (size_t i = 0; i < n; i++)
+    {
+      if (ret_start)
+	{
+	  r = rm_list_append(&start_str, calendar_spec_string(windows[i].start));
+	  if (r < 0)
+	    return r;
+	}
+
+      if (ret_duration)
+	{
+	  char str[RM_DURATION_STRING_MAX];
+
+	  r = rm_duration_format(windows[i].duration, str, sizeof(str));
+	  if (r < 0)
+	    return r;
+	  r = rm_list_append(&duration_str, str);
+	  if (r < 0)
+	    return r;
+	}
+    }
+
+  if (ret_start)
+    *ret_start = TAKE_PTR(start_str);
+  if (ret_duration)
+    *ret_duration = TAKE_PTR(duration_str);
+
+  return 0;
+}
+
+/* Min-heap of the windows, ordered by the start of their next window.
+   Ties are broken by the position in the configuration, so that the
+   result does not depend on the order of the heap operations. */
+
+static bool
+entry_less(const RM_WindowQueueEntry *a, const RM_WindowQueueEntry *b)
+{
+  if (a->start != b->start)
+    return a->start < b->start;
+  return a->window < b->window;
+}
+
+static void
+sift_down(RM_WindowQueue *q, size_t i)
+{
+  for (;;)
+    {
+      size_t l = 2 * i + 1, r = l + 1, min = i;
+
+      if (l < q->n && entry_less(&q->entries[l], &q->entries[min]))
+	min = l;
+      if (r < q->n && entry_less(&q->entries[r], &q->entries[min]))
+	min = r;
+      if (min == i)
+	return;
+
+      RM_WindowQueueEntry tmp = q->entries[i];
+      q->entries[i] = q->entries[min];
+      q->entries[min] = tmp;
+      i = min;
+    }
+}
+
+int
+rm_window_queue_init(RM_WindowQueue *q, const RM_MaintWindow *windows,
+		     size_t n, usec_t usec)
+{
+  int r;
+
+  q->windows = windows;
+  q->n = 0;
+  q->entries = calloc(n > 0 ? n : 1, sizeof(RM_WindowQueueEntry));
+  if (q->entries == NULL)
+    return -ENOMEM;
+
+  for (size_t i = 0; i < n; i++)
+    {
+      RM_WindowQueueEntry *e = &q->entries[q->n];
+      usec_t duration = windows[i].duration;
+
+      /* The first start after usec - duration is either in the past,
+	 then usec is inside this window, or the next window. */
+      r = calendar_spec_cache_next(windows[i].start,
+				   usec > duration ? usec - duration : 0,
+				   &e->start);
+      if (r == -ENOENT) /* this window does not come again */
+	continue;
+      if (r < 0)
+	{
+	  q->entries = mfree(q->entries);
+	  return r;
+	}
+
+      e->window = i;
+      q->n++;
+    }
+
+  for (size_t i = q->n / 2; i-- > 0;)
+    sift_down(q, i);
+
+  return 0;
+}
+
+bool
+rm_window_queue_peek(const RM_WindowQueue *q, usec_t *ret_start,
+		     size_t *ret_window)
+{
+  if (q->n == 0)
+    return false;
+
+  if (ret_start)
+    *ret_start = q->entries[0].start;
+  if (ret_window)
+    *ret_window = q->entries[0].window;
+
+  return true;
+}
+
+int
+rm_window_queue_advance(RM_WindowQueue *q)
+{
+  RM_WindowQueueEntry *e = &q->entries[0];
+  int r;
+
+  if (q->n == 0)
+    return -ENOENT;
+
+  /* Only the window which is on top moves on, all others keep their
+     already calculated start. */
+  r = calendar_spec_cache_next(q->windows[e->window].start, e->start,
+			       &e->start);
+  if (r == -ENOENT)
+    *e = q->entries[--q->n];
+  else if (r < 0)
+    return r;
+
+  sift_down(q, 0);
+
+  return 0;
+}
+
+void
+rm_window_queue_free(RM_WindowQueue *q)
+{
+  q->entries = mfree(q->entries);
+  q->n = 0;
+}
@@ -0,0 +1,78 @@
+//SPDX-License-Identifier: GPL-2.0-or-later
+
+/* Copyright (c) 2025 Thorsten Kukuk
+   Author: Thorsten Kukuk <kukuk@suse.com>
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License along
+   with this program; if not, see <http://www.gnu.org/licenses/>. */
+
+#include "config.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "basics.h"
+#include "common.h"
+
+/* Flags of RebootWithFlags(), see org.freedesktop.login1(5) */
+#define SD_LOGIND_SOFT_REBOOT (UINT64_C(1) << 2)
+
+int
+rm_bus_check_logind (sd_bus *bus)
+{
+  _cleanup_(sd_bus_error_free) sd_bus_error error = SD_BUS_ERROR_NULL;
+  int r;
+
+  r = sd_bus_call_method (bus, RM_LOGIND_SERVICE, RM_LOGIND_PATH,
+			  "org.freedesktop.DBus.Peer", "Ping",
+			  &error, NULL, NULL);
+  if (r < 0)
+    log_msg (LOG_ERR, "Cannot reach logind: %s",
+	     error.message ? error.message : strerror (-r));
+
+  return r;
+}
+
+int
+rm_bus_reboot (sd_bus *bus, RM_RebootMethod method)
+{
+  _cleanup_(sd_bus_error_free) sd_bus_error error = SD_BUS_ERROR_NULL;
+  uint64_t flags;
+  int r;
+
+  /* Without SD_LOGIND_SOFT_REBOOT_IF_NEXTROOT_SET_UP a reboot is never
+     turned into a soft-reboot, like SYSTEMCTL_SKIP_AUTO_SOFT_REBOOT=1
+     does for systemctl. */
+  switch (method)
+    {
+    case RM_REBOOTMETHOD_HARD:
+      flags = 0;
+      break;
+    case RM_REBOOTMETHOD_SOFT:
+      flags = SD_LOGIND_SOFT_REBOOT;
+      break;
+    default:
+      return -EINVAL;
+    }
+
+  r = sd_bus_call_method (bus, RM_LOGIND_SERVICE, RM_LOGIND_PATH,
+			  RM_LOGIND_MANAGER, "RebootWithFlags",
+			  &error, NULL, "t", flags);
+  if (r < 0)
+    log_msg (LOG_ERR, "Calling logind to %s failed: %s",
+	     method == RM_REBOOTMETHOD_HARD ? "reboot" : "soft-reboot",
+	     error.message ? error.message : strerror (-r));
+
+  return r;
+}
@@ -28,8 +28,8 @@
 
 int
 save_config(RM_RebootStrategy reboot_strategy,
-	    CalendarSpec *maint_window_start,
-	    time_t maint_window_duration)
+	    const RM_MaintWindow *maint_windows,
+	    size_t n_maint_windows)
 {
   const char *dropin = NULL;
   _cleanup_(econf_freeFilep) econf_file *key_file = NULL;
@@ -69,16 +69,17 @@ save_config(RM_RebootStrategy reboot_strategy,
 	  return -1;
 	}
     }
-  else if (maint_window_start != NULL)
+  else if (n_maint_windows > 0)
     {
       _cleanup_(freep) char *start_str = NULL;
-      _cleanup_(freep) const char *duration_str = NULL;
+      _cleanup_(freep) char *duration_str = NULL;
 
       dropin = "50-maintenance-window.conf";
-      r = calendar_spec_to_string(maint_window_start, &start_str);
+      r = rm_windows_to_string(maint_windows, n_maint_windows,
+			       &start_str, &duration_str);
       if (r < 0)
 	{
-	  log_msg(LOG_ERR, "Converting calendar entry to string failed: %s", strerror(-r));
+	  log_msg(LOG_ERR, "Converting maintenance windows to string failed: %s", strerror(-r));
 	  return -1;
 	}
 
@@ -89,12 +90,6 @@ save_config(RM_RebootStrategy reboot_strategy,
 	  return -1;
 	}
 
-      r = rm_duration_to_string(maint_window_duration, &duration_str);
-      if (r < 0)
-	{
-	  log_msg(LOG_ERR, "Error converting duration to string: %s", strerror(-r));
-	  return -1;
-	}
       error = econf_setStringValue(key_file, RM_GROUP, "window-duration", duration_str);
       if (error)
 	{
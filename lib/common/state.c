@@ -0,0 +1,154 @@
+//SPDX-License-Identifier: GPL-2.0-or-later
+
+/* Copyright (c) 2025 Thorsten Kukuk
+   Author: Thorsten Kukuk <kukuk@suse.com>
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License along
+   with this program; if not, see <http://www.gnu.org/licenses/>. */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "basics.h"
+#include "common.h"
+
+/* The layout of the state file. It lives below /run and is read only
+   by the same rebootmgrd binary on the same machine, so the fields are
+   in host byte order. */
+#define STATE_MAGIC "RMSTATE"
+#define STATE_VERSION 1
+
+struct state_file {
+  char magic[8];
+  uint32_t version;
+  uint32_t status;
+  uint32_t method;
+  uint32_t forced;
+  uint32_t requester;
+  uint32_t reserved;
+  uint64_t reboot_time;
+};
+
+_Static_assert(sizeof(struct state_file) == 40, "state file layout changed");
+
+void
+rm_state_get(const RM_CTX *ctx, RM_State *ret)
+{
+  if (ctx->reboot_status == RM_REBOOTSTATUS_NOT_REQUESTED || ctx->timer == NULL)
+    {
+      *ret = (RM_State) {
+	.status = RM_REBOOTSTATUS_NOT_REQUESTED,
+      };
+      return;
+    }
+
+  *ret = (RM_State) {
+    .status = ctx->reboot_status,
+    .method = ctx->reboot_method,
+    .reboot_time = ctx->reboot_time,
+    .forced = ctx->reboot_forced,
+    .requester = ctx->reboot_requester,
+  };
+}
+
+int
+rm_state_save(const char *path, const RM_State *state)
+{
+  _cleanup_(freep) char *tmp = NULL;
+  struct state_file f;
+  int fd, r = 0;
+
+  /* without a pending reboot there is nothing to restore */
+  if (state->status == RM_REBOOTSTATUS_NOT_REQUESTED)
+    {
+      if (unlink(path) < 0 && errno != ENOENT)
+	return -errno;
+      return 0;
+    }
+
+  memset(&f, 0, sizeof(f));
+  memcpy(f.magic, STATE_MAGIC, sizeof(STATE_MAGIC));
+  f.version = STATE_VERSION;
+  f.status = state->status;
+  f.method = state->method;
+  f.forced = state->forced;
+  f.requester = state->requester;
+  f.reboot_time = state->reboot_time;
+
+  /* write a new file and rename it, so that a crash leaves either the
+     old or the new state behind */
+  if (asprintf(&tmp, "%s.XXXXXX", path) < 0)
+    return -ENOMEM;
+
+  fd = mkostemp(tmp, O_CLOEXEC);
+  if (fd < 0)
+    return -errno;
+
+  if (write(fd, &f, sizeof(f)) != (ssize_t)sizeof(f) || fsync(fd) < 0)
+    r = errno ? -errno : -EIO;
+  if (close(fd) < 0 && r == 0)
+    r = -errno;
+  if (r == 0 && rename(tmp, path) < 0)
+    r = -errno;
+  if (r < 0)
+    unlink(tmp);
+
+  return r;
+}
+
+int
+rm_state_load(const char *path, RM_State *ret)
+{
+  struct state_file f;
+  ssize_t n;
+  int fd;
+
+  fd = open(path, O_RDONLY|O_CLOEXEC);
+  if (fd < 0)
+    return -errno;
+
+  /* one byte more to notice a longer file */
+  char buf[sizeof(f) + 1];
+  n = read(fd, buf, sizeof(buf));
+  close(fd);
+  if (n < 0)
+    return -errno;
+  if (n != (ssize_t)sizeof(f))
+    return -EBADMSG;
+  memcpy(&f, buf, sizeof(f));
+
+  if (memcmp(f.magic, STATE_MAGIC, sizeof(STATE_MAGIC)) != 0 ||
+      f.version != STATE_VERSION)
+    return -EBADMSG;
+  if (f.status != RM_REBOOTSTATUS_REQUESTED &&
+      f.status != RM_REBOOTSTATUS_WAITING_WINDOW)
+    return -EBADMSG;
+  if (f.method != RM_REBOOTMETHOD_HARD && f.method != RM_REBOOTMETHOD_SOFT)
+    return -EBADMSG;
+  if (f.forced > 1 || f.reboot_time == 0 || f.reboot_time >= USEC_INFINITY)
+    return -EBADMSG;
+
+  *ret = (RM_State) {
+    .status = f.status,
+    .method = f.method,
+    .forced = f.forced,
+    .requester = f.requester,
+    .reboot_time = f.reboot_time,
+  };
+
+  return 0;
+}
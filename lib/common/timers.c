@@ -0,0 +1,569 @@
+//SPDX-License-Identifier: GPL-2.0-or-later
+
+/* Copyright (c) 2025 Thorsten Kukuk
+   Author: Thorsten Kukuk <kukuk@suse.com>
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License along
+   with this program; if not, see <http://www.gnu.org/licenses/>. */
+
+#include <ctype.h>
+#include <dirent.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#include "basics.h"
+#include "common.h"
+#include "parse-duration.h"
+
+/* Timer units, which should not be interrupted by a reboot. Each
+   elapse time of their OnCalendar= settings starts a blackout, which
+   lasts for the margin of the timer, the expected run time of the
+   service it starts. The unit files are read like systemd does it,
+   but only the [Timer] section and only OnCalendar= are looked at. */
+
+const char *const rm_unit_dirs[] = {
+  "/etc/systemd/system",
+  "/run/systemd/system",
+  "/usr/local/lib/systemd/system",
+  "/usr/lib/systemd/system",
+  NULL
+};
+
+static bool
+timer_name_valid(const char *name)
+{
+  size_t l = strlen(name);
+
+  if (l <= strlen(".timer") || strcmp(name + l - strlen(".timer"), ".timer") != 0)
+    return false;
+
+  for (const char *p = name; *p; p++)
+    if (!isalnum((unsigned char)*p) && strchr(":-_.\\@", *p) == NULL)
+      return false;
+
+  return name[0] != '.';
+}
+
+static int
+avoid_timer_from_string(const char *str, RM_AvoidTimer *ret)
+{
+  const char *p = strstr(str, " for ");
+  int r;
+
+  *ret = (RM_AvoidTimer) {
+    .margin = RM_TIMER_MARGIN_DEFAULT,
+  };
+
+  if (p)
+    {
+      r = parse_duration_usec(p + 5, &ret->margin);
+      if (r < 0)
+	return r;
+      if (ret->margin == 0)
+	return -EINVAL;
+      while (p > str && isspace((unsigned char)p[-1]))
+	p--;
+      ret->name = strndup(str, p - str);
+    }
+  else
+    ret->name = strdup(str);
+  if (ret->name == NULL)
+    return -ENOMEM;
+
+  if (!timer_name_valid(ret->name))
+    {
+      ret->name = mfree(ret->name);
+      return -EINVAL;
+    }
+
+  return 0;
+}
+
+int
+rm_avoid_timers_from_string(const char *str, RM_AvoidTimer **ret,
+			    size_t *ret_n)
+{
+  RM_AvoidTimer *timers;
+  size_t n = 0;
+  int r;
+
+  if (str == NULL || *str == '\0')
+    return -EINVAL;
+
+  timers = calloc(rm_list_count_items(str), sizeof(RM_AvoidTimer));
+  if (timers == NULL)
+    return -ENOMEM;
+
+  for (const char *p = str;;)
+    {
+      _cleanup_(freep) char *item = NULL;
+
+      r = rm_list_next_item(&p, &item);
+      if (r < 0)
+	goto fail;
+      if (r == 0)
+	break;
+
+      r = avoid_timer_from_string(item, &timers[n]);
+      if (r < 0)
+	goto fail;
+      n++;
+    }
+
+  *ret = timers;
+  *ret_n = n;
+
+  return 0;
+
+ fail:
+  rm_avoid_timers_free(timers, n);
+  return r;
+}
+
+int
+rm_avoid_timers_to_string(const RM_AvoidTimer *timers, size_t n, char **ret)
+{
+  _cleanup_(freep) char *res = NULL;
+  int r;
+
+  for (size_t i = 0; i < n; i++)
+    {
+      char margin[RM_DURATION_STRING_MAX];
+      char item[strlen(timers[i].name) + strlen(" for ") + sizeof(margin)];
+
+      r = rm_duration_format(timers[i].margin, margin, sizeof(margin));
+      if (r < 0)
+	return r;
+      snprintf(item, sizeof(item), "%s for %s", timers[i].name, margin);
+      r = rm_list_append(&res, item);
+      if (r < 0)
+	return r;
+    }
+
+  *ret = TAKE_PTR(res);
+
+  return 0;
+}
+
+void
+rm_avoid_timers_free(RM_AvoidTimer *timers, size_t n)
+{
+  if (timers == NULL)
+    return;
+
+  for (size_t i = 0; i < n; i++)
+    free(timers[i].name);
+  free(timers);
+}
+
+int
+rm_unit_template(const char *name, char **ret)
+{
+  const char *at = strchr(name, '@');
+  const char *dot = strrchr(name, '.');
+  char *t;
+
+  /* "foo@bar.timer" is an instance of "foo@.timer" */
+  if (at == NULL || dot == NULL || dot <= at + 1)
+    return 0;
+
+  if (asprintf(&t, "%.*s%s", (int)(at + 1 - name), name, dot) < 0)
+    return -ENOMEM;
+
+  *ret = t;
+  return 1;
+}
+
+static bool
+name_configures(const char *name, const char *unit)
+{
+  size_t l = strlen(unit);
+
+  return strncmp(name, unit, l) == 0 &&
+    (name[l] == '\0' || strcmp(name + l, ".d") == 0);
+}
+
+bool
+rm_avoid_timers_match(const RM_AvoidTimer *timers, size_t n, const char *name)
+{
+  for (size_t i = 0; i < n; i++)
+    {
+      _cleanup_(freep) char *template = NULL;
+
+      if (name_configures(name, timers[i].name))
+	return true;
+      if (rm_unit_template(timers[i].name, &template) > 0 &&
+	  name_configures(name, template))
+	return true;
+    }
+
+  return false;
+}
+
+typedef struct {
+  char **items;
+  size_t n;
+} StringList;
+
+static void
+string_list_clear(StringList *l)
+{
+  for (size_t i = 0; i < l->n; i++)
+    free(l->items[i]);
+  l->items = mfree(l->items);
+  l->n = 0;
+}
+
+static int
+string_list_add(StringList *l, const char *str)
+{
+  char **items = reallocarray(l->items, l->n + 1, sizeof(char *));
+
+  if (items == NULL)
+    return -ENOMEM;
+  l->items = items;
+
+  l->items[l->n] = strdup(str);
+  if (l->items[l->n] == NULL)
+    return -ENOMEM;
+  l->n++;
+
+  return 0;
+}
+
+static char *
+strip(char *s)
+{
+  char *e;
+
+  while (isspace((unsigned char)*s))
+    s++;
+  e = s + strlen(s);
+  while (e > s && isspace((unsigned char)e[-1]))
+    *--e = '\0';
+
+  return s;
+}
+
+/* Adds the OnCalendar= settings of the unit file to calendars, an
+   empty assignment removes the ones read before. */
+static int
+read_calendars(const char *path, StringList *calendars)
+{
+  _cleanup_(freep) char *line = NULL;
+  size_t size = 0;
+  bool in_timer = false;
+  FILE *fp;
+  int r = 0;
+
+  fp = fopen(path, "re");
+  if (fp == NULL)
+    return -errno;
+
+  while (r >= 0 && getline(&line, &size, fp) > 0)
+    {
+      char *p = strip(line), *eq;
+
+      if (*p == '\0' || *p == '#' || *p == ';')
+	continue;
+      if (*p == '[')
+	{
+	  in_timer = strcmp(p, "[Timer]") == 0;
+	  continue;
+	}
+      if (!in_timer || (eq = strchr(p, '=')) == NULL)
+	continue;
+
+      *eq = '\0';
+      if (strcmp(strip(p), "OnCalendar") != 0)
+	continue;
+
+      p = strip(eq + 1);
+      if (*p == '\0')
+	string_list_clear(calendars);
+      else
+	r = string_list_add(calendars, p);
+    }
+
+  fclose(fp);
+  return r;
+}
+
+/* A unit file, which is empty or a symlink to /dev/null, masks the
+   unit. */
+static bool
+unit_masked(const struct stat *st)
+{
+  return S_ISCHR(st->st_mode) || st->st_size == 0;
+}
+
+static int
+compare_base_names(const void *a, const void *b)
+{
+  const char *const *x = a, *const *y = b;
+
+  return strcmp(strrchr(*x, '/') + 1, strrchr(*y, '/') + 1);
+}
+
+/* Adds the "*.conf" files of the drop-in directory dir/name.d to
+   dropins. A file of the same name in a directory of higher priority
+   replaces it. */
+static int
+find_dropins(const char *root, const char *dir, const char *name,
+	     StringList *dropins)
+{
+  _cleanup_(freep) char *path = NULL;
+  struct dirent *de;
+  DIR *d;
+  int r = 0;
+
+  if (asprintf(&path, "%s%s/%s.d", root, dir, name) < 0)
+    return -ENOMEM;
+
+  d = opendir(path);
+  if (d == NULL)
+    return errno == ENOENT || errno == ENOTDIR ? 0 : -errno;
+
+  while (r >= 0 && (de = readdir(d)) != NULL)
+    {
+      _cleanup_(freep) char *file = NULL;
+      size_t l = strlen(de->d_name);
+      bool seen = false;
+
+      if (de->d_name[0] == '.' || l <= strlen(".conf") ||
+	  strcmp(de->d_name + l - strlen(".conf"), ".conf") != 0)
+	continue;
+
+      for (size_t i = 0; !seen && i < dropins->n; i++)
+	seen = strcmp(strrchr(dropins->items[i], '/') + 1, de->d_name) == 0;
+      if (seen)
+	continue;
+
+      if (asprintf(&file, "%s/%s", path, de->d_name) < 0)
+	r = -ENOMEM;
+      else
+	r = string_list_add(dropins, file);
+    }
+
+  closedir(d);
+  return r;
+}
+
+/* Returns the OnCalendar= settings of the timer unit below root, or
+   -ENOENT if it is not installed or masked. */
+static int
+timer_calendars(const char *root, const char *name, StringList *calendars)
+{
+  _cleanup_(freep) char *template = NULL;
+  StringList dropins = {};
+  bool found = false;
+  int r;
+
+  r = rm_unit_template(name, &template);
+  if (r < 0)
+    return r;
+
+  /* An instance file is used before the file of the template */
+  const char *const units[] = {name, template};
+  for (size_t j = 0; !found && j < ELEMENTSOF(units) && units[j]; j++)
+    for (size_t i = 0; !found && rm_unit_dirs[i]; i++)
+      {
+	_cleanup_(freep) char *path = NULL;
+	struct stat st;
+
+	if (asprintf(&path, "%s%s/%s", root, rm_unit_dirs[i], units[j]) < 0)
+	  return -ENOMEM;
+	if (stat(path, &st) < 0)
+	  continue;
+	if (unit_masked(&st))
+	  return -ENOENT;
+
+	r = read_calendars(path, calendars);
+	if (r < 0)
+	  return r;
+	found = true;
+      }
+  if (!found)
+    return -ENOENT;
+
+  /* The drop-ins of the instance replace those of the template with
+     the same name, all of them are applied in the order of their
+     names. */
+  for (size_t i = 0; rm_unit_dirs[i]; i++)
+    {
+      r = find_dropins(root, rm_unit_dirs[i], name, &dropins);
+      if (r >= 0 && template)
+	r = find_dropins(root, rm_unit_dirs[i], template, &dropins);
+      if (r < 0)
+	goto out;
+    }
+  if (dropins.n > 1)
+    qsort(dropins.items, dropins.n, sizeof(char *), compare_base_names);
+
+  for (size_t i = 0; i < dropins.n; i++)
+    {
+      r = read_calendars(dropins.items[i], calendars);
+      if (r < 0 && r != -ENOENT)
+	goto out;
+    }
+  r = 0;
+
+ out:
+  string_list_clear(&dropins);
+  return r;
+}
+
+/* Adds a blackout for each calendar of the timer to blackouts. A timer
+   whose blackouts cannot be expanded, or cover all the time, is
+   skipped like a timer which is not installed. */
+static int
+timer_blackouts(const char *root, const RM_AvoidTimer *timer,
+		RM_Blackout **blackouts, size_t *n_blackouts)
+{
+  StringList calendars = {};
+  RM_Blackout *all, *new;
+  size_t n_new = 0;
+  int r;
+
+  r = timer_calendars(root, timer->name, &calendars);
+  if (r == -ENOENT)
+    {
+      log_msg(LOG_WARNING, "Timer '%s' to avoid is not installed",
+	      timer->name);
+      return 0;
+    }
+  if (r < 0)
+    return r;
+
+  new = calloc(calendars.n > 0 ? calendars.n : 1, sizeof(RM_Blackout));
+  if (new == NULL)
+    {
+      string_list_clear(&calendars);
+      return -ENOMEM;
+    }
+
+  for (size_t i = 0; i < calendars.n; i++)
+    {
+      CalendarSpec *spec;
+
+      r = calendar_spec_from_string(calendars.items[i], &spec);
+      if (r == -ENOMEM)
+	goto out;
+      if (r < 0)
+	{
+	  /* e.g. a spec which never elapses again, or a newer syntax */
+	  log_msg(LOG_WARNING, "Ignoring OnCalendar=%s of '%s': %s",
+		  calendars.items[i], timer->name, strerror(-r));
+	  continue;
+	}
+
+      new[n_new++] = (RM_Blackout) {
+	.start = spec,
+	.duration = timer->margin,
+      };
+    }
+
+  if (n_new > 0)
+    {
+      RM_BlackoutIndex idx = {};
+      usec_t allowed;
+
+      r = rm_blackout_index_lookup(&idx, new, n_new, now(CLOCK_REALTIME),
+				   &allowed, NULL);
+      rm_blackout_index_free(&idx);
+      if (r == -ENOMEM)
+	goto out;
+      if (r < 0)
+	{
+	  log_msg(LOG_WARNING, "Ignoring timer '%s', it would block reboots: %s",
+		  timer->name, r == -ETIME ? "elapses too often" : strerror(-r));
+	  r = 0;
+	  goto out;
+	}
+    }
+
+  all = reallocarray(*blackouts, *n_blackouts + n_new, sizeof(RM_Blackout));
+  if (all == NULL && *n_blackouts + n_new > 0)
+    {
+      r = -ENOMEM;
+      goto out;
+    }
+  if (n_new > 0)
+    memcpy(all + *n_blackouts, new, n_new * sizeof(RM_Blackout));
+  *blackouts = all;
+  *n_blackouts += n_new;
+  n_new = 0;
+  r = 0;
+
+ out:
+  rm_blackouts_free(new, n_new);
+  string_list_clear(&calendars);
+  return r;
+}
+
+int
+rm_timer_blackouts_update(const char *root, const RM_AvoidTimer *timers,
+			  size_t n, RM_Blackout **blackouts,
+			  size_t *n_blackouts, size_t *n_timer_blackouts)
+{
+  size_t n_config = *n_blackouts - *n_timer_blackouts;
+  RM_Blackout *new = NULL, *all;
+  size_t n_new = 0;
+  int r;
+
+  if (root == NULL)
+    root = "";
+
+  /* Build the new list completely, so that the old one is kept if
+     this fails. */
+  for (size_t i = 0; i < n; i++)
+    {
+      r = timer_blackouts(root, &timers[i], &new, &n_new);
+      if (r < 0)
+	{
+	  rm_blackouts_free(new, n_new);
+	  return r;
+	}
+    }
+
+  all = calloc(n_config + n_new > 0 ? n_config + n_new : 1,
+	       sizeof(RM_Blackout));
+  if (all == NULL)
+    {
+      rm_blackouts_free(new, n_new);
+      return -ENOMEM;
+    }
+
+  /* the configured blackouts move over to the new list */
+  if (n_config > 0)
+    memcpy(all, *blackouts, n_config * sizeof(RM_Blackout));
+  if (n_new > 0)
+    memcpy(all + n_config, new, n_new * sizeof(RM_Blackout));
+  free(new);
+
+  for (size_t i = n_config; i < *n_blackouts; i++)
+    {
+      calendar_spec_free((*blackouts)[i].start);
+      calendar_spec_free((*blackouts)[i].end);
+    }
+  free(*blackouts);
+
+  *blackouts = all;
+  *n_blackouts = n_config + n_new;
+  *n_timer_blackouts = n_new;
+
+  return 0;
+}
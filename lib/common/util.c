@@ -17,7 +17,10 @@
    with this program; if not, see <http://www.gnu.org/licenses/>. */
 
 #include <time.h>
+#include <ctype.h>
 #include <errno.h>
+#include <inttypes.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <libintl.h>
@@ -35,33 +38,49 @@ bool_to_str (bool var)
 }
 
 int
-rm_duration_to_string (time_t duration, const char **ret)
+rm_duration_format (usec_t duration, char *buf, size_t size)
 {
-  char buf[18];
-  struct tm tm;
-  const char *fmt;
+  usec_t secs = duration / USEC_PER_SEC, frac = duration % USEC_PER_SEC;
+  int r, prec = 6;
 
-  if (gmtime_r (&duration, &tm) == NULL)
-    return -errno;
-
-  if (tm.tm_sec > 0)
-    fmt = "%T";
-  else
-    fmt = "%R";
+  if (duration == USEC_INFINITY)
+    return -EINVAL;
 
-  size_t len = strftime (buf, sizeof (buf), fmt, &tm);
-  if (len == 0)
+  /* hours are not wrapped at 24, parse_duration_usec() accepts "72:00" */
+  if (frac > 0)
     {
-      *ret = NULL;
-      return -ENOSPC;
+      for (; frac % 10 == 0; frac /= 10)
+	prec--;
+      r = snprintf (buf, size, "%02" PRIu64 ":%02" PRIu64 ":%02" PRIu64 ".%0*" PRIu64,
+		    secs / 3600, secs / 60 % 60, secs % 60, prec, frac);
     }
+  else if (secs % 60 > 0)
+    r = snprintf (buf, size, "%02" PRIu64 ":%02" PRIu64 ":%02" PRIu64,
+		  secs / 3600, secs / 60 % 60, secs % 60);
+  else
+    r = snprintf (buf, size, "%02" PRIu64 ":%02" PRIu64,
+		  secs / 3600, secs / 60 % 60);
+  if (r < 0 || (size_t) r >= size)
+    return -ENOBUFS;
+
+  return 0;
+}
+
+int
+rm_duration_to_string (usec_t duration, const char **ret)
+{
+  char buf[RM_DURATION_STRING_MAX];
+  char *p;
+  int r;
 
-  char *p = malloc (len + 1);
+  r = rm_duration_format (duration, buf, sizeof (buf));
+  if (r < 0)
+    return r;
+
+  p = strdup (buf);
   if (p == NULL)
     return -ENOMEM;
 
-  strcpy(p, buf);
-
   *ret = p;
 
   return 0;
@@ -156,3 +175,61 @@ rm_method_to_str (RM_RebootMethod method, const char **ret)
   }
   return 0;
 }
+
+int
+rm_list_next_item (const char **p, char **ret)
+{
+  const char *s = *p, *e;
+
+  /* NULL after the last item, so that an empty item after a
+     trailing separator is an error, too */
+  if (s == NULL)
+    return 0;
+
+  e = strchrnul(s, RM_LIST_SEPARATOR);
+  *p = (*e == '\0') ? NULL : e + 1;
+
+  while (s < e && isspace((unsigned char)*s))
+    s++;
+  while (e > s && isspace((unsigned char)e[-1]))
+    e--;
+  if (s == e)
+    return -EINVAL;
+
+  if ((*ret = strndup(s, e - s)) == NULL)
+    return -ENOMEM;
+
+  return 1;
+}
+
+size_t
+rm_list_count_items (const char *str)
+{
+  size_t n = 1;
+
+  for (const char *p = str; (p = strchr(p, RM_LIST_SEPARATOR)) != NULL; p++)
+    n++;
+
+  return n;
+}
+
+int
+rm_list_append (char **str, const char *item)
+{
+  size_t len = *str ? strlen(*str) : 0;
+  char *p;
+
+  p = realloc(*str, len + strlen(item) + 3);
+  if (p == NULL)
+    return -ENOMEM;
+
+  if (len > 0)
+    {
+      p[len++] = RM_LIST_SEPARATOR;
+      p[len++] = ' ';
+    }
+  strcpy(p + len, item);
+  *str = p;
+
+  return 0;
+}
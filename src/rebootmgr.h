@@ -15,7 +15,10 @@
 
 #pragma once
 
+#include <systemd/sd-bus.h>
 #include <systemd/sd-event.h>
+#include <systemd/sd-json.h>
+#include <systemd/sd-varlink.h>
 #include "calendarspec.h"
 
 #define RM_VARLINK_SOCKET_DIR   "/run/rebootmgr"
@@ -41,15 +44,126 @@ typedef enum RM_RebootStatus {
   RM_REBOOTSTATUS_WAITING_WINDOW,
 } RM_RebootStatus;
 
+/* What to do after an attempt to reboot, see escalation.c */
+typedef enum RM_RebootAction {
+  RM_REBOOTACTION_DONE = 0, /* the reboot is started */
+  RM_REBOOTACTION_RETRY,    /* try the same method again */
+  RM_REBOOTACTION_FALLBACK, /* try a hard reboot instead of a soft-reboot */
+  RM_REBOOTACTION_GIVE_UP,
+} RM_RebootAction;
+
+/* A maintenance window, starting at each elapse time of start and
+   lasting duration microseconds, USEC_INFINITY if not set. */
+typedef struct {
+  CalendarSpec *start;
+  usec_t duration;
+} RM_MaintWindow;
+
+/* A period without reboots, either starting at each elapse time of
+   start and lasting duration microseconds, or from start until end for
+   absolute dates. */
+typedef struct {
+  CalendarSpec *start;
+  CalendarSpec *end;
+  usec_t duration;
+} RM_Blackout;
+
+typedef struct {
+  usec_t start;
+  usec_t end;
+} RM_Interval;
+
+/* A timer unit, which a reboot should not interrupt. Each elapse time
+   of its OnCalendar= settings starts a blackout, which lasts margin
+   microseconds, the expected run time of its service. */
+typedef struct {
+  char *name;
+  usec_t margin;
+} RM_AvoidTimer;
+
+/* The blackout periods between from and until, see blackout.c */
+typedef struct {
+  RM_Interval *intervals;
+  size_t n;
+  usec_t from;
+  usec_t until;
+} RM_BlackoutIndex;
+
+/* A pending reboot request, see state.c */
+typedef struct {
+  RM_RebootStatus status;
+  RM_RebootMethod method;
+  usec_t reboot_time;
+  bool forced;
+  uid_t requester;
+} RM_State;
+
 typedef struct {
   RM_RebootStatus reboot_status;
   RM_RebootMethod reboot_method;
   RM_RebootStrategy reboot_strategy;
-  CalendarSpec *maint_window_start;
-  time_t maint_window_duration;
+  RM_MaintWindow *maint_windows;
+  size_t n_maint_windows;
   int temp_off;
   sd_event *loop;
   sd_event_source *timer;
+  /* Connection to the system bus to reboot through logind, NULL if
+     systemctl is called instead */
+  sd_bus *bus;
+  /* The running systemctl, see execute_reboot(), and the outcome of
+     the last attempt to reboot, NULL if there was none. The exit
+     status is the exit code or the signal of systemctl. */
+  sd_event_source *executor;
+  sd_event_source *executor_timeout;
+  bool executor_timed_out;
+  /* the delay before the next attempt after a failure */
+  sd_event_source *retry_timer;
+  unsigned reboot_attempts;
+  const char *reboot_result;
+  int reboot_exit_status;
+  /* escalation if a reboot fails: the number of retries with the same
+     method, and if a failed soft-reboot becomes a hard reboot */
+  unsigned reboot_retries;
+  bool soft_reboot_fallback;
+  /* accuracy of the reboot timer, which lets the kernel coalesce the
+     wakeup with others */
+  usec_t timer_accuracy;
+  /* the reboot was requested for now, regardless of the windows */
+  bool reboot_forced;
+  /* the UID, which requested the reboot */
+  uid_t reboot_requester;
+  /* the request as last written to RM_STATE_FILE */
+  RM_State saved_state;
+  /* changes of CLOCK_REALTIME and of /etc/localtime */
+  sd_event_source *clock_watch;
+  sd_event_source *localtime_watch;
   usec_t reboot_time;
+  RM_Blackout *blackouts;
+  size_t n_blackouts;
+  RM_BlackoutIndex blackout_index;
+  /* The last n_timer_blackouts entries of blackouts are those of
+     avoid_timers, see rm_timer_blackouts_update() */
+  RM_AvoidTimer *avoid_timers;
+  size_t n_avoid_timers;
+  size_t n_timer_blackouts;
+  sd_event_source **unit_watches;
+  size_t n_unit_watches;
+  sd_event_source *timers_refresh;
+  /* The replies of Status and FullStatus, valid as long as their
+     generation is status_generation, which every change of the state
+     increments. FullStatus expires at the end of the next allowed
+     window, too. */
+  uint64_t status_generation;
+  sd_json_variant *status_reply;
+  uint64_t status_reply_generation;
+  sd_json_variant *fullstatus_reply;
+  uint64_t fullstatus_reply_generation;
+  usec_t fullstatus_reply_until;
+  /* The connections of the callers of WatchStatus and the state they
+     got last */
+  sd_varlink **watchers;
+  size_t n_watchers;
+  sd_json_variant *watch_reply;
+  uint64_t watch_reply_generation;
 } RM_CTX;
 
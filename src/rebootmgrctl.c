@@ -18,6 +18,7 @@
 
 #include "config.h"
 
+#include <errno.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdint.h>
@@ -33,19 +34,6 @@
 #define _(String) gettext(String)
 #endif
 
-/* Takes inspiration from Rust's Option::take() method: reads and returns a pointer, but at the same time
- * resets it to NULL. See: https://doc.rust-lang.org/std/option/enum.Option.html#method.take */
-#define TAKE_GENERIC(var, type, nullvalue)                       \
-        ({                                                       \
-                type *_pvar_ = &(var);                           \
-                type _var_ = *_pvar_;                            \
-                type _nullvalue_ = nullvalue;                    \
-                *_pvar_ = _nullvalue_;                           \
-                _var_;                                           \
-        })
-#define TAKE_PTR_TYPE(ptr, type) TAKE_GENERIC(ptr, type, NULL)
-#define TAKE_PTR(ptr) TAKE_PTR_TYPE(ptr, typeof(ptr))
-
 static int
 connect_to_rebootmgr(sd_varlink **ret)
 {
@@ -384,14 +372,54 @@ struct status {
   RM_RebootStrategy strategy;
   char *maint_window_start;
   time_t maint_window_duration;
+  sd_json_variant *maint_windows;
+  sd_json_variant *blackouts;
+  sd_json_variant *avoid_timers;
+  char *next_allowed_window;
   char *reboot_time;
+  char *reboot_result;
+  int reboot_exit_status;
 };
 
 static void
 struct_status_free(struct status *p)
 {
   p->maint_window_start = mfree(p->maint_window_start);
+  p->maint_windows = sd_json_variant_unref(p->maint_windows);
+  p->blackouts = sd_json_variant_unref(p->blackouts);
+  p->avoid_timers = sd_json_variant_unref(p->avoid_timers);
+  p->next_allowed_window = mfree(p->next_allowed_window);
   p->reboot_time = mfree(p->reboot_time);
+  p->reboot_result = mfree(p->reboot_result);
+}
+
+/* Returns the i-th maintenance window of the status. Older daemons
+   report only one window, without the MaintenanceWindows list. */
+static int
+status_get_window(const struct status *p, size_t i,
+		  const char **ret_start, usec_t *ret_duration)
+{
+  if (p->maint_windows == NULL)
+    {
+      if (i > 0 || p->maint_window_start == NULL)
+	return -ENOENT;
+
+      *ret_start = p->maint_window_start;
+      *ret_duration = (usec_t)p->maint_window_duration * USEC_PER_SEC;
+      return 0;
+    }
+
+  if (i >= sd_json_variant_elements(p->maint_windows))
+    return -ENOENT;
+
+  sd_json_variant *w = sd_json_variant_by_index(p->maint_windows, i);
+  const char *start = sd_json_variant_string(sd_json_variant_by_key(w, "Start"));
+  if (start == NULL)
+    return -EBADMSG;
+
+  *ret_start = start;
+  *ret_duration = (usec_t)sd_json_variant_integer(sd_json_variant_by_key(w, "Duration")) * USEC_PER_SEC;
+  return 0;
 }
 
 static int
@@ -404,6 +432,12 @@ get_full_status(struct status *p)
     { "RebootStrategy",            SD_JSON_VARIANT_INTEGER, sd_json_dispatch_int,    offsetof(struct status, strategy),              SD_JSON_MANDATORY },
     { "MaintenanceWindowStart",    SD_JSON_VARIANT_STRING,  sd_json_dispatch_string, offsetof(struct status, maint_window_start),    SD_JSON_MANDATORY },
     { "MaintenanceWindowDuration", SD_JSON_VARIANT_INTEGER, sd_json_dispatch_int64,  offsetof(struct status, maint_window_duration), SD_JSON_MANDATORY },
+    { "MaintenanceWindows",        SD_JSON_VARIANT_ARRAY,   sd_json_dispatch_variant, offsetof(struct status, maint_windows),       0                 },
+    { "Blackouts",                 SD_JSON_VARIANT_ARRAY,   sd_json_dispatch_variant, offsetof(struct status, blackouts),           0                 },
+    { "AvoidTimers",               SD_JSON_VARIANT_ARRAY,   sd_json_dispatch_variant, offsetof(struct status, avoid_timers),        0                 },
+    { "NextAllowedWindow",         SD_JSON_VARIANT_STRING,  sd_json_dispatch_string, offsetof(struct status, next_allowed_window),   0                 },
+    { "LastRebootResult",          SD_JSON_VARIANT_STRING,  sd_json_dispatch_string, offsetof(struct status, reboot_result),         0                 },
+    { "LastRebootExitStatus",      SD_JSON_VARIANT_INTEGER, sd_json_dispatch_int,    offsetof(struct status, reboot_exit_status),    0                 },
     {}
   };
   _cleanup_(sd_varlink_unrefp) sd_varlink *link = NULL;
@@ -446,9 +480,17 @@ print_full_status(void)
     .strategy = RM_REBOOTSTRATEGY_UNKNOWN,
     .maint_window_start = NULL,
     .maint_window_duration = 0,
-    .reboot_time = NULL
+    .maint_windows = NULL,
+    .blackouts = NULL,
+    .avoid_timers = NULL,
+    .next_allowed_window = NULL,
+    .reboot_time = NULL,
+    .reboot_result = NULL,
+    .reboot_exit_status = 0
   };
   const char *str = NULL;
+  const char *start;
+  usec_t duration;
   int r;
 
   r = get_full_status(&status);
@@ -476,11 +518,11 @@ print_full_status(void)
   else
     printf("Strategy: %s\n", str);
 
-  if (status.maint_window_start)
+  for (size_t i = 0; (r = status_get_window(&status, i, &start, &duration)) == 0; i++)
     {
       _cleanup_(freep) const char *duration_str;
 
-      r = rm_duration_to_string(status.maint_window_duration, &duration_str);
+      r = rm_duration_to_string(duration, &duration_str);
       if (r < 0)
 	{
 	  fprintf(stderr, _("Error converting duration to string: %s\n"),
@@ -488,25 +530,165 @@ print_full_status(void)
 	  return r;
 	}
 
-      printf("Start of maintenance window: %s\n", status.maint_window_start);
+      printf("Start of maintenance window: %s\n", start);
       printf("Duration of maintenance window: %s\n", duration_str);
     }
+  if (r != -ENOENT)
+    {
+      fprintf(stderr, _("Failed to parse JSON answer: %s\n"), strerror(-r));
+      return r;
+    }
+
+  for (size_t i = 0; status.blackouts && i < sd_json_variant_elements(status.blackouts); i++)
+    printf("Blackout: %s\n",
+	   sd_json_variant_string(sd_json_variant_by_index(status.blackouts, i)));
+
+  for (size_t i = 0; status.avoid_timers && i < sd_json_variant_elements(status.avoid_timers); i++)
+    printf("Avoided timer: %s\n",
+	   sd_json_variant_string(sd_json_variant_by_index(status.avoid_timers, i)));
+
+  if (status.next_allowed_window)
+    printf("Next allowed maintenance window: %s\n", status.next_allowed_window);
+
+  if (status.reboot_result)
+    printf("Last reboot attempt: %s (%i)\n", status.reboot_result,
+	   status.reboot_exit_status);
+
+  return 0;
+}
+
+struct watch {
+  bool done;
+  int r;
+};
+
+static int
+watch_reply(sd_varlink *link, sd_json_variant *parameters,
+	    const char *error_id, sd_varlink_reply_flags_t flags,
+	    void *userdata)
+{
+  _cleanup_(struct_status_free) struct status status = {
+    .status = RM_REBOOTSTATUS_NOT_REQUESTED,
+    .method = RM_REBOOTMETHOD_UNKNOWN,
+    .strategy = RM_REBOOTSTRATEGY_UNKNOWN,
+  };
+  static const sd_json_dispatch_field dispatch_table[] = {
+    { "RebootStatus",       SD_JSON_VARIANT_INTEGER, sd_json_dispatch_int,     offsetof(struct status, status),        SD_JSON_MANDATORY },
+    { "RequestedMethod",    SD_JSON_VARIANT_INTEGER, sd_json_dispatch_int,     offsetof(struct status, method),        0                 },
+    { "RebootTime",         SD_JSON_VARIANT_STRING,  sd_json_dispatch_string,  offsetof(struct status, reboot_time),   0                 },
+    { "RebootStrategy",     SD_JSON_VARIANT_INTEGER, sd_json_dispatch_int,     offsetof(struct status, strategy),      SD_JSON_MANDATORY },
+    { "MaintenanceWindows", SD_JSON_VARIANT_ARRAY,   sd_json_dispatch_variant, offsetof(struct status, maint_windows), 0                 },
+    {}
+  };
+  struct watch *w = sd_varlink_get_userdata(link);
+  const char *str, *start;
+  usec_t duration;
+  int r;
+
+  if (!(flags & SD_VARLINK_REPLY_CONTINUES))
+    w->done = true;
+
+  if (error_id && strlen(error_id) > 0)
+    {
+      fprintf(stderr, _("Calling rebootmgrd failed: %s\n"), error_id);
+      w->r = -1;
+      return 0;
+    }
+
+  r = sd_json_dispatch(parameters, dispatch_table, SD_JSON_ALLOW_EXTENSIONS, &status);
+  if (r < 0)
+    {
+      fprintf(stderr, _("Failed to parse JSON answer: %s\n"), strerror(-r));
+      w->r = r;
+      w->done = true;
+      return 0;
+    }
+
+  if (rm_status_to_str(status.status, status.method, &str) < 0)
+    str = _("unknown");
+  printf(_("Status: %s\n"), str);
+  if (status.reboot_time)
+    printf(_("Scheduled for: %s\n"), status.reboot_time);
+  if (rm_strategy_to_str(status.strategy, &str) < 0)
+    str = _("unknown");
+  printf(_("Strategy: %s\n"), str);
+  for (size_t i = 0; status_get_window(&status, i, &start, &duration) == 0; i++)
+    {
+      char duration_str[RM_DURATION_STRING_MAX];
+
+      if (rm_duration_format(duration, duration_str, sizeof(duration_str)) >= 0)
+	printf(_("Maintenance window: %s, lasting %s\n"), start, duration_str);
+    }
+  printf("\n");
+  fflush(stdout);
 
   return 0;
 }
 
+/* Prints the status and again after each change of it, until rebootmgrd
+   goes away. */
+static int
+watch_status(void)
+{
+  _cleanup_(sd_varlink_unrefp) sd_varlink *link = NULL;
+  struct watch w = {
+    .done = false,
+    .r = 0,
+  };
+  int r;
+
+  r = connect_to_rebootmgr(&link);
+  if (r < 0)
+    return r;
+
+  sd_varlink_set_userdata(link, &w);
+  r = sd_varlink_bind_reply(link, watch_reply);
+  if (r >= 0)
+    r = sd_varlink_observe(link, "org.openSUSE.rebootmgr.WatchStatus", NULL);
+  if (r < 0)
+    {
+      fprintf(stderr, "Failed to call watch status method: %s\n", strerror(-r));
+      return r;
+    }
+
+  while (!w.done)
+    {
+      r = sd_varlink_process(link);
+      if (r == 0)
+	r = sd_varlink_wait(link, USEC_INFINITY);
+      if (r < 0)
+	{
+	  fprintf(stderr, "Failed to watch the status: %s\n", strerror(-r));
+	  return r;
+	}
+    }
+
+  return w.r;
+}
+
 static int
 dump_config(void)
 {
   _cleanup_(freep) char *start_str = NULL;
-  _cleanup_(freep) const char *duration_str = NULL;
+  _cleanup_(freep) char *duration_str = NULL;
+  _cleanup_(freep) char *blackout_str = NULL;
+  _cleanup_(freep) char *timers_str = NULL;
   const char *strategy_str = NULL;
   RM_CTX ctx;
   int r;
 
   ctx.reboot_strategy = RM_REBOOTSTRATEGY_UNKNOWN;
-  ctx.maint_window_duration = BAD_TIME;
-  ctx.maint_window_start = NULL;
+  ctx.maint_windows = NULL;
+  ctx.n_maint_windows = 0;
+  ctx.blackouts = NULL;
+  ctx.n_blackouts = 0;
+  ctx.blackout_index = (RM_BlackoutIndex) {};
+  ctx.avoid_timers = NULL;
+  ctx.n_avoid_timers = 0;
+  ctx.n_timer_blackouts = 0;
+  ctx.reboot_retries = RM_REBOOT_RETRIES_DEFAULT;
+  ctx.soft_reboot_fallback = true;
+  ctx.timer_accuracy = RM_TIMER_ACCURACY_DEFAULT;
 
   log_init();
 
@@ -526,39 +708,137 @@ dump_config(void)
   else
     strategy_str = _("Not set");
 
-  if (ctx.maint_window_start != NULL)
+  if (ctx.n_maint_windows > 0)
     {
-      r = calendar_spec_to_string(ctx.maint_window_start, &start_str);
+      /* window-start without window-duration leaves the durations unset */
+      r = rm_windows_to_string(ctx.maint_windows, ctx.n_maint_windows, &start_str,
+			       ctx.maint_windows[0].duration != USEC_INFINITY ? &duration_str : NULL);
       if (r < 0)
 	{
-	  fprintf(stderr, _("Converting calendar entry to string failed: %s\n"), strerror(-r));
+	  fprintf(stderr, _("Converting maintenance windows to string failed: %s\n"), strerror(-r));
+	  rm_windows_free(ctx.maint_windows, ctx.n_maint_windows);
 	  return -1;
 	}
     }
-  else
-    start_str = strdup(_("Not set"));
-
-  if (ctx.maint_window_duration != BAD_TIME)
+  if (ctx.n_blackouts > 0)
     {
-      r = rm_duration_to_string(ctx.maint_window_duration, &duration_str);
+      r = rm_blackouts_to_string(ctx.blackouts, ctx.n_blackouts, &blackout_str);
       if (r < 0)
 	{
-	  fprintf(stderr, _("Error converting duration to string: %s\n"), strerror(-r));
+	  fprintf(stderr, _("Converting blackouts to string failed: %s\n"), strerror(-r));
+	  rm_windows_free(ctx.maint_windows, ctx.n_maint_windows);
+	  rm_blackouts_free(ctx.blackouts, ctx.n_blackouts);
 	  return -1;
 	}
     }
-  else
+  if (ctx.n_avoid_timers > 0)
+    {
+      r = rm_avoid_timers_to_string(ctx.avoid_timers, ctx.n_avoid_timers, &timers_str);
+      if (r < 0)
+	{
+	  fprintf(stderr, _("Converting timers to avoid to string failed: %s\n"), strerror(-r));
+	  rm_windows_free(ctx.maint_windows, ctx.n_maint_windows);
+	  rm_blackouts_free(ctx.blackouts, ctx.n_blackouts);
+	  rm_avoid_timers_free(ctx.avoid_timers, ctx.n_avoid_timers);
+	  return -1;
+	}
+    }
+  if (start_str == NULL)
+    start_str = strdup(_("Not set"));
+  if (duration_str == NULL)
     duration_str = strdup(_("Not set"));
 
   printf ("strategy: %s\n", strategy_str);
   printf ("window-start: %s\n", start_str);
   printf ("window-duration: %s\n", duration_str);
-
-  calendar_spec_free (ctx.maint_window_start);
+  printf ("blackout: %s\n", blackout_str ? blackout_str : _("Not set"));
+  printf ("avoid-timers: %s\n", timers_str ? timers_str : _("Not set"));
+  printf ("reboot-retries: %u\n", ctx.reboot_retries);
+  printf ("soft-reboot-fallback: %s\n", bool_to_str(ctx.soft_reboot_fallback));
+  char accuracy_str[RM_DURATION_STRING_MAX];
+  if (rm_duration_format(ctx.timer_accuracy, accuracy_str, sizeof(accuracy_str)) >= 0)
+    printf ("timer-accuracy: %s\n", accuracy_str);
+
+  rm_windows_free(ctx.maint_windows, ctx.n_maint_windows);
+  rm_blackouts_free(ctx.blackouts, ctx.n_blackouts);
+  rm_avoid_timers_free(ctx.avoid_timers, ctx.n_avoid_timers);
 
   return 0;
 }
 
+static int
+show_calendar(const char *str, unsigned long iterations)
+{
+  CalendarSpec *spec = NULL;
+  CalendarSpecIter iter;
+  _cleanup_(freep) char *normalized = NULL;
+  char buf[FORMAT_TIMESTAMP_MAX];
+  usec_t next;
+  int r;
+
+  r = calendar_spec_from_string(str, &spec);
+  if (r == -EDOM)
+    {
+      fprintf(stderr, _("Calendar specification '%s' never elapses\n"), str);
+      return r;
+    }
+  if (r < 0)
+    {
+      fprintf(stderr, _("Failed to parse calendar specification '%s': %s\n"),
+	      str, strerror(-r));
+      return r;
+    }
+
+  r = calendar_spec_to_string(spec, &normalized);
+  if (r < 0)
+    {
+      fprintf(stderr, _("Converting calendar entry to string failed: %s\n"), strerror(-r));
+      goto out;
+    }
+
+  printf(_("  Original form: %s\n"), str);
+  printf(_("Normalized form: %s\n"), normalized);
+
+  r = calendar_spec_iter_init(&iter, spec, now(CLOCK_REALTIME));
+  if (r < 0)
+    {
+      fprintf(stderr, _("Failed to calculate next elapse: %s\n"), strerror(-r));
+      goto out;
+    }
+
+  for (unsigned long i = 1; i <= iterations; i++)
+    {
+      r = calendar_spec_iter_next(&iter, &next);
+      if (r == -ENOENT)
+	{
+	  if (i == 1)
+	    printf(_("    Next elapse: never\n"));
+	  r = 0;
+	  break;
+	}
+      if (r < 0)
+	{
+	  fprintf(stderr, _("Failed to calculate next elapse: %s\n"), strerror(-r));
+	  break;
+	}
+
+      if (i == 1)
+	printf(_("    Next elapse: %s\n"), format_timestamp(buf, sizeof(buf), next));
+      else
+	{
+	  char label[32];
+
+	  snprintf(label, sizeof(label), _("Iter. #%lu"), i);
+	  printf("%15s: %s\n", label, format_timestamp(buf, sizeof(buf), next));
+	}
+      printf(_("       (in UTC): %s\n"), format_timestamp_utc(buf, sizeof(buf), next));
+    }
+
+ out:
+  calendar_spec_free(spec);
+  return r;
+}
+
 static void
 usage(int exit_code)
 {
@@ -569,11 +849,13 @@ usage(int exit_code)
   printf(_("\trebootmgrctl soft-reboot [now]\n"));
   printf(_("\trebootmgrctl cancel\n"));
   printf(_("\trebootmgrctl status [--full|--quiet]\n"));
+  printf(_("\trebootmgrctl watch\n"));
   printf(_("\trebootmgrctl set-strategy best-effort|maint-window|instantly|off\n"));
   printf(_("\trebootmgrctl get-strategy\n"));
-  printf(_("\trebootmgrctl set-window <time> <duration>\n"));
+  printf(_("\trebootmgrctl set-window <time>[;<time>...] <duration>[;<duration>...]\n"));
   printf(_("\trebootmgrctl get-window\n"));
   printf(_("\trebootmgrctl dump-config\n"));
+  printf(_("\trebootmgrctl calendar <time> [--iterations N]\n"));
   exit(exit_code);
 }
 
@@ -688,6 +970,13 @@ main(int argc, char **argv)
 	    }
 	}
     }
+  else if (strcasecmp("watch", argv[1]) == 0)
+    {
+      if (argc > 2)
+	usage(1);
+      if (watch_status() < 0)
+	retval = 1;
+    }
   else if (strcasecmp("is-active", argv[1]) == 0)
     {
       int quiet = 0;
@@ -757,29 +1046,33 @@ main(int argc, char **argv)
     }
   else if (strcasecmp("get-window", argv[1]) == 0)
     {
-      struct status status = {
+      _cleanup_(struct_status_free) struct status status = {
 	.maint_window_start = NULL,
 	.maint_window_duration = 0,
+	.maint_windows = NULL,
       };
+      const char *start;
+      usec_t duration;
       int r;
 
       r = get_full_status(&status);
       if (r < 0)
 	retval = 1;
       else
-	{
-	  _cleanup_(freep) const char *duration_str = NULL;
-	  r = rm_duration_to_string(status.maint_window_duration, &duration_str);
-	  if (r < 0)
-	    {
-	      fprintf(stderr, _("Error converting duration to string: %s\n"),
-		      strerror(-r));
-	      retval = 1;
-	    }
-	  else
+	for (size_t i = 0; status_get_window(&status, i, &start, &duration) == 0; i++)
+	  {
+	    _cleanup_(freep) const char *duration_str = NULL;
+	    r = rm_duration_to_string(duration, &duration_str);
+	    if (r < 0)
+	      {
+		fprintf(stderr, _("Error converting duration to string: %s\n"),
+			strerror(-r));
+		retval = 1;
+		break;
+	      }
 	    printf(_("Maintenance window is set to '%s', lasting %s.\n"),
-		   status.maint_window_start, duration_str);
-	}
+		   start, duration_str);
+	  }
     }
   else if (strcasecmp("set-window", argv[1]) == 0)
     {
@@ -792,6 +1085,25 @@ main(int argc, char **argv)
     retval = cancel_reboot();
   else if (strcasecmp("dump-config", argv[1]) == 0)
     retval = dump_config();
+  else if (strcasecmp("calendar", argv[1]) == 0)
+    {
+      unsigned long iterations = 1;
+
+      if (argc == 5 && strcmp("--iterations", argv[3]) == 0)
+	{
+	  char *ep;
+
+	  errno = 0;
+	  iterations = strtoul(argv[4], &ep, 10);
+	  if (errno != 0 || *ep != '\0' || argv[4][0] == '-' || iterations == 0)
+	    usage(1);
+	}
+      else if (argc != 3)
+	usage(1);
+
+      if (show_calendar(argv[2], iterations) < 0)
+	retval = 1;
+    }
   else
     usage(1);
 
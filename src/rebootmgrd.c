@@ -22,6 +22,16 @@
 #include <stdlib.h>
 #include <stdbool.h>
 #include <libintl.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/inotify.h>
+#include <sys/pidfd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/timerfd.h>
+#include <sys/un.h>
+#include <sys/wait.h>
 #include <systemd/sd-daemon.h>
 #include <systemd/sd-varlink.h>
 
@@ -146,6 +156,36 @@ vl_method_get_environment(sd_varlink *link, sd_json_variant *parameters,
 #endif
 }
 
+/* The replies of Status and FullStatus are kept in the context and
+   built again only after a change of the state, which is announced by
+   status_changed(). */
+
+static int
+build_status (RM_CTX *ctx, sd_json_variant **ret)
+{
+  _cleanup_(sd_json_variant_unrefp) sd_json_variant *v = NULL;
+  char buf[FORMAT_TIMESTAMP_MAX];
+  int r;
+
+  RM_RebootStatus tmp_status = ctx->reboot_status;
+  if (ctx->temp_off)
+    tmp_status = RM_REBOOTSTATUS_NOT_REQUESTED;
+
+  r = sd_json_buildo(&v, SD_JSON_BUILD_PAIR("RebootStatus", SD_JSON_BUILD_INTEGER(tmp_status)));
+  if (r >= 0 && ctx->reboot_method != RM_REBOOTMETHOD_UNKNOWN)
+    {
+      r = sd_json_variant_merge_objectbo(&v,
+	      SD_JSON_BUILD_PAIR("RequestedMethod", SD_JSON_BUILD_INTEGER(ctx->reboot_method)),
+	      SD_JSON_BUILD_PAIR("RebootTime", SD_JSON_BUILD_STRING(format_timestamp(buf, sizeof(buf), ctx->reboot_time))),
+	      SD_JSON_BUILD_PAIR("RebootTimeUSec", SD_JSON_BUILD_UNSIGNED(ctx->reboot_time)));
+    }
+  if (r < 0)
+    return r;
+
+  *ret = TAKE_PTR(v);
+  return 0;
+}
+
 static int
 vl_method_status (sd_varlink *link, sd_json_variant *parameters,
 		  sd_varlink_method_flags_t _unused_(flags),
@@ -154,7 +194,6 @@ vl_method_status (sd_varlink *link, sd_json_variant *parameters,
   static const sd_json_dispatch_field dispatch_table[] = {
     {}
   };
-  char buf[FORMAT_TIMESTAMP_MAX];
   RM_CTX *ctx = userdata;
   int r;
 
@@ -165,26 +204,139 @@ vl_method_status (sd_varlink *link, sd_json_variant *parameters,
   if (r != 0)
     return r;
 
+  if (ctx->status_reply == NULL ||
+      ctx->status_reply_generation != ctx->status_generation)
+    {
+      ctx->status_reply = sd_json_variant_unref (ctx->status_reply);
+      r = build_status (ctx, &ctx->status_reply);
+      if (r < 0)
+	{
+	  log_msg (LOG_ERR, "Failed to build JSON data: %s", strerror (-r));
+	  return r;
+	}
+      ctx->status_reply_generation = ctx->status_generation;
+    }
+
+  return sd_varlink_reply (link, ctx->status_reply);
+}
+
+/* The maintenance windows as array of MaintenanceWindow, the
+   interface reports the durations in seconds. */
+static int
+build_windows (RM_CTX *ctx, sd_json_variant **ret)
+{
+  _cleanup_(sd_json_variant_unrefp) sd_json_variant *windows = NULL;
+  int r = 0;
+
+  for (size_t i = 0; r >= 0 && i < ctx->n_maint_windows; i++)
+    r = sd_json_variant_append_arraybo(&windows,
+	    SD_JSON_BUILD_PAIR("Start", SD_JSON_BUILD_STRING(calendar_spec_string(ctx->maint_windows[i].start))),
+	    SD_JSON_BUILD_PAIR("Duration", SD_JSON_BUILD_INTEGER(ctx->maint_windows[i].duration / USEC_PER_SEC)));
+  if (r < 0)
+    return r;
+
+  *ret = TAKE_PTR(windows);
+  return 0;
+}
+
+/* Besides the state, the reply contains the next allowed window,
+   which stays the same until the end of it, returned in valid_until. */
+static int
+build_fullstatus (RM_CTX *ctx, sd_json_variant **ret, usec_t *valid_until)
+{
   _cleanup_(sd_json_variant_unrefp) sd_json_variant *v = NULL;
+  int r;
+
+  *valid_until = USEC_INFINITY;
 
   RM_RebootStatus tmp_status = ctx->reboot_status;
   if (ctx->temp_off)
     tmp_status = RM_REBOOTSTATUS_NOT_REQUESTED;
 
-  r = sd_json_buildo(&v, SD_JSON_BUILD_PAIR("RebootStatus", SD_JSON_BUILD_INTEGER(tmp_status)));
-  if (r == 0 && ctx->reboot_method != RM_REBOOTMETHOD_UNKNOWN)
+  r = sd_json_buildo (&v,
+		      SD_JSON_BUILD_PAIR("RebootStatus", SD_JSON_BUILD_INTEGER(tmp_status)),
+		      SD_JSON_BUILD_PAIR("RebootStrategy", SD_JSON_BUILD_INTEGER(ctx->reboot_strategy)));
+
+  if (r >= 0 && ctx->reboot_method != RM_REBOOTMETHOD_UNKNOWN)
+    r = sd_json_variant_merge_objectbo(&v, SD_JSON_BUILD_PAIR("RequestedMethod", SD_JSON_BUILD_INTEGER(ctx->reboot_method)));
+  if (r >= 0 && ctx->n_maint_windows > 0)
     {
+      _cleanup_(sd_json_variant_unrefp) sd_json_variant *windows = NULL;
+
+      /* The first window is reported on its own, too, for clients
+	 which know only about one window. */
       r = sd_json_variant_merge_objectbo(&v,
-	      SD_JSON_BUILD_PAIR("RequestedMethod", SD_JSON_BUILD_INTEGER(ctx->reboot_method)),
-	      SD_JSON_BUILD_PAIR("RebootTime", SD_JSON_BUILD_STRING(format_timestamp(buf, sizeof(buf), ctx->reboot_time))));
+	      SD_JSON_BUILD_PAIR("MaintenanceWindowStart", SD_JSON_BUILD_STRING(calendar_spec_string(ctx->maint_windows[0].start))),
+	      SD_JSON_BUILD_PAIR("MaintenanceWindowDuration", SD_JSON_BUILD_INTEGER(ctx->maint_windows[0].duration / USEC_PER_SEC)));
+      if (r >= 0)
+	r = build_windows (ctx, &windows);
+      if (r >= 0)
+	r = sd_json_variant_merge_objectbo(&v, SD_JSON_BUILD_PAIR("MaintenanceWindows", SD_JSON_BUILD_VARIANT(windows)));
     }
-  if (r < 0)
+  if (r >= 0 && ctx->reboot_time)
     {
-      log_msg (LOG_ERR, "Failed to build JSON data: %s", strerror (-r));
-      return r;
+      char buf[FORMAT_TIMESTAMP_MAX];
+      r = sd_json_variant_merge_objectbo(&v,
+	      SD_JSON_BUILD_PAIR("RebootTime", SD_JSON_BUILD_STRING(format_timestamp(buf, sizeof(buf), ctx->reboot_time))),
+	      SD_JSON_BUILD_PAIR("RebootTimeUSec", SD_JSON_BUILD_UNSIGNED(ctx->reboot_time)));
+    }
+  if (r >= 0 && ctx->reboot_result)
+    r = sd_json_variant_merge_objectbo(&v,
+	    SD_JSON_BUILD_PAIR("LastRebootResult", SD_JSON_BUILD_STRING(ctx->reboot_result)),
+	    SD_JSON_BUILD_PAIR("LastRebootExitStatus", SD_JSON_BUILD_INTEGER(ctx->reboot_exit_status)));
+  /* the blackouts of the timers are reported as AvoidTimers */
+  if (r >= 0 && ctx->n_blackouts > ctx->n_timer_blackouts)
+    {
+      _cleanup_(sd_json_variant_unrefp) sd_json_variant *blackouts = NULL;
+
+      for (size_t i = 0; r >= 0 && i < ctx->n_blackouts - ctx->n_timer_blackouts; i++)
+	{
+	  char str[rm_blackout_format_max(&ctx->blackouts[i])];
+
+	  r = rm_blackout_format(&ctx->blackouts[i], str, sizeof(str));
+	  if (r >= 0)
+	    r = sd_json_variant_append_arrayb(&blackouts, SD_JSON_BUILD_STRING(str));
+	}
+      if (r >= 0)
+	r = sd_json_variant_merge_objectbo(&v, SD_JSON_BUILD_PAIR("Blackouts", SD_JSON_BUILD_VARIANT(blackouts)));
+    }
+  if (r >= 0 && ctx->n_avoid_timers > 0)
+    {
+      _cleanup_(sd_json_variant_unrefp) sd_json_variant *timers = NULL;
+
+      for (size_t i = 0; r >= 0 && i < ctx->n_avoid_timers; i++)
+	{
+	  _cleanup_(freep) char *str = NULL;
+
+	  r = rm_avoid_timers_to_string(&ctx->avoid_timers[i], 1, &str);
+	  if (r >= 0)
+	    r = sd_json_variant_append_arrayb(&timers, SD_JSON_BUILD_STRING(str));
+	}
+      if (r >= 0)
+	r = sd_json_variant_merge_objectbo(&v, SD_JSON_BUILD_PAIR("AvoidTimers", SD_JSON_BUILD_VARIANT(timers)));
+    }
+  if (r >= 0)
+    {
+      usec_t start, end;
+
+      /* no next window is not an error of this call */
+      if (rm_next_allowed_window(ctx->maint_windows, ctx->n_maint_windows,
+				 &ctx->blackout_index, ctx->blackouts,
+				 ctx->n_blackouts, now(CLOCK_REALTIME),
+				 &start, &end) >= 0)
+	{
+	  char buf[FORMAT_TIMESTAMP_MAX];
+	  r = sd_json_variant_merge_objectbo(&v,
+		  SD_JSON_BUILD_PAIR("NextAllowedWindow", SD_JSON_BUILD_STRING(format_timestamp(buf, sizeof(buf), start))),
+		  SD_JSON_BUILD_PAIR("NextAllowedWindowUSec", SD_JSON_BUILD_UNSIGNED(start)));
+	  *valid_until = end;
+	}
     }
+  if (r < 0)
+    return r;
 
-  return sd_varlink_reply (link, v);
+  *ret = TAKE_PTR(v);
+  return 0;
 }
 
 static int
@@ -205,66 +357,204 @@ vl_method_fullstatus (sd_varlink *link, sd_json_variant *parameters,
   if (r != 0)
     return r;
 
-  _cleanup_(sd_json_variant_unrefp) sd_json_variant *v = NULL;
+  if (ctx->fullstatus_reply == NULL ||
+      ctx->fullstatus_reply_generation != ctx->status_generation ||
+      now (CLOCK_REALTIME) >= ctx->fullstatus_reply_until)
+    {
+      ctx->fullstatus_reply = sd_json_variant_unref (ctx->fullstatus_reply);
+      r = build_fullstatus (ctx, &ctx->fullstatus_reply,
+			    &ctx->fullstatus_reply_until);
+      if (r < 0)
+	{
+	  log_msg (LOG_ERR, "Failed to build JSON data: %s", strerror (-r));
+	  return r;
+	}
+      ctx->fullstatus_reply_generation = ctx->status_generation;
+    }
 
-  RM_RebootStatus tmp_status = ctx->reboot_status;
-  if (ctx->temp_off)
-    tmp_status = RM_REBOOTSTATUS_NOT_REQUESTED;
+  return sd_varlink_reply (link, ctx->fullstatus_reply);
+}
 
-  r = sd_json_buildo (&v,
-		      SD_JSON_BUILD_PAIR("RebootStatus", SD_JSON_BUILD_INTEGER(tmp_status)),
-		      SD_JSON_BUILD_PAIR("RebootStrategy", SD_JSON_BUILD_INTEGER(ctx->reboot_strategy)));
+/* The state sent to the callers of WatchStatus: the reply of Status
+   plus the strategy and the maintenance windows. */
+static int
+build_watch_status (RM_CTX *ctx, sd_json_variant **ret)
+{
+  _cleanup_(sd_json_variant_unrefp) sd_json_variant *v = NULL;
+  int r;
 
-  if (r >= 0 && ctx->reboot_method != RM_REBOOTMETHOD_UNKNOWN)
-    r = sd_json_variant_merge_objectbo(&v, SD_JSON_BUILD_PAIR("RequestedMethod", SD_JSON_BUILD_INTEGER(ctx->reboot_method)));
-  if (r >= 0 && ctx->maint_window_start)
+  r = build_status (ctx, &v);
+  if (r >= 0)
+    r = sd_json_variant_merge_objectbo(&v, SD_JSON_BUILD_PAIR("RebootStrategy", SD_JSON_BUILD_INTEGER(ctx->reboot_strategy)));
+  if (r >= 0 && ctx->n_maint_windows > 0)
     {
-      _cleanup_(freep) char *str = NULL;
+      _cleanup_(sd_json_variant_unrefp) sd_json_variant *windows = NULL;
 
-      calendar_spec_to_string(ctx->maint_window_start, &str);
-      r = sd_json_variant_merge_objectbo(&v, SD_JSON_BUILD_PAIR("MaintenanceWindowStart", SD_JSON_BUILD_STRING(str)));
-    }
-  if (r >= 0 && ctx->maint_window_duration != BAD_TIME)
-    r = sd_json_variant_merge_objectbo(&v, SD_JSON_BUILD_PAIR("MaintenanceWindowDuration", SD_JSON_BUILD_INTEGER(ctx->maint_window_duration)));
-  if (r >= 0 && ctx->reboot_time)
-    {
-      char buf[FORMAT_TIMESTAMP_MAX];
-      r = sd_json_variant_merge_objectbo(&v, SD_JSON_BUILD_PAIR("RebootTime", SD_JSON_BUILD_STRING(format_timestamp(buf, sizeof(buf), ctx->reboot_time))));
+      r = build_windows (ctx, &windows);
+      if (r >= 0)
+	r = sd_json_variant_merge_objectbo(&v, SD_JSON_BUILD_PAIR("MaintenanceWindows", SD_JSON_BUILD_VARIANT(windows)));
     }
+  if (r < 0)
+    return r;
+
+  *ret = TAKE_PTR(v);
+  return 0;
+}
+
+static int
+update_watch_status (RM_CTX *ctx)
+{
+  if (ctx->watch_reply != NULL &&
+      ctx->watch_reply_generation == ctx->status_generation)
+    return 0;
+
+  _cleanup_(sd_json_variant_unrefp) sd_json_variant *v = NULL;
+  int r;
 
+  r = build_watch_status (ctx, &v);
   if (r < 0)
     {
       log_msg (LOG_ERR, "Failed to build JSON data: %s", strerror (-r));
       return r;
     }
+  ctx->watch_reply_generation = ctx->status_generation;
+
+  if (ctx->watch_reply != NULL && sd_json_variant_equal (v, ctx->watch_reply))
+    return 0;
+
+  sd_json_variant_unref (ctx->watch_reply);
+  ctx->watch_reply = TAKE_PTR(v);
 
-  return sd_varlink_reply (link, v);
+  return 1;
 }
 
-static int
-calc_reboot_time (RM_CTX *ctx, usec_t *ret)
+/* Writes the pending reboot to RM_STATE_FILE, if it changed, so that
+   a restarted rebootmgrd continues to wait for it. */
+static void
+save_state (RM_CTX *ctx)
 {
-  usec_t next;
-  usec_t curr = now (CLOCK_REALTIME);
-  usec_t duration = ctx->maint_window_duration * USEC_PER_SEC;
+  const RM_State *saved = &ctx->saved_state;
+  RM_State state;
+  int r;
 
-  /* Check, if we are inside the maintenance window. If yes, reboot now. */
-  int r = calendar_spec_next_usec (ctx->maint_window_start, curr - duration, &next);
+  rm_state_get (ctx, &state);
+  if (state.status == saved->status && state.method == saved->method &&
+      state.reboot_time == saved->reboot_time &&
+      state.forced == saved->forced && state.requester == saved->requester)
+    return;
+
+  r = rm_state_save (RM_STATE_FILE, &state);
   if (r < 0)
     {
-      log_msg (LOG_ERR, "ERROR: Internal error converting the timer: %s",
-               strerror (-r));
-      return r;
+      log_msg (LOG_ERR, "Failed to write '"RM_STATE_FILE"': %s", strerror (-r));
+      return;
+    }
+  ctx->saved_state = state;
+}
+
+/* Saves the state and sends it to the callers of WatchStatus, if a
+   part of it, which they see, changed. */
+static void
+status_changed (RM_CTX *ctx)
+{
+  ctx->status_generation++;
+
+  save_state (ctx);
+
+  if (ctx->n_watchers == 0 || update_watch_status (ctx) <= 0)
+    return;
+
+  for (size_t i = 0; i < ctx->n_watchers; i++)
+    {
+      int r = sd_varlink_notify (ctx->watchers[i], ctx->watch_reply);
+      if (r < 0)
+	log_msg (LOG_ERR, "Failed to send status update: %s", strerror (-r));
     }
-  if (curr > next && curr < next + duration)
+}
+
+static int
+vl_method_watch_status (sd_varlink *link, sd_json_variant *parameters,
+			sd_varlink_method_flags_t flags,
+			void *userdata)
+{
+  static const sd_json_dispatch_field dispatch_table[] = {
+    {}
+  };
+  sd_varlink **watchers;
+  RM_CTX *ctx = userdata;
+  int r;
+
+  if (verbose_flag)
+    log_msg (LOG_INFO, "Varlink method \"WatchStatus\" called...");
+
+  r = sd_varlink_dispatch (link, parameters, dispatch_table, /* userdata= */ NULL);
+  if (r != 0)
+    return r;
+
+  if (!(flags & SD_VARLINK_METHOD_MORE))
+    return sd_varlink_error (link, SD_VARLINK_ERROR_EXPECTED_MORE, NULL);
+
+  r = update_watch_status (ctx);
+  if (r < 0)
+    return r;
+
+  watchers = reallocarray (ctx->watchers, ctx->n_watchers + 1,
+			   sizeof (sd_varlink *));
+  if (watchers == NULL)
+    return -ENOMEM;
+  ctx->watchers = watchers;
+  ctx->watchers[ctx->n_watchers++] = sd_varlink_ref (link);
+
+  return sd_varlink_notify (link, ctx->watch_reply);
+}
+
+static void
+vl_disconnect (sd_varlink_server _unused_(*server), sd_varlink *link,
+	       void *userdata)
+{
+  RM_CTX *ctx = userdata;
+
+  for (size_t i = 0; i < ctx->n_watchers; i++)
+    if (ctx->watchers[i] == link)
+      {
+	sd_varlink_unref (link);
+	ctx->watchers[i] = ctx->watchers[--ctx->n_watchers];
+	break;
+      }
+}
+
+static int
+calc_reboot_time (RM_CTX *ctx, usec_t *ret)
+{
+  usec_t next, end;
+  usec_t curr = now (CLOCK_REALTIME);
+  int r;
+
+  if (ctx->reboot_strategy == RM_REBOOTSTRATEGY_INSTANTLY)
     {
-      /* We are inside the maintenance window. */
-      next = curr;
+      /* Reboot now, or at the end of the current blackout. */
+      r = rm_blackout_index_lookup (&ctx->blackout_index, ctx->blackouts,
+				    ctx->n_blackouts, curr, &next, NULL);
+      if (r < 0)
+	{
+	  log_msg (LOG_ERR, "ERROR: Cannot calculate end of blackout: %s",
+		   strerror (-r));
+	  return r;
+	}
     }
   else
     {
-      /* we are not inside a maintenance window, set timer for next one */
-      r = calendar_spec_next_usec (ctx->maint_window_start, curr, &next);
+      /* Find the earliest maintenance window which is not blacked
+	 out. If we are inside of it, reboot now, else set timer for
+	 the start of it. */
+      r = rm_next_allowed_window (ctx->maint_windows, ctx->n_maint_windows,
+				  &ctx->blackout_index, ctx->blackouts,
+				  ctx->n_blackouts, curr, &next, &end);
+      if (r == -ENOENT || r == -ETIME)
+	{
+	  log_msg (LOG_ERR, "ERROR: No maintenance window outside of the blackouts");
+	  return r;
+	}
       if (r < 0)
 	{
 	  log_msg (LOG_ERR, "ERROR: Internal error converting the timer: %s",
@@ -272,9 +562,19 @@ calc_reboot_time (RM_CTX *ctx, usec_t *ret)
 	  return r;
 	}
 
-      /* Add a random delay between 0 and duration to not reboot
-	 everything at the beginning of the maintenance window */
-      next = next + ((usec_t)rand() * USEC_PER_SEC) % duration;
+      /* Add a random delay between 0 and the remaining time of the
+	 window to not reboot everything at the beginning of the
+	 maintenance window. The timer may elapse timer_accuracy late,
+	 which must still be inside of the window. rand() alone does
+	 not cover windows longer than RAND_MAX microseconds. */
+      if (next > curr && end > next)
+	{
+	  usec_t span = end - next;
+
+	  if (span > ctx->timer_accuracy)
+	    span -= ctx->timer_accuracy;
+	  next = next + (((usec_t)rand() << 31) ^ (usec_t)rand()) % span;
+	}
     }
 
   if (debug_flag || verbose_flag)
@@ -291,12 +591,283 @@ calc_reboot_time (RM_CTX *ctx, usec_t *ret)
   return 0;
 }
 
+/* Returns the accuracy of the reboot timer at reboot_time, which lets
+   it elapse late, but not after the end of the maintenance window or
+   in the next blackout. */
+static usec_t
+reboot_timer_accuracy (RM_CTX *ctx, usec_t reboot_time)
+{
+  usec_t start, end;
+  int r;
+
+  if (ctx->reboot_strategy == RM_REBOOTSTRATEGY_INSTANTLY)
+    r = rm_blackout_index_lookup (&ctx->blackout_index, ctx->blackouts,
+				  ctx->n_blackouts, reboot_time, &start, &end);
+  else
+    r = rm_next_allowed_window (ctx->maint_windows, ctx->n_maint_windows,
+				&ctx->blackout_index, ctx->blackouts,
+				ctx->n_blackouts, reboot_time, &start, &end);
+
+  /* 0 would be the default accuracy of sd-event, 250ms */
+  if (r < 0 || start != reboot_time || end <= reboot_time)
+    return 1;
+
+  return end - reboot_time < ctx->timer_accuracy ?
+    end - reboot_time : ctx->timer_accuracy;
+}
+
 static void
 reset_timer(RM_CTX *ctx)
 {
   ctx->reboot_status = RM_REBOOTSTATUS_NOT_REQUESTED;
   ctx->reboot_method = RM_REBOOTMETHOD_UNKNOWN;
+  ctx->reboot_forced = false;
   ctx->timer = sd_event_source_unref (ctx->timer);
+  ctx->retry_timer = sd_event_source_unref (ctx->retry_timer);
+  status_changed (ctx);
+}
+
+/* Time systemctl gets to hand the reboot over to systemd */
+#define REBOOT_EXECUTOR_TIMEOUT (30 * USEC_PER_SEC)
+
+static void execute_reboot (RM_CTX *ctx);
+
+static void
+exec_systemctl (RM_RebootMethod method)
+{
+  sigset_t mask;
+  int r;
+
+  /* rebootmgrd blocks SIGCHLD for the event loop */
+  sigemptyset (&mask);
+  sigprocmask (SIG_SETMASK, &mask, NULL);
+
+  switch (method)
+    {
+    case RM_REBOOTMETHOD_HARD:
+      char envar1[] = "SYSTEMCTL_SKIP_AUTO_SOFT_REBOOT=1";
+      char *env[] = {envar1, NULL};
+
+      r = execle ("/usr/bin/systemctl", "systemctl", "reboot",
+		  NULL, env);
+
+      break;
+    case RM_REBOOTMETHOD_SOFT:
+      r = execl ("/usr/bin/systemctl", "systemctl", "soft-reboot",
+		 NULL);
+      break;
+    default:
+      /* cannot happen */
+      r = -1;
+      break;
+    }
+  if (r < 0)
+    {
+      log_msg (LOG_ERR, "Calling /usr/bin/systemctl %s failed: %m",
+	       (method == RM_REBOOTMETHOD_HARD)?"reboot":"soft-reboot");
+      _exit (1);
+    }
+  _exit (0);
+}
+
+static void
+executor_free (RM_CTX *ctx)
+{
+  ctx->executor = sd_event_source_disable_unref (ctx->executor);
+  ctx->executor_timeout = sd_event_source_disable_unref (ctx->executor_timeout);
+  ctx->executor_timed_out = false;
+}
+
+static int
+retry_handler (sd_event_source _unused_(*s), uint64_t _unused_(usec),
+	       void *userdata)
+{
+  RM_CTX *ctx = userdata;
+
+  ctx->retry_timer = sd_event_source_unref (ctx->retry_timer);
+  execute_reboot (ctx);
+
+  return 0;
+}
+
+/* Records the outcome of an attempt to reboot. After a failure the
+   reboot is tried again reboot_retries times, then a soft-reboot
+   falls back to a hard reboot if soft_reboot_fallback is set. Every
+   new attempt waits for rm_reboot_retry_delay(), the request stays
+   pending meanwhile. */
+static void
+reboot_attempt_done (RM_CTX *ctx, const char *result, int exit_status)
+{
+  bool success = strcmp (result, "success") == 0;
+  usec_t delay;
+  int r;
+
+  executor_free (ctx);
+  ctx->reboot_result = result;
+  ctx->reboot_exit_status = exit_status;
+
+  if (!success)
+    log_msg (LOG_ERR, "Reboot attempt %u failed: %s (%i)",
+	     ctx->reboot_attempts, result, exit_status);
+
+  /* cancelled meanwhile */
+  if (ctx->reboot_status == RM_REBOOTSTATUS_NOT_REQUESTED)
+    {
+      status_changed (ctx);
+      return;
+    }
+
+  delay = rm_reboot_retry_delay (ctx->reboot_attempts);
+
+  switch (rm_reboot_next_action (success, ctx->reboot_attempts,
+				 ctx->reboot_retries, ctx->reboot_method,
+				 ctx->soft_reboot_fallback))
+    {
+    case RM_REBOOTACTION_DONE:
+      reset_timer (ctx);
+      return;
+    case RM_REBOOTACTION_RETRY:
+      log_msg (LOG_NOTICE, "Trying to reboot again in %llu seconds",
+	       (unsigned long long) (delay / USEC_PER_SEC));
+      break;
+    case RM_REBOOTACTION_FALLBACK:
+      log_msg (LOG_NOTICE, "Falling back from soft-reboot to reboot in %llu seconds",
+	       (unsigned long long) (delay / USEC_PER_SEC));
+      ctx->reboot_method = RM_REBOOTMETHOD_HARD;
+      ctx->reboot_attempts = 0;
+      break;
+    default:
+      log_msg (LOG_ERR, "Giving up to reboot");
+      reset_timer (ctx);
+      return;
+    }
+
+  r = sd_event_add_time_relative (ctx->loop, &ctx->retry_timer,
+				  CLOCK_MONOTONIC, delay, 0,
+				  retry_handler, ctx);
+  if (r < 0)
+    {
+      log_msg (LOG_ERR, "Cannot add retry timer to event loop: %s",
+	       strerror (-r));
+      reset_timer (ctx);
+      return;
+    }
+  status_changed (ctx);
+}
+
+static int
+executor_handler (sd_event_source _unused_(*s), const siginfo_t *si,
+		  void *userdata)
+{
+  RM_CTX *ctx = userdata;
+
+  if (si->si_code == CLD_EXITED)
+    reboot_attempt_done (ctx, si->si_status == 0 ? "success" : "exit-code",
+			 si->si_status);
+  else
+    reboot_attempt_done (ctx, ctx->executor_timed_out ? "timeout" : "signal",
+			 si->si_status);
+
+  return 0;
+}
+
+static int
+executor_timeout_handler (sd_event_source _unused_(*s),
+			  uint64_t _unused_(usec), void *userdata)
+{
+  RM_CTX *ctx = userdata;
+  int r;
+
+  log_msg (LOG_ERR, "systemctl did not finish in time, killing it");
+
+  /* the executor handler records the timeout */
+  ctx->executor_timed_out = true;
+  r = sd_event_source_send_child_signal (ctx->executor, SIGKILL, NULL, 0);
+  if (r < 0)
+    reboot_attempt_done (ctx, "timeout", SIGKILL);
+
+  return 0;
+}
+
+/* Starts systemctl, whose exit is handled by executor_handler() */
+static int
+spawn_systemctl (RM_CTX *ctx)
+{
+  pid_t pid;
+  int pidfd, r;
+
+  pid = fork ();
+  if (pid < 0)
+    return -errno;
+  if (pid == 0)
+    exec_systemctl (ctx->reboot_method);
+
+  pidfd = pidfd_open (pid, 0);
+  if (pidfd < 0)
+    {
+      r = -errno;
+      kill (pid, SIGKILL);
+      waitpid (pid, NULL, 0);
+      return r;
+    }
+
+  r = sd_event_add_child_pidfd (ctx->loop, &ctx->executor, pidfd, WEXITED,
+				executor_handler, ctx);
+  if (r < 0)
+    {
+      close (pidfd);
+      kill (pid, SIGKILL);
+      waitpid (pid, NULL, 0);
+      return r;
+    }
+  /* freeing the source kills and reaps a still running child */
+  sd_event_source_set_child_pidfd_own (ctx->executor, true);
+  sd_event_source_set_child_process_own (ctx->executor, true);
+
+  return sd_event_add_time_relative (ctx->loop, &ctx->executor_timeout,
+				     CLOCK_MONOTONIC, REBOOT_EXECUTOR_TIMEOUT,
+				     0, executor_timeout_handler, ctx);
+}
+
+/* Asks logind for the reboot, or calls systemctl if that fails */
+static void
+execute_reboot (RM_CTX *ctx)
+{
+  int r;
+
+  ctx->reboot_attempts++;
+
+  if (debug_flag)
+    {
+      switch (ctx->reboot_method)
+	{
+	case RM_REBOOTMETHOD_HARD:
+	  log_msg (LOG_DEBUG, "reboot called!");
+	  break;
+	case RM_REBOOTMETHOD_SOFT:
+	  log_msg (LOG_DEBUG, "soft-reboot called!");
+	  break;
+	default:
+	  /* cannot happen */
+	  break;
+	}
+      reboot_attempt_done (ctx, "success", 0);
+      return;
+    }
+
+  if (ctx->bus != NULL && rm_bus_reboot (ctx->bus, ctx->reboot_method) >= 0)
+    {
+      reboot_attempt_done (ctx, "success", 0);
+      return;
+    }
+
+  r = spawn_systemctl (ctx);
+  if (r < 0)
+    {
+      log_msg (LOG_ERR, "Calling /usr/bin/systemctl failed: %s",
+	       strerror (-r));
+      reboot_attempt_done (ctx, "resources", -r);
+    }
 }
 
 static int
@@ -323,69 +894,21 @@ time_handler (sd_event_source _unused_(*s), uint64_t _unused_(usec), void *userd
 	  break;
 	case RM_REBOOTMETHOD_SOFT:
 	  log_msg (LOG_INFO, "rebootmgr: soft-reboot triggered now!");
-	  break;
-	default:
-	  log_msg (LOG_ERR, "rebootmgr: internal error, reboot method is invalid: %i",
-		   ctx->reboot_method);
-	  return -EINVAL;
-	}
-
-      if (debug_flag)
-	{
-	  switch (ctx->reboot_method)
-	    {
-	    case RM_REBOOTMETHOD_HARD:
-	      log_msg (LOG_DEBUG, "systemctl reboot called!");
-	      break;
-	    case RM_REBOOTMETHOD_SOFT:
-	      log_msg (LOG_DEBUG, "systemctl soft-reboot called!");
-	      break;
-	    default:
-	      /* cannot happen */
-	      break;
-	    }
+	  break;
+	default:
+	  log_msg (LOG_ERR, "rebootmgr: internal error, reboot method is invalid: %i",
+		   ctx->reboot_method);
+	  return -EINVAL;
 	}
-      else
-        {
-          pid_t pid = fork();
-
-          if (pid < 0)
-            {
-              log_msg (LOG_ERR, "Calling /usr/bin/systemctl failed: %m");
-            }
-          else if (pid == 0)
-            {
-	      int r;
-
-	      switch (ctx->reboot_method)
-		{
-		case RM_REBOOTMETHOD_HARD:
-                  char envar1[] = "SYSTEMCTL_SKIP_AUTO_SOFT_REBOOT=1";
-                  char *env[] = {envar1, NULL};
-
-                  r = execle ("/usr/bin/systemctl", "systemctl", "reboot",
-			      NULL, env);
-
-		  break;
-		case RM_REBOOTMETHOD_SOFT:
-                  r = execl ("/usr/bin/systemctl", "systemctl", "soft-reboot",
-                             NULL);
-		  break;
-		default:
-		  /* cannot happen */
-		  break;
-		}
-	      if (r < 0)
-		{
-		  log_msg (LOG_ERR, "Calling /usr/bin/systemctl %s failed: %m",
-			   (ctx->reboot_method == RM_REBOOTMETHOD_HARD)?"reboot":"soft-reboot");
-		  exit (1);
-                }
-              exit (0);
-            }
-        }
 
-      reset_timer(ctx);
+      /* the timer is done, the reboot is requested until
+	 reboot_attempt_done() resets it. It is not pending anymore and
+	 removed from RM_STATE_FILE before it starts, as rebootmgrd may
+	 be stopped before the attempt returns. */
+      ctx->timer = sd_event_source_unref (ctx->timer);
+      ctx->reboot_attempts = 0;
+      status_changed (ctx);
+      execute_reboot (ctx);
     }
 
   return 0;
@@ -470,8 +993,11 @@ vl_method_reboot(sd_varlink *link, sd_json_variant *parameters,
 	}
     }
 
+  /* a forced reboot is not delayed */
   r = sd_event_add_time(ctx->loop, &ctx->timer, CLOCK_REALTIME,
-			reboot_time, 0, time_handler, ctx);
+			reboot_time,
+			p.force ? 0 : reboot_timer_accuracy (ctx, reboot_time),
+			time_handler, ctx);
   if (r < 0)
     {
       ctx->reboot_method = RM_REBOOTMETHOD_UNKNOWN;
@@ -481,6 +1007,9 @@ vl_method_reboot(sd_varlink *link, sd_json_variant *parameters,
     }
   ctx->reboot_status = RM_REBOOTSTATUS_WAITING_WINDOW;
   ctx->reboot_time = reboot_time;
+  ctx->reboot_forced = p.force;
+  ctx->reboot_requester = peer_uid;
+  status_changed (ctx);
 
   return sd_varlink_replybo(link,
 			    SD_JSON_BUILD_PAIR_INTEGER("Method", ctx->reboot_method),
@@ -544,6 +1073,7 @@ vl_method_set_strategy (sd_varlink *link, sd_json_variant *parameters,
 	}
 
       ctx->reboot_strategy = p.strategy;
+      status_changed (ctx);
 
       /* Informal log message */
       const char *str;
@@ -613,49 +1143,63 @@ vl_method_set_window (sd_varlink *link, sd_json_variant *parameters,
       return sd_varlink_error(link, SD_VARLINK_ERROR_PERMISSION_DENIED, parameters);
     }
 
-  CalendarSpec *new_start = NULL;
-  if (p.start == NULL || strlen (p.start) == 0 ||
-      calendar_spec_from_string (p.start, &new_start) < 0)
+  _cleanup_(freep) usec_t *durations = NULL;
+  size_t n_durations = 0;
+  if (p.duration == NULL ||
+      rm_durations_from_string(p.duration, &durations, &n_durations) < 0)
     {
-      log_msg(LOG_ERR, "Reboot strategy not changed, invalid value for window start (%s)", p.start);
+      log_msg(LOG_ERR, "Reboot strategy not changed, invalid value for duration (%s)", p.duration);
       return sd_varlink_errorbo(link, "org.openSUSE.rebootmgr.InvalidParameter",
-				SD_JSON_BUILD_PAIR_STRING("Variable", "start time"),
+				SD_JSON_BUILD_PAIR_STRING("Variable", "duration"),
 				SD_JSON_BUILD_PAIR_BOOLEAN("Success", false));
     }
 
-  time_t new_duration;
-  if (p.duration == NULL || strlen(p.duration) == 0 ||
-      (new_duration = parse_duration(p.duration)) == BAD_TIME)
+  RM_MaintWindow *new_windows = NULL;
+  size_t n_new_windows = 0;
+  r = -EINVAL;
+  if (p.start != NULL)
+    r = rm_windows_from_string(p.start, durations, n_durations,
+			       &new_windows, &n_new_windows);
+  if (r == -ERANGE)
     {
-      calendar_spec_free(new_start);
-
-      log_msg(LOG_ERR, "Reboot strategy not changed, invalid value for duration (%s)", p.duration);
+      log_msg(LOG_ERR, "Reboot strategy not changed, number of durations (%s) does not match the windows (%s)",
+	      p.duration, p.start);
       return sd_varlink_errorbo(link, "org.openSUSE.rebootmgr.InvalidParameter",
 				SD_JSON_BUILD_PAIR_STRING("Variable", "duration"),
 				SD_JSON_BUILD_PAIR_BOOLEAN("Success", false));
     }
+  if (r < 0)
+    {
+      log_msg(LOG_ERR, "Reboot strategy not changed, invalid value for window start (%s)", p.start);
+      return sd_varlink_errorbo(link, "org.openSUSE.rebootmgr.InvalidParameter",
+				SD_JSON_BUILD_PAIR_STRING("Variable", "start time"),
+				SD_JSON_BUILD_PAIR_BOOLEAN("Success", false));
+    }
 
-  r = save_config(RM_REBOOTSTRATEGY_UNKNOWN, new_start, new_duration);
+  r = save_config(RM_REBOOTSTRATEGY_UNKNOWN, new_windows, n_new_windows);
   if (r < 0)
     {
-      calendar_spec_free(new_start);
+      rm_windows_free(new_windows, n_new_windows);
       log_msg(LOG_ERR, "Maintenance window not changed, saving failed");
       return sd_varlink_errorbo(link, "org.openSUSE.rebootmgr.ErrorWritingConfig",
 				SD_JSON_BUILD_PAIR_BOOLEAN("Success", false));
     }
 
-  calendar_spec_free(ctx->maint_window_start);
-  ctx->maint_window_start = new_start;
-  ctx->maint_window_duration = new_duration;
+  rm_windows_free(ctx->maint_windows, ctx->n_maint_windows);
+  ctx->maint_windows = new_windows;
+  ctx->n_maint_windows = n_new_windows;
+  status_changed (ctx);
 
   /* Informal log message */
-  _cleanup_(freep) char *start_str = NULL;
-  _cleanup_(freep) const char *duration_str = NULL;
-  calendar_spec_to_string (ctx->maint_window_start, &start_str);
-  r = rm_duration_to_string (ctx->maint_window_duration, &duration_str);
-  if (r >= 0)
-    log_msg (LOG_INFO, "Maintenance window changed to '%s', lasting %s",
-	     start_str, duration_str);
+  for (size_t i = 0; i < ctx->n_maint_windows; i++)
+    {
+      char duration_str[RM_DURATION_STRING_MAX];
+
+      if (rm_duration_format (ctx->maint_windows[i].duration, duration_str,
+			      sizeof (duration_str)) >= 0)
+	log_msg (LOG_INFO, "Maintenance window changed to '%s', lasting %s",
+		 calendar_spec_string (ctx->maint_windows[i].start), duration_str);
+    }
 
   return sd_varlink_replybo (link, SD_JSON_BUILD_PAIR_BOOLEAN("Success", true));
 }
@@ -761,10 +1305,421 @@ vl_method_quit (sd_varlink *link, sd_json_variant *parameters,
   ctx->timer = sd_event_source_unref (ctx->timer);
   ctx->reboot_status = RM_REBOOTSTATUS_NOT_REQUESTED;
   ctx->reboot_method = RM_REBOOTMETHOD_UNKNOWN;
+  status_changed (ctx);
 
   return sd_varlink_replybo (link, SD_JSON_BUILD_PAIR_BOOLEAN("Success", true));
 }
 
+/* Delay between a change in a unit directory and reading the timers
+   to avoid again, so that e.g. a package update is handled once. */
+#define TIMERS_REFRESH_DELAY USEC_PER_SEC
+
+static int watch_unit_dirs (RM_CTX *ctx);
+
+/* Moves a scheduled reboot, which is now inside of a blackout of the
+   timers to avoid, to the next allowed time. */
+static void
+reschedule_reboot (RM_CTX *ctx)
+{
+  char buf[FORMAT_TIMESTAMP_MAX];
+  usec_t allowed, reboot_time;
+  int r;
+
+  if (ctx->reboot_status != RM_REBOOTSTATUS_WAITING_WINDOW ||
+      ctx->timer == NULL)
+    return;
+
+  r = rm_blackout_index_lookup (&ctx->blackout_index, ctx->blackouts,
+				ctx->n_blackouts, ctx->reboot_time,
+				&allowed, NULL);
+  if (r < 0 || allowed == ctx->reboot_time)
+    return;
+
+  r = calc_reboot_time (ctx, &reboot_time);
+  if (r >= 0)
+    r = sd_event_source_set_time (ctx->timer, reboot_time);
+  if (r >= 0)
+    r = sd_event_source_set_time_accuracy (ctx->timer,
+					   reboot_timer_accuracy (ctx, reboot_time));
+  if (r < 0)
+    {
+      log_msg (LOG_ERR, "Cannot move the reboot out of the blackouts of the timers: %s",
+	       strerror (-r));
+      return;
+    }
+
+  ctx->reboot_time = reboot_time;
+  status_changed (ctx);
+  log_msg (LOG_INFO, "Reboot moved to %s to avoid a timer",
+	   format_timestamp (buf, sizeof (buf), reboot_time));
+}
+
+static int
+refresh_timers (RM_CTX *ctx)
+{
+  int r;
+
+  r = rm_timer_blackouts_update (NULL, ctx->avoid_timers,
+				 ctx->n_avoid_timers, &ctx->blackouts,
+				 &ctx->n_blackouts, &ctx->n_timer_blackouts);
+  if (r < 0)
+    {
+      log_msg (LOG_ERR, "Cannot read the timers to avoid: %s",
+	       strerror (-r));
+      return r;
+    }
+  rm_blackout_index_free (&ctx->blackout_index);
+  status_changed (ctx);
+
+  if (debug_flag)
+    log_msg (LOG_DEBUG, "%zu blackouts from the timers to avoid",
+	     ctx->n_timer_blackouts);
+
+  reschedule_reboot (ctx);
+
+  return 0;
+}
+
+static int
+timers_refresh_handler (sd_event_source _unused_(*s), uint64_t _unused_(usec),
+			void *userdata)
+{
+  RM_CTX *ctx = userdata;
+
+  ctx->timers_refresh = sd_event_source_unref (ctx->timers_refresh);
+
+  refresh_timers (ctx);
+  /* a new drop-in directory needs a watch, too */
+  watch_unit_dirs (ctx);
+
+  return 0;
+}
+
+static int
+unit_dir_handler (sd_event_source *s, const struct inotify_event *event,
+		  void *userdata)
+{
+  RM_CTX *ctx = userdata;
+  const char *path = NULL;
+  size_t l;
+  int r;
+
+  /* Every change of a drop-in directory is relevant, in the unit
+     directories only those of the timers to avoid. */
+  sd_event_source_get_description (s, &path);
+  l = path ? strlen (path) : 0;
+  if (!(event->mask & (IN_Q_OVERFLOW|IN_IGNORED)) && event->len > 0 &&
+      (l < 2 || strcmp (path + l - 2, ".d") != 0) &&
+      !rm_avoid_timers_match (ctx->avoid_timers, ctx->n_avoid_timers,
+			      event->name))
+    return 0;
+
+  if (ctx->timers_refresh)
+    return 0;
+
+  r = sd_event_add_time_relative (ctx->loop, &ctx->timers_refresh,
+				  CLOCK_MONOTONIC, TIMERS_REFRESH_DELAY, 0,
+				  timers_refresh_handler, ctx);
+  if (r < 0)
+    log_msg (LOG_ERR, "Cannot schedule reading the timers to avoid: %s",
+	     strerror (-r));
+
+  return 0;
+}
+
+static void
+unwatch_unit_dirs (RM_CTX *ctx)
+{
+  for (size_t i = 0; i < ctx->n_unit_watches; i++)
+    sd_event_source_unref (ctx->unit_watches[i]);
+  ctx->unit_watches = mfree (ctx->unit_watches);
+  ctx->n_unit_watches = 0;
+}
+
+static int
+add_unit_watch (RM_CTX *ctx, const char *path)
+{
+  sd_event_source *s, **watches;
+  int r;
+
+  r = sd_event_add_inotify (ctx->loop, &s, path,
+			    IN_CREATE|IN_DELETE|IN_CLOSE_WRITE|IN_ATTRIB|
+			    IN_MOVED_FROM|IN_MOVED_TO|IN_ONLYDIR,
+			    unit_dir_handler, ctx);
+  if (r == -ENOENT || r == -ENOTDIR)
+    return 0;
+  if (r < 0)
+    return r;
+
+  sd_event_source_set_description (s, path);
+
+  watches = reallocarray (ctx->unit_watches, ctx->n_unit_watches + 1,
+			  sizeof (sd_event_source *));
+  if (watches == NULL)
+    {
+      sd_event_source_unref (s);
+      return -ENOMEM;
+    }
+  ctx->unit_watches = watches;
+  ctx->unit_watches[ctx->n_unit_watches++] = s;
+
+  return 0;
+}
+
+/* Watches the unit directories and the existing drop-in directories
+   of the timers to avoid. */
+static int
+watch_unit_dirs (RM_CTX *ctx)
+{
+  int r = 0;
+
+  unwatch_unit_dirs (ctx);
+  if (ctx->n_avoid_timers == 0)
+    return 0;
+
+  for (size_t i = 0; r >= 0 && rm_unit_dirs[i]; i++)
+    {
+      r = add_unit_watch (ctx, rm_unit_dirs[i]);
+
+      for (size_t j = 0; r >= 0 && j < ctx->n_avoid_timers; j++)
+	{
+	  _cleanup_(freep) char *template = NULL;
+	  _cleanup_(freep) char *dropin = NULL;
+
+	  if (asprintf (&dropin, "%s/%s.d", rm_unit_dirs[i],
+			ctx->avoid_timers[j].name) < 0)
+	    r = -ENOMEM;
+	  else
+	    r = add_unit_watch (ctx, dropin);
+	  if (r < 0)
+	    break;
+
+	  r = rm_unit_template (ctx->avoid_timers[j].name, &template);
+	  if (r > 0)
+	    {
+	      dropin = mfree (dropin);
+	      if (asprintf (&dropin, "%s/%s.d", rm_unit_dirs[i], template) < 0)
+		r = -ENOMEM;
+	      else
+		r = add_unit_watch (ctx, dropin);
+	    }
+	}
+    }
+
+  if (r < 0)
+    log_msg (LOG_ERR, "Cannot watch the unit directories: %s",
+	     strerror (-r));
+
+  return r;
+}
+
+/* Calculates the time of a scheduled reboot again, after the clock
+   jumped or the local time zone changed. A reboot time calculated
+   with a wrong clock, e.g. before NTP corrected a bad RTC, would be
+   hours off. */
+static void
+recalc_reboot_time (RM_CTX *ctx, const char *reason)
+{
+  char buf[FORMAT_TIMESTAMP_MAX];
+  usec_t reboot_time;
+  int r;
+
+  calendar_spec_cache_invalidate_all ();
+  rm_blackout_index_free (&ctx->blackout_index);
+  status_changed (ctx);
+
+  if (ctx->reboot_status != RM_REBOOTSTATUS_WAITING_WINDOW ||
+      ctx->timer == NULL || ctx->reboot_forced)
+    return;
+
+  r = calc_reboot_time (ctx, &reboot_time);
+  if (r >= 0)
+    r = sd_event_source_set_time (ctx->timer, reboot_time);
+  if (r >= 0)
+    r = sd_event_source_set_time_accuracy (ctx->timer,
+					   reboot_timer_accuracy (ctx, reboot_time));
+  if (r < 0)
+    {
+      log_msg (LOG_ERR, "Cannot calculate the reboot time after the %s: %s",
+	       reason, strerror (-r));
+      return;
+    }
+
+  ctx->reboot_time = reboot_time;
+  status_changed (ctx);
+  log_msg (LOG_INFO, "Reboot rescheduled to %s after the %s",
+	   format_timestamp (buf, sizeof (buf), reboot_time), reason);
+}
+
+/* Arms the timerfd to be cancelled by the next discontinuous change
+   of CLOCK_REALTIME, like setting the time or an NTP step. */
+static int
+arm_clock_watch (int fd)
+{
+  const struct itimerspec its = {
+    .it_value.tv_sec = (time_t)((UINTMAX_C(1) << (sizeof (time_t) * 8 - 1)) - 1),
+  };
+
+  if (timerfd_settime (fd, TFD_TIMER_ABSTIME|TFD_TIMER_CANCEL_ON_SET,
+		       &its, NULL) < 0)
+    return -errno;
+
+  return 0;
+}
+
+static int
+clock_handler (sd_event_source _unused_(*s), int fd,
+	       uint32_t _unused_(revents), void *userdata)
+{
+  RM_CTX *ctx = userdata;
+  uint64_t expirations;
+  int r;
+
+  /* fails with ECANCELED after a change of the clock */
+  if (read (fd, &expirations, sizeof (expirations)) >= 0 || errno != ECANCELED)
+    return 0;
+
+  r = arm_clock_watch (fd);
+  if (r < 0)
+    log_msg (LOG_ERR, "Cannot watch for changes of the clock: %s",
+	     strerror (-r));
+
+  log_msg (LOG_INFO, "System clock changed");
+  recalc_reboot_time (ctx, "change of the clock");
+
+  return 0;
+}
+
+static int
+localtime_handler (sd_event_source _unused_(*s),
+		   const struct inotify_event *event, void *userdata)
+{
+  RM_CTX *ctx = userdata;
+
+  if (!(event->mask & IN_Q_OVERFLOW) &&
+      (event->len == 0 || strcmp (event->name, "localtime") != 0))
+    return 0;
+
+  /* localtime_r() does not look at /etc/localtime again by itself */
+  tzset ();
+
+  log_msg (LOG_INFO, "Local time zone changed");
+  recalc_reboot_time (ctx, "change of the time zone");
+
+  return 0;
+}
+
+static int
+watch_time_changes (RM_CTX *ctx)
+{
+  int fd, r;
+
+  fd = timerfd_create (CLOCK_REALTIME, TFD_NONBLOCK|TFD_CLOEXEC);
+  if (fd < 0)
+    return -errno;
+
+  r = arm_clock_watch (fd);
+  if (r >= 0)
+    r = sd_event_add_io (ctx->loop, &ctx->clock_watch, fd, EPOLLIN,
+			 clock_handler, ctx);
+  if (r < 0)
+    {
+      close (fd);
+      return r;
+    }
+  sd_event_source_set_io_fd_own (ctx->clock_watch, true);
+
+  /* /etc/localtime is usually a symlink, which is replaced */
+  return sd_event_add_inotify (ctx->loop, &ctx->localtime_watch, "/etc",
+			       IN_CLOSE_WRITE|IN_CREATE|IN_DELETE|IN_ATTRIB|
+			       IN_MOVED_FROM|IN_MOVED_TO|IN_ONLYDIR,
+			       localtime_handler, ctx);
+}
+
+/* Connects to the system bus for rebooting, so that this is ready
+   and known to work once the reboot is due. Without logind, systemctl
+   is called. */
+static void
+open_bus (RM_CTX *ctx)
+{
+  int r;
+
+  r = sd_bus_open_system (&ctx->bus);
+  if (r >= 0)
+    r = rm_bus_check_logind (ctx->bus);
+  if (r >= 0)
+    r = sd_bus_attach_event (ctx->bus, ctx->loop, SD_EVENT_PRIORITY_NORMAL);
+  if (r < 0)
+    {
+      log_msg (LOG_WARNING, "Cannot use logind on the system bus, falling back to systemctl: %s",
+	       strerror (-r));
+      ctx->bus = sd_bus_flush_close_unref (ctx->bus);
+    }
+}
+
+/* Continues to wait for the reboot, which the previous instance of
+   rebootmgrd saved in RM_STATE_FILE. If its time passed meanwhile,
+   a forced reboot happens now, else the next window is searched. */
+static void
+restore_state (RM_CTX *ctx)
+{
+  RM_State state;
+  usec_t reboot_time;
+  const char *str;
+  char buf[FORMAT_TIMESTAMP_MAX];
+  int r;
+
+  r = rm_state_load (RM_STATE_FILE, &state);
+  if (r == -ENOENT)
+    return;
+  if (r < 0)
+    {
+      log_msg (LOG_ERR, "Ignoring '"RM_STATE_FILE"': %s", strerror (-r));
+      goto discard;
+    }
+
+  ctx->saved_state = state;
+  ctx->reboot_method = state.method;
+  ctx->reboot_forced = state.forced;
+  ctx->reboot_requester = state.requester;
+
+  reboot_time = state.reboot_time;
+  if (!state.forced && reboot_time < now (CLOCK_REALTIME))
+    {
+      r = calc_reboot_time (ctx, &reboot_time);
+      if (r < 0)
+	goto discard;
+    }
+
+  r = sd_event_add_time (ctx->loop, &ctx->timer, CLOCK_REALTIME,
+			 reboot_time,
+			 state.forced ? 0 : reboot_timer_accuracy (ctx, reboot_time),
+			 time_handler, ctx);
+  if (r < 0)
+    {
+      log_msg (LOG_ERR, "Cannot add reboot timer to event loop: %s", strerror (-r));
+      goto discard;
+    }
+  ctx->reboot_status = RM_REBOOTSTATUS_WAITING_WINDOW;
+  ctx->reboot_time = reboot_time;
+  status_changed (ctx);
+
+  rm_method_to_str (ctx->reboot_method, &str);
+  log_msg (LOG_INFO, "Restored pending %s at %s", str,
+	   format_timestamp (buf, sizeof (buf), reboot_time));
+  return;
+
+ discard:
+  ctx->reboot_method = RM_REBOOTMETHOD_UNKNOWN;
+  ctx->reboot_forced = false;
+  ctx->saved_state = (RM_State) {
+    .status = RM_REBOOTSTATUS_NOT_REQUESTED,
+  };
+  r = rm_state_save (RM_STATE_FILE, &ctx->saved_state);
+  if (r < 0)
+    log_msg (LOG_ERR, "Failed to remove '"RM_STATE_FILE"': %s", strerror (-r));
+}
+
 /* Send a messages to systemd daemon, that inicialization of daemon
    is finished and daemon is ready to accept connections. */
 static void
@@ -792,10 +1747,28 @@ varlink_server_loop(sd_varlink_server *server, RM_CTX *ctx)
 
   /* Runs a sd_varlink service event loop populated with a passed fd. */
 
+  /* systemctl is supervised by a child event source, which needs
+     SIGCHLD blocked */
+  sigset_t mask;
+  sigemptyset(&mask);
+  sigaddset(&mask, SIGCHLD);
+  if (sigprocmask(SIG_BLOCK, &mask, NULL) < 0)
+    return -errno;
+
   r = sd_event_new(&(ctx->loop));
   if (r < 0)
     return r;
 
+  /* changes of the timers to avoid are picked up while running */
+  watch_unit_dirs(ctx);
+
+  open_bus(ctx);
+
+  r = watch_time_changes(ctx);
+  if (r < 0)
+    log_msg(LOG_ERR, "Cannot watch for changes of the clock and time zone: %s",
+	    strerror(-r));
+
   r = sd_varlink_server_set_exit_on_idle(server, false);
   if (r < 0)
     return r;
@@ -804,9 +1777,7 @@ varlink_server_loop(sd_varlink_server *server, RM_CTX *ctx)
   if (r < 0)
     return r;
 
-  r = sd_varlink_server_listen_auto(server);
-  if (r < 0)
-    return r;
+  restore_state(ctx);
 
   announce_ready();
   r = sd_event_loop (ctx->loop);
@@ -815,6 +1786,51 @@ varlink_server_loop(sd_varlink_server *server, RM_CTX *ctx)
   return r;
 }
 
+/* Creates the listening socket and hands it to the fd store of
+   systemd, which passes it to the next instance of rebootmgrd. Clients
+   connecting meanwhile wait in the backlog instead of getting
+   ECONNREFUSED or ENOENT. */
+static int
+listen_socket (sd_varlink_server *server)
+{
+  struct sockaddr_un sa = {
+    .sun_family = AF_UNIX,
+    .sun_path = RM_VARLINK_SOCKET,
+  };
+  int fd, r;
+
+  fd = socket (AF_UNIX, SOCK_STREAM|SOCK_CLOEXEC|SOCK_NONBLOCK, 0);
+  if (fd < 0)
+    return -errno;
+
+  (void) unlink (RM_VARLINK_SOCKET);
+  if (bind (fd, (struct sockaddr *) &sa, sizeof (sa)) < 0 ||
+      chmod (RM_VARLINK_SOCKET, 0666) < 0 ||
+      listen (fd, SOMAXCONN) < 0)
+    {
+      r = -errno;
+      close (fd);
+      return r;
+    }
+
+  r = sd_varlink_server_listen_fd (server, fd);
+  if (r < 0)
+    {
+      close (fd);
+      return r;
+    }
+
+  /* without systemd, or without FileDescriptorStoreMax=, this does
+     nothing */
+  r = sd_pid_notify_with_fds (0, 0, "FDSTORE=1\n"
+			      "FDNAME=varlink", &fd, 1);
+  if (r < 0)
+    log_msg (LOG_WARNING, "Cannot store the Varlink socket in the fd store: %s",
+	     strerror (-r));
+
+  return 0;
+}
+
 static int
 run_varlink (RM_CTX *ctx)
 {
@@ -864,7 +1880,8 @@ run_varlink (RM_CTX *ctx)
 					 "org.openSUSE.rebootmgr.SetLogLevel",    vl_method_set_log_level,
 					 "org.openSUSE.rebootmgr.SetStrategy",    vl_method_set_strategy,
 					 "org.openSUSE.rebootmgr.SetWindow",      vl_method_set_window,
-					 "org.openSUSE.rebootmgr.Status",         vl_method_status);
+					 "org.openSUSE.rebootmgr.Status",         vl_method_status,
+					 "org.openSUSE.rebootmgr.WatchStatus",    vl_method_watch_status);
   if (r < 0)
     {
       log_msg(LOG_ERR, "Failed to bind Varlink methods: %s",
@@ -872,6 +1889,14 @@ run_varlink (RM_CTX *ctx)
       return r;
     }
 
+  r = sd_varlink_server_bind_disconnect(varlink_server, vl_disconnect);
+  if (r < 0)
+    {
+      log_msg(LOG_ERR, "Failed to bind Varlink disconnect handler: %s",
+	      strerror(-r));
+      return r;
+    }
+
   r = mkdir_p(RM_VARLINK_SOCKET_DIR, 0755);
   if (r < 0)
     {
@@ -879,7 +1904,12 @@ run_varlink (RM_CTX *ctx)
 	      strerror(-r));
       return r;
     }
-  r = sd_varlink_server_listen_address(varlink_server, RM_VARLINK_SOCKET, 0666);
+
+  /* the socket of the previous instance from the fd store, or one
+     from socket activation */
+  r = sd_varlink_server_listen_auto(varlink_server);
+  if (r == 0)
+    r = listen_socket(varlink_server);
   if (r < 0)
     {
       log_msg(LOG_ERR, "Failed to bind to Varlink socket: %s", strerror (-r));
@@ -911,16 +1941,27 @@ create_context (RM_CTX **ctx)
    * RM_RebootStatus
    * RM_RebootMethod
    * RM_RebootStrategy
-   * CalendarSpec
-   * Maintenance Window Duration
+   * Maintenance Windows
    * temporary off
    */
-  **ctx = (RM_CTX) {RM_REBOOTSTATUS_NOT_REQUESTED,
-		   RM_REBOOTMETHOD_UNKNOWN,
-		   RM_REBOOTSTRATEGY_BEST_EFFORT,
-		   NULL, 3600, 0,
-		   NULL, NULL, 0};
-  calendar_spec_from_string("03:30", &(*ctx)->maint_window_start);
+  **ctx = (RM_CTX) {
+    .reboot_status = RM_REBOOTSTATUS_NOT_REQUESTED,
+    .reboot_method = RM_REBOOTMETHOD_UNKNOWN,
+    .reboot_strategy = RM_REBOOTSTRATEGY_BEST_EFFORT,
+    .temp_off = 0,
+    .reboot_retries = RM_REBOOT_RETRIES_DEFAULT,
+    .soft_reboot_fallback = true,
+    .timer_accuracy = RM_TIMER_ACCURACY_DEFAULT,
+  };
+  const usec_t duration = USEC_PER_HOUR;
+  int r = rm_windows_from_string("03:30", &duration, 1,
+				 &(*ctx)->maint_windows,
+				 &(*ctx)->n_maint_windows);
+  if (r < 0)
+    {
+      *ctx = mfree(*ctx);
+      return r;
+    }
 
   return 0;
 }
@@ -931,7 +1972,23 @@ destroy_context (RM_CTX *ctx)
   if (ctx == NULL)
     return -EBADF;
 
-  calendar_spec_free (ctx->maint_window_start);
+  rm_windows_free (ctx->maint_windows, ctx->n_maint_windows);
+  rm_blackouts_free (ctx->blackouts, ctx->n_blackouts);
+  rm_blackout_index_free (&ctx->blackout_index);
+  rm_avoid_timers_free (ctx->avoid_timers, ctx->n_avoid_timers);
+  unwatch_unit_dirs (ctx);
+  sd_event_source_unref (ctx->timers_refresh);
+  sd_json_variant_unref (ctx->status_reply);
+  sd_json_variant_unref (ctx->fullstatus_reply);
+  sd_json_variant_unref (ctx->watch_reply);
+  for (size_t i = 0; i < ctx->n_watchers; i++)
+    sd_varlink_unref (ctx->watchers[i]);
+  free (ctx->watchers);
+  executor_free (ctx);
+  sd_event_source_disable_unref (ctx->retry_timer);
+  sd_event_source_disable_unref (ctx->clock_watch);
+  sd_event_source_disable_unref (ctx->localtime_watch);
+  sd_bus_flush_close_unref (ctx->bus);
   sd_event_unrefp(&(ctx->loop));
   free (ctx);
 
@@ -1022,6 +2079,9 @@ main (int argc, char **argv)
       return -r;
     }
 
+  /* not fatal, the reboots just do not avoid the timers */
+  refresh_timers (ctx);
+
   if (verbose_flag)
     log_msg (LOG_INFO, "Starting rebootmgrd (%s) %s...", PACKAGE, VERSION);
 
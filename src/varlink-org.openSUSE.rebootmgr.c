@@ -23,9 +23,16 @@ static SD_VARLINK_DEFINE_METHOD(
 		SD_VARLINK_DEFINE_INPUT(Strategy, SD_VARLINK_INT, 0),
 		SD_VARLINK_DEFINE_OUTPUT(Success, SD_VARLINK_BOOL, 0));
 
+static SD_VARLINK_DEFINE_STRUCT_TYPE(
+		MaintenanceWindow,
+		SD_VARLINK_FIELD_COMMENT("Calendar specification of the start of the window"),
+		SD_VARLINK_DEFINE_FIELD(Start, SD_VARLINK_STRING, 0),
+		SD_VARLINK_FIELD_COMMENT("Duration of the window in seconds"),
+		SD_VARLINK_DEFINE_FIELD(Duration, SD_VARLINK_INT, 0));
+
 static SD_VARLINK_DEFINE_METHOD(
 		SetWindow,
-		SD_VARLINK_FIELD_COMMENT("Set new maintenance window"),
+		SD_VARLINK_FIELD_COMMENT("Set new maintenance windows, start times and durations are separated by ';'"),
 		SD_VARLINK_DEFINE_INPUT(Start, SD_VARLINK_STRING, 0),
 		SD_VARLINK_DEFINE_INPUT(Duration, SD_VARLINK_STRING, 0),
 		SD_VARLINK_DEFINE_OUTPUT(Variable, SD_VARLINK_STRING, SD_VARLINK_NULLABLE),
@@ -36,7 +43,9 @@ static SD_VARLINK_DEFINE_METHOD(
 		SD_VARLINK_FIELD_COMMENT("If a reboot is requested and if yes, which kind of reboot"),
 		SD_VARLINK_DEFINE_OUTPUT(RebootStatus, SD_VARLINK_INT, 0),
 		SD_VARLINK_DEFINE_OUTPUT(RequestedMethod, SD_VARLINK_INT, SD_VARLINK_NULLABLE),
-		SD_VARLINK_DEFINE_OUTPUT(RebootTime, SD_VARLINK_STRING, SD_VARLINK_NULLABLE));
+		SD_VARLINK_DEFINE_OUTPUT(RebootTime, SD_VARLINK_STRING, SD_VARLINK_NULLABLE),
+		SD_VARLINK_FIELD_COMMENT("Time of the reboot in microseconds since the epoch"),
+		SD_VARLINK_DEFINE_OUTPUT(RebootTimeUSec, SD_VARLINK_INT, SD_VARLINK_NULLABLE));
 
 static SD_VARLINK_DEFINE_METHOD(
 		FullStatus,
@@ -45,8 +54,35 @@ static SD_VARLINK_DEFINE_METHOD(
 		SD_VARLINK_DEFINE_OUTPUT(RebootStrategy, SD_VARLINK_INT, 0),
 		SD_VARLINK_DEFINE_OUTPUT(RequestedMethod, SD_VARLINK_INT, SD_VARLINK_NULLABLE),
 		SD_VARLINK_DEFINE_OUTPUT(RebootTime, SD_VARLINK_STRING, SD_VARLINK_NULLABLE),
+		SD_VARLINK_FIELD_COMMENT("Time of the reboot in microseconds since the epoch"),
+		SD_VARLINK_DEFINE_OUTPUT(RebootTimeUSec, SD_VARLINK_INT, SD_VARLINK_NULLABLE),
 		SD_VARLINK_DEFINE_OUTPUT(MaintenanceWindowStart, SD_VARLINK_STRING, SD_VARLINK_NULLABLE),
-		SD_VARLINK_DEFINE_OUTPUT(MaintenanceWindowDuration, SD_VARLINK_INT, SD_VARLINK_NULLABLE));
+		SD_VARLINK_DEFINE_OUTPUT(MaintenanceWindowDuration, SD_VARLINK_INT, SD_VARLINK_NULLABLE),
+		SD_VARLINK_DEFINE_OUTPUT_BY_TYPE(MaintenanceWindows, MaintenanceWindow, SD_VARLINK_ARRAY|SD_VARLINK_NULLABLE),
+		SD_VARLINK_FIELD_COMMENT("Outcome of the last attempt to reboot: success, exit-code, signal, timeout or resources"),
+		SD_VARLINK_DEFINE_OUTPUT(LastRebootResult, SD_VARLINK_STRING, SD_VARLINK_NULLABLE),
+		SD_VARLINK_FIELD_COMMENT("Exit code or signal of systemctl in the last attempt to reboot"),
+		SD_VARLINK_DEFINE_OUTPUT(LastRebootExitStatus, SD_VARLINK_INT, SD_VARLINK_NULLABLE),
+		SD_VARLINK_FIELD_COMMENT("Periods in which no reboot is done"),
+		SD_VARLINK_DEFINE_OUTPUT(Blackouts, SD_VARLINK_STRING, SD_VARLINK_ARRAY|SD_VARLINK_NULLABLE),
+		SD_VARLINK_FIELD_COMMENT("Timer units, which reboots avoid for the given time after each elapse"),
+		SD_VARLINK_DEFINE_OUTPUT(AvoidTimers, SD_VARLINK_STRING, SD_VARLINK_ARRAY|SD_VARLINK_NULLABLE),
+		SD_VARLINK_FIELD_COMMENT("Start of the next maintenance window outside of the blackouts"),
+		SD_VARLINK_DEFINE_OUTPUT(NextAllowedWindow, SD_VARLINK_STRING, SD_VARLINK_NULLABLE),
+		SD_VARLINK_FIELD_COMMENT("Start of the next allowed window in microseconds since the epoch"),
+		SD_VARLINK_DEFINE_OUTPUT(NextAllowedWindowUSec, SD_VARLINK_INT, SD_VARLINK_NULLABLE));
+
+static SD_VARLINK_DEFINE_METHOD_FULL(
+		WatchStatus,
+		SD_VARLINK_REQUIRES_MORE,
+		SD_VARLINK_FIELD_COMMENT("Sends the current status and again after each change of it"),
+		SD_VARLINK_DEFINE_OUTPUT(RebootStatus, SD_VARLINK_INT, 0),
+		SD_VARLINK_DEFINE_OUTPUT(RequestedMethod, SD_VARLINK_INT, SD_VARLINK_NULLABLE),
+		SD_VARLINK_DEFINE_OUTPUT(RebootTime, SD_VARLINK_STRING, SD_VARLINK_NULLABLE),
+		SD_VARLINK_FIELD_COMMENT("Time of the reboot in microseconds since the epoch"),
+		SD_VARLINK_DEFINE_OUTPUT(RebootTimeUSec, SD_VARLINK_INT, SD_VARLINK_NULLABLE),
+		SD_VARLINK_DEFINE_OUTPUT(RebootStrategy, SD_VARLINK_INT, 0),
+		SD_VARLINK_DEFINE_OUTPUT_BY_TYPE(MaintenanceWindows, MaintenanceWindow, SD_VARLINK_ARRAY|SD_VARLINK_NULLABLE));
 
 static SD_VARLINK_DEFINE_METHOD(
 		Quit,
@@ -79,6 +115,8 @@ SD_VARLINK_DEFINE_INTERFACE(
                 org_openSUSE_rebootmgr,
                 "org.openSUSE.rebootmgr",
 		SD_VARLINK_INTERFACE_COMMENT("Rebootmgr control APIs"),
+		SD_VARLINK_SYMBOL_COMMENT("A maintenance window"),
+		&vl_type_MaintenanceWindow,
 		SD_VARLINK_SYMBOL_COMMENT("Request a reboot"),
                 &vl_method_Reboot,
 		SD_VARLINK_SYMBOL_COMMENT("Cancel a reboot"),
@@ -91,6 +129,8 @@ SD_VARLINK_DEFINE_INTERFACE(
                 &vl_method_Status,
 		SD_VARLINK_SYMBOL_COMMENT("Current status and configuration"),
                 &vl_method_FullStatus,
+		SD_VARLINK_SYMBOL_COMMENT("Current status and each change of it"),
+                &vl_method_WatchStatus,
 		SD_VARLINK_SYMBOL_COMMENT("Stop the daemon"),
                 &vl_method_Quit,
 		&vl_method_Ping,
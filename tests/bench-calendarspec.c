@@ -0,0 +1,102 @@
+/*-*- Mode: C; c-basic-offset: 8; indent-tabs-mode: nil -*-*/
+
+/* Throughput of finding the next elapse time of many specs against the
+ * same point in time, one by one and with calendar_spec_next_usec_many().
+ *
+ * Usage: bench-calendarspec [number of specs] [rounds] */
+
+#include <assert.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "calendarspec.h"
+#include "time-util.h"
+
+#define assert_se assert
+
+static const char *const weekdays[] = { "Mon", "Tue", "Wed", "Thu", "Fri", "Sat", "Sun", "Sat,Sun", "Mon-Fri" };
+
+static double elapsed(const struct timespec *a, const struct timespec *b) {
+        return (double) (b->tv_sec - a->tv_sec) + (double) (b->tv_nsec - a->tv_nsec) / 1e9;
+}
+
+/* Mostly weekly maintenance windows, as found on real hosts, and a few
+ * others which take the general search */
+static void make_spec(unsigned k, CalendarSpec **ret) {
+        char buf[64];
+
+        if (k % 50 == 49)
+                snprintf(buf, sizeof(buf), "*-*-%02u %02u:%02u", k % 28 + 1, k % 24, k % 60);
+        else if (k % 10 == 9)
+                snprintf(buf, sizeof(buf), "%s %02u:%02u Europe/Berlin",
+                         weekdays[k % ELEMENTSOF(weekdays)], k % 24, k / 24 % 4 * 15);
+        else
+                snprintf(buf, sizeof(buf), "%s %02u:%02u",
+                         weekdays[k % ELEMENTSOF(weekdays)], k % 24, k / 24 % 4 * 15);
+
+        assert_se(calendar_spec_from_string(buf, ret) >= 0);
+}
+
+int main(int argc, char *argv[]) {
+        unsigned n = 50000, rounds = 10, k, j;
+        CalendarSpec **specs;
+        CalendarSpecBatch *b;
+        usec_t *next, *expect, start;
+        struct timespec t0, t1;
+        double one, many;
+
+        if (argc > 1)
+                n = (unsigned) strtoul(argv[1], NULL, 10);
+        if (argc > 2)
+                rounds = (unsigned) strtoul(argv[2], NULL, 10);
+        if (n == 0 || rounds == 0)
+                return EXIT_FAILURE;
+
+        /* Evaluate in a zone with DST, regardless of the host */
+        assert_se(setenv("TZ", "Europe/Berlin", 1) >= 0);
+        tzset();
+
+        specs = calloc(n, sizeof(CalendarSpec*));
+        next = calloc(n, sizeof(usec_t));
+        expect = calloc(n, sizeof(usec_t));
+        assert_se(specs && next && expect);
+
+        for (k = 0; k < n; k++)
+                make_spec(k, &specs[k]);
+        assert_se(calendar_spec_batch_new(specs, n, &b) >= 0);
+
+        start = now(CLOCK_REALTIME);
+
+        clock_gettime(CLOCK_MONOTONIC, &t0);
+        for (j = 0; j < rounds; j++)
+                for (k = 0; k < n; k++)
+                        if (calendar_spec_next_usec(specs[k], start + j * USEC_PER_MINUTE, &expect[k]) < 0)
+                                expect[k] = USEC_INFINITY;
+        clock_gettime(CLOCK_MONOTONIC, &t1);
+        one = elapsed(&t0, &t1);
+
+        clock_gettime(CLOCK_MONOTONIC, &t0);
+        for (j = 0; j < rounds; j++)
+                assert_se(calendar_spec_next_usec_many(b, NULL, start + j * USEC_PER_MINUTE, next, NULL) >= 0);
+        clock_gettime(CLOCK_MONOTONIC, &t1);
+        many = elapsed(&t0, &t1);
+
+        /* Both have to agree on the last round */
+        assert_se(memcmp(next, expect, n * sizeof(usec_t)) == 0);
+
+        printf("%u specs (%zu weekly), %u rounds\n", n, b->n_weekly, rounds);
+        printf("calendar_spec_next_usec():      %12.0f specs/s\n", n * rounds / one);
+        printf("calendar_spec_next_usec_many(): %12.0f specs/s (%.1fx)\n", n * rounds / many, one / many);
+
+        calendar_spec_batch_free(b);
+        for (k = 0; k < n; k++)
+                calendar_spec_free(specs[k]);
+        free(specs);
+        free(next);
+        free(expect);
+
+        return EXIT_SUCCESS;
+}
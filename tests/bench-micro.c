@@ -0,0 +1,230 @@
+/*-*- Mode: C; c-basic-offset: 8; indent-tabs-mode: nil -*-*/
+
+/* Microbenchmarks of the calendar and duration parsers and formatters
+ * over a fixed corpus of realistic and pathological inputs. Every line
+ * reports the number of iterations, ns/op and allocations/op.
+ *
+ * Usage: bench-micro [minimum seconds per benchmark] */
+
+#include <assert.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "calendarspec.h"
+#include "parse-duration.h"
+#include "time-util.h"
+
+#define assert_se assert
+#define _unused_ __attribute__ ((unused))
+
+/* Count the allocations by replacing malloc() with wrappers around the
+ * glibc allocator. Elsewhere the allocations are not reported. */
+#ifdef __GLIBC__
+#define COUNT_ALLOCATIONS 1
+
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t nmemb, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+extern void __libc_free(void *ptr);
+
+static unsigned long long n_allocations = 0;
+
+void *malloc(size_t size) {
+        n_allocations++;
+        return __libc_malloc(size);
+}
+
+void *calloc(size_t nmemb, size_t size) {
+        n_allocations++;
+        return __libc_calloc(nmemb, size);
+}
+
+void *realloc(void *ptr, size_t size) {
+        n_allocations++;
+        return __libc_realloc(ptr, size);
+}
+
+void free(void *ptr) {
+        __libc_free(ptr);
+}
+#else
+#define COUNT_ALLOCATIONS 0
+
+static unsigned long long n_allocations = 0;
+#endif
+
+/* Maintenance windows as found on real hosts */
+static const char *const realistic[] = {
+        "03:30",
+        "daily",
+        "Mon-Fri 02:00",
+        "Tue,Thu 02:00",
+        "Sat 22:00 Europe/Berlin",
+        "Sun *-*-1,2,3,4,5,6,7 04:00",
+        "*:0/15",
+};
+
+/* Specs which elapse rarely, are long or need many iterations */
+static const char *const pathological[] = {
+        "Mon *-02-29 UTC",
+        "Fri *-*-13 03:00",
+        "*-*-31 23:59:59 America/New_York",
+        "*-*-* 02:30 Europe/Berlin",
+        "Mon,Wed,Fri,Sun 2100/99-1/1,2/9,3/3-1,2,3,4,5/5 1/2,3/4:5/6,7:8/9,10,11,12",
+        "*:*:0/7",
+};
+
+static const char *const durations[] = {
+        "1h30m",
+        "01:30:00",
+        "013000",
+        "2w",
+        "1h 30min 15s 250ms",
+};
+
+/* Wed 2025-01-01 00:00:00 UTC */
+#define BASE (1735689600 * USEC_PER_SEC)
+
+typedef int (*bench_func_t)(const void *arg, unsigned long long i);
+
+static volatile usec_t sink;
+static double min_seconds = 0.1;
+
+static double elapsed(const struct timespec *a, const struct timespec *b) {
+        return (double) (b->tv_sec - a->tv_sec) + (double) (b->tv_nsec - a->tv_nsec) / 1e9;
+}
+
+/* Doubles the iterations until one run takes at least min_seconds */
+static void bench(const char *name, const char *input, bench_func_t f, const void *arg) {
+        unsigned long long n = 1, allocations;
+        struct timespec t0, t1;
+        double secs;
+
+        for (;;) {
+                allocations = n_allocations;
+                clock_gettime(CLOCK_MONOTONIC, &t0);
+                for (unsigned long long i = 0; i < n; i++)
+                        assert_se(f(arg, i) >= 0);
+                clock_gettime(CLOCK_MONOTONIC, &t1);
+                allocations = n_allocations - allocations;
+
+                secs = elapsed(&t0, &t1);
+                if (secs >= min_seconds || n >= (1ULL << 40))
+                        break;
+                n *= 2;
+        }
+
+        if (COUNT_ALLOCATIONS)
+                printf("%-26s %-40.40s %12llu %12.1f ns/op %8.2f allocs/op\n",
+                       name, input, n, secs * 1e9 / n, (double) allocations / n);
+        else
+                printf("%-26s %-40.40s %12llu %12.1f ns/op\n",
+                       name, input, n, secs * 1e9 / n);
+}
+
+static int bench_from_string(const void *arg, _unused_ unsigned long long i) {
+        CalendarSpec *spec;
+        int r;
+
+        r = calendar_spec_from_string(arg, &spec);
+        if (r < 0)
+                return r;
+        calendar_spec_free(spec);
+        return 0;
+}
+
+/* Walks through the next week in steps of 7 minutes, so that the
+ * lookups do not all start at the same point in time */
+static int bench_next_usec(const void *arg, unsigned long long i) {
+        usec_t next;
+        int r;
+
+        r = calendar_spec_next_usec(arg, BASE + (i % 1440) * 7 * USEC_PER_MINUTE, &next);
+        if (r == -ENOENT)
+                return 0;
+        if (r < 0)
+                return r;
+        sink = next;
+        return 0;
+}
+
+static int bench_to_string(const void *arg, _unused_ unsigned long long i) {
+        char *str;
+        int r;
+
+        r = calendar_spec_to_string(arg, &str);
+        if (r < 0)
+                return r;
+        free(str);
+        return 0;
+}
+
+static int bench_parse_duration(const void *arg, _unused_ unsigned long long i) {
+        time_t t;
+
+        t = parse_duration(arg);
+        if (t == BAD_TIME)
+                return -EINVAL;
+        sink = t;
+        return 0;
+}
+
+static int bench_parse_duration_usec(const void *arg, _unused_ unsigned long long i) {
+        usec_t usec;
+        int r;
+
+        r = parse_duration_usec(arg, &usec);
+        if (r < 0)
+                return r;
+        sink = usec;
+        return 0;
+}
+
+static int bench_format_timestamp(_unused_ const void *arg, unsigned long long i) {
+        char buf[FORMAT_TIMESTAMP_MAX];
+
+        if (!format_timestamp(buf, sizeof(buf), BASE + i * USEC_PER_HOUR))
+                return -EINVAL;
+        sink = buf[0];
+        return 0;
+}
+
+static void bench_specs(const char *const *specs, size_t n) {
+        for (size_t k = 0; k < n; k++) {
+                CalendarSpec *spec;
+
+                assert_se(calendar_spec_from_string(specs[k], &spec) >= 0);
+
+                bench("calendar_spec_from_string", specs[k], bench_from_string, specs[k]);
+                bench("calendar_spec_next_usec", specs[k], bench_next_usec, spec);
+                bench("calendar_spec_to_string", specs[k], bench_to_string, spec);
+
+                calendar_spec_free(spec);
+        }
+}
+
+int main(int argc, char *argv[]) {
+        if (argc > 1)
+                min_seconds = strtod(argv[1], NULL);
+        if (min_seconds <= 0)
+                return EXIT_FAILURE;
+
+        /* Evaluate in a zone with DST, regardless of the host */
+        assert_se(setenv("TZ", "Europe/Berlin", 1) >= 0);
+        tzset();
+
+        bench_specs(realistic, ELEMENTSOF(realistic));
+        bench_specs(pathological, ELEMENTSOF(pathological));
+
+        for (size_t k = 0; k < ELEMENTSOF(durations); k++) {
+                bench("parse_duration", durations[k], bench_parse_duration, durations[k]);
+                bench("parse_duration_usec", durations[k], bench_parse_duration_usec, durations[k]);
+        }
+
+        bench("format_timestamp", "", bench_format_timestamp, NULL);
+
+        return EXIT_SUCCESS;
+}
@@ -0,0 +1,113 @@
+/*-*- Mode: C; c-basic-offset: 8; indent-tabs-mode: nil -*-*/
+
+/* Fuzz target for calendar_spec_from_string(). A spec which parses has
+ * to print to a string which parses to the same spec again, has to
+ * elapse at the same times as the reparsed spec, and must find its next
+ * elapse time within FUZZ_ITERATIONS_MAX search steps, since every step
+ * above that delays the daemon.
+ *
+ * The limit can be lowered with $FUZZ_ITERATIONS_MAX to look for specs
+ * which are slow, but not yet too slow. */
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "calendarspec.h"
+#include "time-util.h"
+#include "fuzz.h"
+
+#define FUZZ_ITERATIONS_MAX CALENDAR_SEARCH_BUDGET_DEFAULT
+
+/* A failed check has to crash, also if built with -DNDEBUG */
+#define check(expr)                                                     \
+        do {                                                            \
+                if (!(expr)) {                                          \
+                        fprintf(stderr, "%s:%d: check failed: %s\n",    \
+                                __FILE__, __LINE__, #expr);             \
+                        abort();                                        \
+                }                                                       \
+        } while (0)
+
+static const usec_t starts[] = {
+        0,
+        /* Wed 2025-01-01 00:00:00 UTC */
+        1735689600 * USEC_PER_SEC,
+        /* Sun 2025-10-26 02:10:00 CEST, before the repeated hour */
+        1761437400 * USEC_PER_SEC,
+        /* Fri 2100-01-01 00:00:00 UTC, beyond the last transition */
+        4102444800 * USEC_PER_SEC,
+};
+
+static unsigned iterations_max = FUZZ_ITERATIONS_MAX;
+
+static void init(void) {
+        static bool initialized = false;
+        const char *e;
+
+        if (initialized)
+                return;
+        initialized = true;
+
+        /* Specs without zone are evaluated in a zone with DST */
+        setenv("TZ", "Europe/Berlin", 1);
+        tzset();
+
+        e = getenv("FUZZ_ITERATIONS_MAX");
+        if (e)
+                iterations_max = (unsigned) strtoul(e, NULL, 10);
+}
+
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size) {
+        CalendarSpec *spec, *again;
+        char *str, *a, *b;
+
+        if (size > FUZZ_INPUT_MAX)
+                return 0;
+
+        init();
+
+        str = strndup((const char *) data, size);
+        check(str);
+
+        if (calendar_spec_from_string(str, &spec) < 0) {
+                free(str);
+                return 0;
+        }
+
+        check(calendar_spec_to_string(spec, &a) >= 0);
+        check(strcmp(calendar_spec_string(spec), a) == 0);
+        check(calendar_spec_from_string(a, &again) >= 0);
+        check(calendar_spec_to_string(again, &b) >= 0);
+        if (strcmp(a, b) != 0) {
+                fprintf(stderr, "\"%s\" → \"%s\" → \"%s\"\n", str, a, b);
+                abort();
+        }
+
+        for (size_t i = 0; i < ELEMENTSOF(starts); i++) {
+                usec_t u = 0, v = 0;
+                int r, q;
+
+                r = calendar_spec_next_usec_budget(spec, starts[i], iterations_max, &u, NULL);
+                if (r == -ETIME) {
+                        fprintf(stderr, "\"%s\" needs more than %u iterations after " USEC_FMT "\n",
+                                a, iterations_max, starts[i]);
+                        abort();
+                }
+                check(r >= 0 || r == -ENOENT);
+                check(r < 0 || u > starts[i]);
+
+                q = calendar_spec_next_usec_budget(again, starts[i], iterations_max, &v, NULL);
+                check(q == r);
+                check(r < 0 || u == v);
+        }
+
+        calendar_spec_free(again);
+        calendar_spec_free(spec);
+        free(b);
+        free(a);
+        free(str);
+        return 0;
+}
@@ -0,0 +1,158 @@
+//SPDX-License-Identifier: GPL-2.0-or-later
+
+/* Fuzz target for load_config_file(). The input is written to a
+   temporary file and read like rebootmgr.conf. The maintenance
+   windows, blackouts and timers to avoid of an accepted configuration
+   have to survive the round trip through the functions which write
+   them back, and the planner has to come to an answer for them. */
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "basics.h"
+#include "common.h"
+#include "fuzz.h"
+
+/* A failed check has to crash, also if built with -DNDEBUG */
+#define check(expr)							\
+  do {									\
+    if (!(expr))							\
+      {									\
+	fprintf(stderr, "%s:%d: check failed: %s\n",			\
+		__FILE__, __LINE__, #expr);				\
+	abort();							\
+      }									\
+  } while (0)
+
+/* Wed 2025-01-01 00:00:00 UTC */
+#define WED (1735689600 * USEC_PER_SEC)
+
+static void
+check_windows(const RM_CTX *ctx)
+{
+  _cleanup_(freep) char *start = NULL, *duration = NULL;
+  _cleanup_(freep) char *start2 = NULL, *duration2 = NULL;
+  _cleanup_(freep) usec_t *durations = NULL;
+  RM_MaintWindow *windows = NULL;
+  size_t n_durations, n;
+
+  for (size_t i = 0; i < ctx->n_maint_windows; i++)
+    if (ctx->maint_windows[i].duration == USEC_INFINITY)
+      {
+	/* without window-duration only the starts are written */
+	check(rm_windows_to_string(ctx->maint_windows, ctx->n_maint_windows,
+				   &start, NULL) == 0);
+	return;
+      }
+
+  check(rm_windows_to_string(ctx->maint_windows, ctx->n_maint_windows,
+			     &start, &duration) == 0);
+  check(rm_durations_from_string(duration, &durations, &n_durations) == 0);
+  check(n_durations == ctx->n_maint_windows);
+  check(rm_windows_from_string(start, durations, n_durations,
+			       &windows, &n) == 0);
+  check(rm_windows_to_string(windows, n, &start2, &duration2) == 0);
+  if (strcmp(start, start2) != 0 || strcmp(duration, duration2) != 0)
+    {
+      fprintf(stderr, "\"%s\" for \"%s\" → \"%s\" for \"%s\"\n",
+	      start, duration, start2, duration2);
+      abort();
+    }
+  rm_windows_free(windows, n);
+}
+
+static void
+check_blackouts(const RM_CTX *ctx)
+{
+  _cleanup_(freep) char *str = NULL, *str2 = NULL;
+  RM_Blackout *blackouts = NULL;
+  size_t n;
+
+  check(rm_blackouts_to_string(ctx->blackouts, ctx->n_blackouts, &str) == 0);
+  check(rm_blackouts_from_string(str, &blackouts, &n) == 0);
+  check(rm_blackouts_to_string(blackouts, n, &str2) == 0);
+  if (strcmp(str, str2) != 0)
+    {
+      fprintf(stderr, "\"%s\" → \"%s\"\n", str, str2);
+      abort();
+    }
+  rm_blackouts_free(blackouts, n);
+}
+
+static void
+check_timers(const RM_CTX *ctx)
+{
+  _cleanup_(freep) char *str = NULL, *str2 = NULL;
+  RM_AvoidTimer *timers = NULL;
+  size_t n;
+
+  check(rm_avoid_timers_to_string(ctx->avoid_timers, ctx->n_avoid_timers,
+				  &str) == 0);
+  check(rm_avoid_timers_from_string(str, &timers, &n) == 0);
+  check(rm_avoid_timers_to_string(timers, n, &str2) == 0);
+  if (strcmp(str, str2) != 0)
+    {
+      fprintf(stderr, "\"%s\" → \"%s\"\n", str, str2);
+      abort();
+    }
+  rm_avoid_timers_free(timers, n);
+}
+
+static void
+check_planner(RM_CTX *ctx)
+{
+  usec_t start, end;
+  int r;
+
+  for (size_t i = 0; i < ctx->n_maint_windows; i++)
+    if (ctx->maint_windows[i].duration == USEC_INFINITY)
+      return;
+
+  r = rm_next_allowed_window(ctx->maint_windows, ctx->n_maint_windows,
+			     &ctx->blackout_index, ctx->blackouts,
+			     ctx->n_blackouts, WED, &start, &end);
+  check(r >= 0 || r == -ENOENT || r == -ETIME);
+  check(r < 0 || (start >= WED && start < end));
+}
+
+int
+LLVMFuzzerTestOneInput(const uint8_t *data, size_t size)
+{
+  char path[] = "/tmp/fuzz-load-config.XXXXXX";
+  RM_CTX ctx = {
+    .reboot_strategy = RM_REBOOTSTRATEGY_BEST_EFFORT,
+  };
+  int fd, r;
+
+  if (size > FUZZ_INPUT_MAX)
+    return 0;
+
+  fd = mkstemp(path);
+  check(fd >= 0);
+  check(write(fd, data, size) == (ssize_t) size);
+  close(fd);
+
+  r = load_config_file(&ctx, path);
+  unlink(path);
+
+  if (r == 0)
+    {
+      check(ctx.reboot_strategy != RM_REBOOTSTRATEGY_UNKNOWN);
+      if (ctx.n_maint_windows > 0)
+	check_windows(&ctx);
+      if (ctx.n_blackouts > 0)
+	check_blackouts(&ctx);
+      if (ctx.n_avoid_timers > 0)
+	check_timers(&ctx);
+      check_planner(&ctx);
+    }
+
+  rm_windows_free(ctx.maint_windows, ctx.n_maint_windows);
+  rm_blackouts_free(ctx.blackouts, ctx.n_blackouts);
+  rm_blackout_index_free(&ctx.blackout_index);
+  rm_avoid_timers_free(ctx.avoid_timers, ctx.n_avoid_timers);
+  return 0;
+}
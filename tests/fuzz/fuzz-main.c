@@ -0,0 +1,76 @@
+//SPDX-License-Identifier: GPL-2.0-or-later
+
+/* Copyright (c) 2025 Thorsten Kukuk
+   Author: Thorsten Kukuk <kukuk@suse.com>
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License along
+   with this program; if not, see <http://www.gnu.org/licenses/>. */
+
+/* Runs a fuzz target over the files given as arguments, or over stdin
+   if there are none. This is used to replay a corpus or crashes without
+   libFuzzer, and as driver for AFL:
+     afl-fuzz -i corpus/calendarspec -o out -- ./fuzz-calendarspec @@ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "fuzz.h"
+
+static int
+run(const char *name, FILE *fp)
+{
+  uint8_t buf[FUZZ_INPUT_MAX + 1];
+  size_t size;
+
+  size = fread(buf, 1, sizeof(buf), fp);
+  if (ferror(fp))
+    {
+      fprintf(stderr, "Reading %s failed: %s\n", name, strerror(errno));
+      return -1;
+    }
+
+  /* larger inputs are ignored by the targets, too */
+  if (size > FUZZ_INPUT_MAX)
+    return 0;
+
+  LLVMFuzzerTestOneInput(buf, size);
+  return 0;
+}
+
+int
+main(int argc, char **argv)
+{
+  int retval = EXIT_SUCCESS;
+
+  if (argc < 2)
+    return run("stdin", stdin) < 0 ? EXIT_FAILURE : EXIT_SUCCESS;
+
+  for (int i = 1; i < argc; i++)
+    {
+      FILE *fp = fopen(argv[i], "r");
+
+      if (fp == NULL)
+	{
+	  fprintf(stderr, "Cannot open %s: %s\n", argv[i], strerror(errno));
+	  retval = EXIT_FAILURE;
+	  continue;
+	}
+      if (run(argv[i], fp) < 0)
+	retval = EXIT_FAILURE;
+      fclose(fp);
+    }
+
+  return retval;
+}
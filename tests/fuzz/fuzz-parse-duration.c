@@ -0,0 +1,62 @@
+//SPDX-License-Identifier: GPL-2.0-or-later
+
+/* Fuzz target for parse_duration_usec() and parse_duration(). Both
+   have to agree, and a parsed duration has to survive the round trip
+   through rm_duration_format(), which writes the configuration. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "basics.h"
+#include "common.h"
+#include "parse-duration.h"
+#include "fuzz.h"
+
+/* A failed check has to crash, also if built with -DNDEBUG */
+#define check(expr)							\
+  do {									\
+    if (!(expr))							\
+      {									\
+	fprintf(stderr, "%s:%d: check failed: %s\n",			\
+		__FILE__, __LINE__, #expr);				\
+	abort();							\
+      }									\
+  } while (0)
+
+int
+LLVMFuzzerTestOneInput(const uint8_t *data, size_t size)
+{
+  _cleanup_(freep) char *str = NULL;
+  char buf[RM_DURATION_STRING_MAX];
+  usec_t usec, again = 0;
+  time_t t;
+  int r;
+
+  if (size > FUZZ_INPUT_MAX)
+    return 0;
+
+  str = strndup((const char *) data, size);
+  check(str);
+
+  r = parse_duration_usec(str, &usec);
+  t = parse_duration(str);
+  if (r < 0)
+    {
+      check(t == BAD_TIME);
+      return 0;
+    }
+  check(usec != USEC_INFINITY);
+  check(t == (time_t) (usec / USEC_PER_SEC));
+
+  check(rm_duration_format(usec, buf, sizeof(buf)) == 0);
+  r = parse_duration_usec(buf, &again);
+  if (r < 0 || again != usec)
+    {
+      fprintf(stderr, "\"%s\" → %llu → \"%s\" → %llu\n", str,
+	      (unsigned long long) usec, buf, (unsigned long long) again);
+      abort();
+    }
+
+  return 0;
+}
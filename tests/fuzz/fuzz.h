@@ -0,0 +1,14 @@
+//SPDX-License-Identifier: GPL-2.0-or-later
+
+/* Entry points of the fuzz targets, see fuzz-main.c */
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Upper limit for the inputs, larger ones are ignored, so that the
+   fuzzer does not spend its time on huge configurations */
+#define FUZZ_INPUT_MAX 4096
+
+extern int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size);
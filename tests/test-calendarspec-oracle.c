@@ -0,0 +1,405 @@
+/*-*- Mode: C; c-basic-offset: 8; indent-tabs-mode: nil -*-*/
+
+/* Differential test of the calendar engine against a brute force
+ * reference. Random specs are generated from a description, and the
+ * reference walks through time, comparing the civil time from libc in
+ * the zone of the spec with that description. It steps by days, hours
+ * or minutes as long as these do not match, and by seconds inside of a
+ * matching minute.
+ *
+ * Usage: test-calendarspec-oracle [rounds [seed]]
+ * With 0 rounds it runs until a mismatch is found. */
+
+#include <assert.h>
+#include <errno.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "calendarspec.h"
+#include "time-util.h"
+
+#define assert_se assert
+#define MIN(a, b) ((a) < (b) ? (a) : (b))
+
+#define SPECS_PER_ROUND 16
+#define HORIZON ((time_t) 8 * 366 * 24 * 3600)
+
+/* Zones with DST at different times of the day, by 30 minutes, at
+ * midnight, and with an offset which is not a multiple of an hour */
+static const char *const zones[] = {
+        "UTC",
+        "Europe/Berlin",
+        "America/New_York",
+        "Australia/Lord_Howe",
+        "Pacific/Chatham",
+        "America/Sao_Paulo",
+};
+
+static const char *const weekday_names[] = { "Mon", "Tue", "Wed", "Thu", "Fri", "Sat", "Sun" };
+
+typedef struct Item {
+        int value;
+        int repeat;
+} Item;
+
+/* A chain of values, n == 0 is "*" */
+typedef struct Field {
+        unsigned n;
+        Item items[3];
+} Field;
+
+typedef struct Spec {
+        unsigned weekdays; /* bit 0 is Monday, 0 is every day */
+        Field year, month, day, hour, minute, second;
+        const char *zone;  /* NULL for the one of the round */
+        bool utc;
+        char str[256];
+} Spec;
+
+static uint64_t rng_state;
+
+/* xorshift64*, so that a seed gives the same specs everywhere */
+static uint64_t rng(void) {
+        rng_state ^= rng_state >> 12;
+        rng_state ^= rng_state << 25;
+        rng_state ^= rng_state >> 27;
+        return rng_state * UINT64_C(2685821657736338717);
+}
+
+static int rnd(int n) {
+        return (int) (rng() % (uint64_t) n);
+}
+
+static int rnd_range(int min, int max) {
+        return min + rnd(max - min + 1);
+}
+
+static bool field_matches(const Field *f, int x) {
+        if (f->n == 0)
+                return true;
+
+        for (unsigned i = 0; i < f->n; i++) {
+                const Item *it = &f->items[i];
+
+                if (it->repeat == 0 ? x == it->value :
+                    x >= it->value && (x - it->value) % it->repeat == 0)
+                        return true;
+        }
+
+        return false;
+}
+
+/* "*" with a probability of any_pct, otherwise up to three values,
+ * half of them from the ones which are likely to find bugs */
+static void gen_field(Field *f, int min, int max, int any_pct, const int *hot, size_t n_hot) {
+        *f = (Field) {};
+
+        if (rnd(100) < any_pct)
+                return;
+
+        f->n = rnd_range(1, 3);
+        for (unsigned i = 0; i < f->n; i++) {
+                Item *it = &f->items[i];
+
+                it->value = hot && rnd(2) ? hot[rnd((int) n_hot)] : rnd_range(min, max);
+
+                /* The second value of a repetition has to be in range */
+                if (it->value < max && rnd(4) == 0)
+                        it->repeat = rnd_range(1, MIN((max - min) / 2 + 1, max - it->value));
+        }
+}
+
+static void format_field(char **p, const Field *f, int width) {
+        if (f->n == 0) {
+                *p += sprintf(*p, "*");
+                return;
+        }
+
+        for (unsigned i = 0; i < f->n; i++) {
+                *p += sprintf(*p, "%s%0*d", i > 0 ? "," : "", width, f->items[i].value);
+                if (f->items[i].repeat > 0)
+                        *p += sprintf(*p, "/%d", f->items[i].repeat);
+        }
+}
+
+static void format_weekdays(char **p, unsigned bits) {
+        bool first = true;
+
+        for (int i = 0; i < 7; i++) {
+                int j = i;
+
+                if (!(bits & 1U << i))
+                        continue;
+
+                /* Runs of three or more days as range */
+                while (j < 6 && bits & 1U << (j + 1))
+                        j++;
+                if (j - i < 2)
+                        j = i;
+
+                *p += sprintf(*p, "%s%s", first ? "" : ",", weekday_names[i]);
+                if (j > i)
+                        *p += sprintf(*p, "-%s", weekday_names[j]);
+                first = false;
+                i = j;
+        }
+
+        *p += sprintf(*p, " ");
+}
+
+static void gen_spec(Spec *s, int year) {
+        static const int hot_month[] = { 2, 3, 4, 9, 10, 11 };
+        static const int hot_day[] = { 1, 28, 29, 30, 31 };
+        static const int hot_hour[] = { 0, 1, 2, 3 };
+        static const int hot_minute[] = { 0, 30, 45, 59 };
+        int hot_year[] = { year, year + 1, year + 3, year + 4 };
+        char *p = s->str;
+        bool short_time;
+
+        *s = (Spec) {};
+
+        if (rnd(5) < 2)
+                s->weekdays = rnd_range(1, 127);
+        gen_field(&s->year, year - 1, year + 6, 70, hot_year, ELEMENTSOF(hot_year));
+        gen_field(&s->month, 1, 12, 50, hot_month, ELEMENTSOF(hot_month));
+        gen_field(&s->day, 1, 31, 50, hot_day, ELEMENTSOF(hot_day));
+        gen_field(&s->hour, 0, 23, 15, hot_hour, ELEMENTSOF(hot_hour));
+        gen_field(&s->minute, 0, 59, 15, hot_minute, ELEMENTSOF(hot_minute));
+        if (rnd(3) == 0)
+                gen_field(&s->second, 0, 59, 10, NULL, 0);
+        else
+                s->second = (Field) { .n = 1 };
+
+        switch (rnd(4)) {
+        case 0:
+                break;
+        case 1:
+                s->utc = true;
+                break;
+        default:
+                s->zone = zones[rnd(ELEMENTSOF(zones))];
+        }
+
+        if (s->weekdays)
+                format_weekdays(&p, s->weekdays);
+
+        if (s->year.n > 0 || s->month.n > 0 || s->day.n > 0 || rnd(2)) {
+                if (s->year.n > 0 || rnd(2)) {
+                        format_field(&p, &s->year, 4);
+                        *p++ = '-';
+                }
+                format_field(&p, &s->month, 2);
+                *p++ = '-';
+                format_field(&p, &s->day, 2);
+                *p++ = ' ';
+        }
+
+        /* "HH:MM" means second 0, but "HH:*" every second */
+        short_time = s->second.n == 1 && s->second.items[0].value == 0 &&
+                s->second.items[0].repeat == 0 && s->minute.n > 0 && rnd(2);
+        format_field(&p, &s->hour, 2);
+        *p++ = ':';
+        format_field(&p, &s->minute, 2);
+        if (!short_time) {
+                *p++ = ':';
+                format_field(&p, &s->second, 2);
+        }
+
+        if (s->utc)
+                p += sprintf(p, " UTC");
+        else if (s->zone)
+                p += sprintf(p, " %s", s->zone);
+        *p = 0;
+}
+
+static void set_tz(const char *zone) {
+        assert_se(setenv("TZ", zone, 1) >= 0);
+        tzset();
+}
+
+static void civil(time_t t, struct tm *tm) {
+        assert_se(localtime_r(&t, tm));
+}
+
+static bool date_matches(const Spec *s, const struct tm *tm) {
+        return (s->weekdays == 0 || s->weekdays & 1U << ((tm->tm_wday + 6) % 7)) &&
+                field_matches(&s->year, tm->tm_year + 1900) &&
+                field_matches(&s->month, tm->tm_mon + 1) &&
+                field_matches(&s->day, tm->tm_mday);
+}
+
+/* Skips the given amount of civil time, to the end of the day or of
+ * the hour. If the UTC offset changes in between, only to the next
+ * minute, so that no civil time after a DST change gets lost. */
+static time_t skip_civil(time_t t, const struct tm *tm, long seconds) {
+        struct tm n;
+
+        civil(t + seconds, &n);
+        if (n.tm_gmtoff == tm->tm_gmtoff)
+                return t + seconds;
+
+        return t + 60 - tm->tm_sec;
+}
+
+/* The reference: the first second at or after t whose civil time in
+ * the zone in $TZ matches the spec */
+static bool oracle_next(const Spec *s, time_t t, time_t until, time_t *ret) {
+        struct tm tm;
+
+        while (t < until) {
+                civil(t, &tm);
+
+                if (!date_matches(s, &tm))
+                        t = skip_civil(t, &tm, 24 * 3600 - (tm.tm_hour * 3600 + tm.tm_min * 60 + tm.tm_sec));
+                else if (!field_matches(&s->hour, tm.tm_hour))
+                        t = skip_civil(t, &tm, 3600 - (tm.tm_min * 60 + tm.tm_sec));
+                else if (!field_matches(&s->minute, tm.tm_min))
+                        t += 60 - tm.tm_sec;
+                else {
+                        for (int sec = tm.tm_sec; sec < 60; sec++)
+                                if (field_matches(&s->second, sec)) {
+                                        *ret = t + sec - tm.tm_sec;
+                                        return true;
+                                }
+                        t += 60 - tm.tm_sec;
+                }
+        }
+
+        return false;
+}
+
+/* Random start times, half of them in the months with DST changes */
+static usec_t gen_start(void) {
+        static const int dst_months[] = { 3, 4, 9, 10, 11 };
+        struct tm tm = {
+                .tm_year = rnd_range(1995, 2040) - 1900,
+                .tm_mday = rnd_range(1, 28),
+                .tm_hour = rnd_range(0, 23),
+                .tm_min = rnd_range(0, 59),
+                .tm_sec = rnd_range(0, 59),
+        };
+
+        tm.tm_mon = (rnd(2) ? dst_months[rnd(ELEMENTSOF(dst_months))] : rnd_range(1, 12)) - 1;
+
+        return (usec_t) timegm(&tm) * USEC_PER_SEC + (usec_t) rnd(USEC_PER_SEC);
+}
+
+static void check(const char *what, const Spec *s, const char *zone, usec_t start,
+                  bool found, time_t expected, int r, usec_t next, unsigned long long seed) {
+        char a[FORMAT_TIMESTAMP_MAX], b[FORMAT_TIMESTAMP_MAX];
+
+        if (found ? r >= 0 && next == (usec_t) expected * USEC_PER_SEC :
+            r == -ENOENT || (r >= 0 && next >= start + (usec_t) HORIZON * USEC_PER_SEC))
+                return;
+
+        set_tz("UTC");
+        fprintf(stderr, "MISMATCH (seed %llu) %s: \"%s\" in %s after %s (" USEC_FMT ")\n",
+               seed, what, s->str, zone, format_timestamp(a, sizeof(a), start), start);
+        fprintf(stderr, "  reference: %s\n", found ? format_timestamp(a, sizeof(a), (usec_t) expected * USEC_PER_SEC) : "none");
+        fprintf(stderr, "  engine:    %s\n", r < 0 ? strerror(-r) : format_timestamp(b, sizeof(b), next));
+        assert_se(false);
+}
+
+static void round_one(unsigned long long seed, unsigned *n_checked, unsigned *n_never) {
+        const char *zone = zones[rnd(ELEMENTSOF(zones))];
+        usec_t start = gen_start(), next_many[SPECS_PER_ROUND], next[SPECS_PER_ROUND];
+        CalendarSpec *specs[SPECS_PER_ROUND];
+        int errors[SPECS_PER_ROUND], r_next[SPECS_PER_ROUND];
+        Spec s[SPECS_PER_ROUND];
+        CalendarSpecBatch *b;
+        CalendarEvalCtx *ctx;
+        time_t t0 = (time_t) (start / USEC_PER_SEC) + 1;
+        size_t n = 0;
+        int year, r;
+
+        {
+                struct tm tm;
+                time_t t = t0;
+
+                assert_se(gmtime_r(&t, &tm));
+                year = tm.tm_year + 1900;
+        }
+
+        set_tz(zone);
+        calendar_spec_cache_invalidate_all();
+
+        while (n < SPECS_PER_ROUND) {
+                gen_spec(&s[n], year);
+                r = calendar_spec_from_string(s[n].str, &specs[n]);
+                if (r == -EDOM) {
+                        /* like "*-02-30", never elapses */
+                        (*n_never)++;
+                        continue;
+                }
+                if (r < 0) {
+                        fprintf(stderr, "Failed to parse \"%s\": %s\n", s[n].str, strerror(-r));
+                        assert_se(false);
+                }
+                n++;
+        }
+
+        for (size_t k = 0; k < n; k++)
+                r_next[k] = calendar_spec_next_usec(specs[k], start, &next[k]);
+
+        assert_se(calendar_spec_batch_new(specs, n, &b) >= 0);
+        assert_se(calendar_spec_next_usec_many(b, NULL, start, next_many, errors) >= 0);
+        calendar_spec_batch_free(b);
+
+        for (size_t k = 0; k < n; k++) {
+                const char *z = s[k].utc ? "UTC" : s[k].zone ?: zone;
+                usec_t u = 0;
+                time_t expected = 0;
+                bool found;
+
+                set_tz(z);
+                found = oracle_next(&s[k], t0, t0 + HORIZON, &expected);
+
+                set_tz(zone);
+                check("calendar_spec_next_usec", &s[k], z, start, found, expected, r_next[k], next[k], seed);
+                check("calendar_spec_next_usec_many", &s[k], z, start, found, expected,
+                      next_many[k] == USEC_INFINITY ? errors[k] : 0, next_many[k], seed);
+                r = calendar_spec_cache_next(specs[k], start, &u);
+                check("calendar_spec_cache_next", &s[k], z, start, found, expected, r, u, seed);
+
+                /* The zone of the round from a context, with a different
+                 * local one */
+                set_tz("Asia/Tokyo");
+                assert_se(calendar_eval_ctx_new(zone, &ctx) >= 0);
+                r = calendar_spec_next_usec_ctx(specs[k], ctx, start, &u);
+                calendar_eval_ctx_free(ctx);
+                check("calendar_spec_next_usec_ctx", &s[k], z, start, found, expected, r, u, seed);
+
+                (*n_checked)++;
+        }
+
+        for (size_t k = 0; k < n; k++)
+                calendar_spec_free(specs[k]);
+}
+
+int main(int argc, char *argv[]) {
+        unsigned long long rounds = 100, seed = 1;
+        unsigned n_checked = 0, n_never = 0;
+
+        if (argc > 1)
+                rounds = strtoull(argv[1], NULL, 10);
+        if (argc > 2)
+                seed = strtoull(argv[2], NULL, 10);
+
+        /* xorshift must not start from 0 */
+        rng_state = seed * UINT64_C(0x9E3779B97F4A7C15) | 1;
+
+        for (unsigned long long i = 0; rounds == 0 || i < rounds; i++) {
+                round_one(seed, &n_checked, &n_never);
+
+                if (rounds == 0 && i % 1000 == 999)
+                        printf("%llu rounds, %u specs checked\n", i + 1, n_checked);
+        }
+
+        printf("%u specs checked, %u never elapsing ones skipped\n", n_checked, n_never);
+
+        return EXIT_SUCCESS;
+}
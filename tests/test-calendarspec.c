@@ -52,6 +52,17 @@ static void test_one(const char *input, const char *output) {
 
         assert_se(streq(p, output));
 
+        /* the same without allocation */
+        assert_se(streq(calendar_spec_string(c), output));
+        assert_se(calendar_spec_format_max(c) == strlen(output) + 1);
+        {
+                char f[calendar_spec_format_max(c)];
+
+                assert_se(calendar_spec_format(c, f, sizeof(f)) == 0);
+                assert_se(streq(f, output));
+                assert_se(calendar_spec_format(c, f, sizeof(f) - 1) == -ENOBUFS);
+        }
+
         u = now(CLOCK_REALTIME);
         r = calendar_spec_next_usec(c, u, &u);
         printf("Next: %s\n", r < 0 ? strerror(-r) : format_timestamp(buf, sizeof(buf), u));
@@ -104,6 +115,338 @@ static void test_next(const char *input, const char *new_tz, usec_t after, usec_
         tzset();
 }
 
+static void test_prev(const char *input, const char *new_tz, usec_t before, usec_t expect) {
+        CalendarSpec *c;
+        usec_t u;
+        char *old_tz;
+        char buf[FORMAT_TIMESTAMP_MAX];
+        int r;
+
+        old_tz = getenv("TZ");
+        if (old_tz)
+                old_tz = strdupa(old_tz);
+
+        assert_se(setenv("TZ", new_tz, 1) >= 0);
+        tzset();
+
+        assert_se(calendar_spec_from_string(input, &c) >= 0);
+
+        printf("\"%s\"\n", input);
+
+        r = calendar_spec_prev_usec(c, before, &u);
+        printf("Last: %s\n", r < 0 ? strerror(-r) : format_timestamp(buf, sizeof(buf), u));
+        if (expect != (usec_t)-1)
+                assert_se(r >= 0 && u == expect);
+        else
+                assert(r == -ENOENT);
+
+        calendar_spec_free(c);
+
+        if (old_tz)
+                assert_se(setenv("TZ", old_tz, 1) >= 0);
+        else
+                assert_se(unsetenv("TZ") >= 0);
+        tzset();
+}
+
+static void test_locate(const char *input, usec_t duration, usec_t at, int inside, usec_t expect) {
+        CalendarSpec *c;
+        usec_t u;
+
+        assert_se(calendar_spec_from_string(input, &c) >= 0);
+        assert_se(calendar_window_locate(c, duration, at, &u) == inside);
+        assert_se(u == expect);
+        calendar_spec_free(c);
+}
+
+static void test_budget(const char *input, usec_t after, unsigned max_iterations) {
+        CalendarSpec *c;
+        usec_t u;
+        unsigned n;
+
+        assert_se(calendar_spec_from_string(input, &c) >= 0);
+        assert_se(calendar_spec_next_usec_budget(c, after, CALENDAR_SEARCH_BUDGET_DEFAULT, &u, &n) >= 0);
+        printf("\"%s\": %u iterations\n", input, n);
+        assert_se(n <= max_iterations);
+        assert_se(calendar_spec_next_usec_budget(c, after, n - 1, &u, NULL) == -ETIME);
+        calendar_spec_free(c);
+}
+
+static void test_iter(const char *input, const char *new_tz, usec_t after, unsigned n) {
+        CalendarSpec *c;
+        CalendarSpecIter i;
+        usec_t u, v;
+        char *old_tz;
+        int r, q;
+
+        old_tz = getenv("TZ");
+        if (old_tz)
+                old_tz = strdupa(old_tz);
+
+        assert_se(setenv("TZ", new_tz, 1) >= 0);
+        tzset();
+
+        assert_se(calendar_spec_from_string(input, &c) >= 0);
+
+        printf("\"%s\" (%u iterations)\n", input, n);
+
+        /* The iterator has to yield the same as calling
+           calendar_spec_next_usec() with the previous result */
+        assert_se(calendar_spec_iter_init(&i, c, after) >= 0);
+        u = after;
+        while (n-- > 0) {
+                r = calendar_spec_iter_next(&i, &v);
+                q = calendar_spec_next_usec(c, u, &u);
+                assert_se(r == q);
+                if (r < 0)
+                        break;
+                assert_se(u == v);
+        }
+
+        calendar_spec_free(c);
+
+        if (old_tz)
+                assert_se(setenv("TZ", old_tz, 1) >= 0);
+        else
+                assert_se(unsetenv("TZ") >= 0);
+        tzset();
+}
+
+static void test_ctx(const char *input, const char *tz, usec_t after, unsigned n) {
+        usec_t *expect, *expect_prev;
+        int *expect_r;
+        CalendarEvalCtx *ctx;
+        CalendarSpec *c;
+        CalendarSpecIter i;
+        usec_t u, v;
+        char *old_tz;
+        unsigned k;
+
+        old_tz = getenv("TZ");
+        if (old_tz)
+                old_tz = strdupa(old_tz);
+
+        assert_se(calendar_spec_from_string(input, &c) >= 0);
+        expect = calloc(n, sizeof(usec_t));
+        assert_se(expect);
+        expect_prev = calloc(n, sizeof(usec_t));
+        assert_se(expect_prev);
+        expect_r = calloc(n, sizeof(int));
+        assert_se(expect_r);
+
+        printf("\"%s\" in %s (%u iterations)\n", input, tz, n);
+
+        /* The reference from the C library, in the zone of the context */
+        assert_se(setenv("TZ", tz, 1) >= 0);
+        tzset();
+        assert_se(calendar_spec_iter_init(&i, c, after) >= 0);
+        for (k = 0; k < n; k++) {
+                assert_se(calendar_spec_iter_next(&i, &expect[k]) >= 0);
+                expect_r[k] = calendar_spec_prev_usec(c, expect[k] - 1, &expect_prev[k]);
+        }
+
+        /* A context for the local zone takes it from $TZ */
+        assert_se(calendar_eval_ctx_new(NULL, &ctx) >= 0);
+        assert_se(streq(calendar_eval_ctx_timezone(ctx), tz));
+        calendar_eval_ctx_free(ctx);
+
+        /* The context does not depend on the zone of the process */
+        assert_se(setenv("TZ", "Asia/Tokyo", 1) >= 0);
+        tzset();
+        assert_se(calendar_eval_ctx_new(tz, &ctx) >= 0);
+
+        assert_se(calendar_spec_iter_init_ctx(&i, c, ctx, after) >= 0);
+        u = after;
+        for (k = 0; k < n; k++) {
+                assert_se(calendar_spec_iter_next(&i, &v) >= 0);
+                assert_se(v == expect[k]);
+                assert_se(calendar_spec_next_usec_ctx(c, ctx, u, &u) >= 0);
+                assert_se(u == expect[k]);
+                assert_se(calendar_spec_prev_usec_ctx(c, ctx, expect[k] - 1, &v) == expect_r[k]);
+                assert_se(expect_r[k] < 0 || v == expect_prev[k]);
+        }
+
+        calendar_eval_ctx_free(ctx);
+        calendar_spec_free(c);
+        free(expect);
+        free(expect_prev);
+        free(expect_r);
+
+        if (old_tz)
+                assert_se(setenv("TZ", old_tz, 1) >= 0);
+        else
+                assert_se(unsetenv("TZ") >= 0);
+        tzset();
+}
+
+static void test_cache(const char *input, const char *new_tz, usec_t after, unsigned n) {
+        CalendarSpec *c;
+        usec_t u, v, w;
+        char *old_tz;
+        int r, q;
+
+        old_tz = getenv("TZ");
+        if (old_tz)
+                old_tz = strdupa(old_tz);
+
+        assert_se(setenv("TZ", new_tz, 1) >= 0);
+        tzset();
+
+        assert_se(calendar_spec_from_string(input, &c) >= 0);
+
+        printf("\"%s\" cached (%u iterations)\n", input, n);
+
+        u = v = after;
+        while (n-- > 0) {
+                r = calendar_spec_cache_next(c, u, &u);
+                q = calendar_spec_next_usec(c, v, &v);
+                assert_se(r == q);
+                if (r < 0)
+                        break;
+                assert_se(u == v);
+
+                /* a point within the same second, and going back to the
+                   start, which rebuilds the table once it moved on */
+                assert_se(calendar_spec_cache_next(c, u - USEC_PER_SEC / 2, &w) >= 0 && w == u);
+                if (n % 97 == 0) {
+                        assert_se(calendar_spec_cache_next(c, after, &w) >= 0);
+                        assert_se(calendar_spec_next_usec(c, after, &v) >= 0 && w == v);
+                        v = u;
+                }
+        }
+
+        /* after invalidation the table is rebuilt */
+        calendar_spec_cache_invalidate_all();
+        assert_se(calendar_spec_cache_next(c, after, &u) >= 0);
+        assert_se(calendar_spec_next_usec(c, after, &v) >= 0 && u == v);
+        assert_se(c->cache && c->cache->generation > 0);
+
+        calendar_spec_free(c);
+
+        if (old_tz)
+                assert_se(setenv("TZ", old_tz, 1) >= 0);
+        else
+                assert_se(unsetenv("TZ") >= 0);
+        tzset();
+}
+
+/* The bitmap of weekly specs has to give the same results as the
+   general search */
+static void test_weekly(const char *input, const char *new_tz, bool weekly, usec_t after, unsigned n) {
+        CalendarSpec *c, *g;
+        CalendarSpecIter i, j;
+        usec_t u, v;
+        char *old_tz;
+        int r, q;
+
+        old_tz = getenv("TZ");
+        if (old_tz)
+                old_tz = strdupa(old_tz);
+
+        assert_se(setenv("TZ", new_tz, 1) >= 0);
+        tzset();
+
+        assert_se(calendar_spec_from_string(input, &c) >= 0);
+        assert_se(calendar_spec_from_string(input, &g) >= 0);
+        assert_se(c->weekly == weekly);
+        g->weekly = false;
+
+        printf("\"%s\" weekly (%u iterations)\n", input, n);
+
+        assert_se(calendar_spec_iter_init(&i, c, after) >= 0);
+        assert_se(calendar_spec_iter_init(&j, g, after) >= 0);
+        while (n-- > 0) {
+                r = calendar_spec_iter_next(&i, &u);
+                q = calendar_spec_iter_next(&j, &v);
+                assert_se(r == q);
+                if (r < 0)
+                        break;
+                assert_se(u == v);
+
+                /* and from within the minute before */
+                assert_se(calendar_spec_next_usec(c, u - 30 * USEC_PER_SEC, &u) >= 0);
+                assert_se(calendar_spec_next_usec(g, v - 30 * USEC_PER_SEC, &v) >= 0);
+                assert_se(u == v);
+        }
+
+        calendar_spec_free(c);
+        calendar_spec_free(g);
+
+        if (old_tz)
+                assert_se(setenv("TZ", old_tz, 1) >= 0);
+        else
+                assert_se(unsetenv("TZ") >= 0);
+        tzset();
+}
+
+static void test_many(const char *new_tz, usec_t after) {
+        static const char *const inputs[] = {
+                "Sat 02:00",
+                "Sun 23:59 UTC",
+                "Mon-Fri 02,03:30",
+                "*-*-* 02:30",
+                "Thu 04:00 Europe/Berlin",
+                "*:0/7",
+                "Fri *-*-13 03:00",
+                "2016-03-27 03:17:00",
+                "Sat 02:00:30 America/New_York",
+        };
+        CalendarSpec *specs[ELEMENTSOF(inputs)];
+        CalendarSpecBatch *b;
+        CalendarEvalCtx *ctx;
+        usec_t next[ELEMENTSOF(inputs)], u;
+        int errors[ELEMENTSOF(inputs)], r;
+        char *old_tz;
+        unsigned k, j;
+
+        old_tz = getenv("TZ");
+        if (old_tz)
+                old_tz = strdupa(old_tz);
+
+        assert_se(setenv("TZ", new_tz, 1) >= 0);
+        tzset();
+
+        printf("%zu specs at once in %s\n", ELEMENTSOF(inputs), new_tz);
+
+        for (k = 0; k < ELEMENTSOF(inputs); k++)
+                assert_se(calendar_spec_from_string(inputs[k], &specs[k]) >= 0);
+        assert_se(calendar_spec_batch_new(specs, ELEMENTSOF(inputs), &b) >= 0);
+        assert_se(b->n_weekly == 6);
+        assert_se(calendar_eval_ctx_new(NULL, &ctx) >= 0);
+
+        /* every 17 minutes for two weeks, which crosses DST changes
+           for the dates picked in main() */
+        for (j = 0; j < 1200; j++) {
+                usec_t usec = after + j * 17 * USEC_PER_MINUTE + j % 3 * USEC_PER_SEC;
+
+                assert_se(calendar_spec_next_usec_many(b, NULL, usec, next, errors) >= 0);
+                for (k = 0; k < ELEMENTSOF(inputs); k++) {
+                        r = calendar_spec_next_usec(specs[k], usec, &u);
+                        assert_se(r == errors[k]);
+                        assert_se(next[k] == (r < 0 ? USEC_INFINITY : u));
+                }
+
+                /* the context is of the same zone */
+                assert_se(calendar_spec_next_usec_many(b, ctx, usec, next, NULL) >= 0);
+                for (k = 0; k < ELEMENTSOF(inputs); k++) {
+                        if (calendar_spec_next_usec(specs[k], usec, &u) < 0)
+                                u = USEC_INFINITY;
+                        assert_se(next[k] == u);
+                }
+        }
+
+        calendar_eval_ctx_free(ctx);
+        calendar_spec_batch_free(b);
+        for (k = 0; k < ELEMENTSOF(inputs); k++)
+                calendar_spec_free(specs[k]);
+
+        if (old_tz)
+                assert_se(setenv("TZ", old_tz, 1) >= 0);
+        else
+                assert_se(unsetenv("TZ") >= 0);
+        tzset();
+}
+
 int main(void) {
         CalendarSpec *c;
 
@@ -112,7 +455,7 @@ int main(void) {
         test_one("Wed *-1", "Wed *-*-01 00:00:00");
         test_one("Wed-Wed,Wed *-1", "Wed *-*-01 00:00:00");
         test_one("Wed, 17:48", "Wed *-*-* 17:48:00");
-        test_one("Wed-Sat,Tue 12-10-15 1:2:3", "Tue-Sat 2012-10-15 01:02:03");
+        test_one("Wed-Sat,Tue 12-10-16 1:2:3", "Tue-Sat 2012-10-16 01:02:03");
         test_one("*-*-7 0:0:0", "*-*-07 00:00:00");
         test_one("10-15", "*-10-15 00:00:00");
         test_one("monday *-12-* 17:00", "Mon *-12-* 17:00:00");
@@ -135,8 +478,15 @@ int main(void) {
         test_one("quarterly", "*-01,04,07,10-01 00:00:00");
         test_one("semi-annually", "*-01,07-01 00:00:00");
         test_one("annually", "*-01-01 00:00:00");
+        test_one("YEARLY", "*-01-01 00:00:00");
+        test_one("bi-annually", "*-01,07-01 00:00:00");
+        test_one("thursday,SUNDAY,tue-wed 1,1,1:1,1", "Tue-Thu,Sun *-*-* 01:01:00");
         test_one("*:2/3", "*-*-* *:02/3:00");
         test_one("2015-10-25 01:00:00 uTc", "2015-10-25 01:00:00 UTC");
+        test_one("Sat 02:00 Europe/Berlin", "Sat *-*-* 02:00:00 Europe/Berlin");
+        test_one("daily America/New_York", "*-*-* 00:00:00 America/New_York");
+        test_one("Mon,Wed,Fri,Sun 2100/99-1/1,2/9,3/3-1,2,3,4,5/5 1/2,3/4:5/6,7:8/9,10,11,12",
+                 "Mon,Wed,Fri,Sun 2100/99-01/1,02/9,03/3-01,02,03,04,05/5 01/2,03/4:05/6,07:08/9,10,11,12");
 
         test_next("2016-03-27 03:17:00", "", 12345, 1459048620000000);
         test_next("2016-03-27 03:17:00", "CET", 12345, 1459041420000000);
@@ -145,11 +495,92 @@ int main(void) {
         test_next("2016-03-27 03:17:00 UTC", "", 12345, 1459048620000000);
         test_next("2016-03-27 03:17:00 UTC", "CET", 12345, 1459048620000000);
         test_next("2016-03-27 03:17:00 UTC", "EET", 12345, 1459048620000000);
+        test_next("*-*-31 UTC", NULL, 1454284800000000, 1459382400000000);
+        test_next("*:2/20 UTC", NULL, 1454284800000000, 1454284920000000);
+        test_next("10/5:00 UTC", NULL, 1454284800000000, 1454320800000000);
+        test_next("*-02-29 UTC", NULL, 1483228800000000, 1582934400000000);
+        test_next("Fri *-*-13 UTC", NULL, 1483228800000000, 1484265600000000);
+        test_next("2016-03-27 03:17:00 Europe/Berlin", "America/New_York", 12345, 1459041420000000);
+        test_next("2016-03-27 03:17:00 Europe/Helsinki", "CET", 12345, -1);
+        test_next("2150-07-01 12:00 Europe/Berlin", NULL, 12345, 5695956000000000);
+        /* 02:30 exists twice at the end of DST, the earlier one is used
+           first, the later one when starting in the repeated hour */
+        test_next("2025-10-26 02:30 Europe/Berlin", "UTC", 12345, 1761438600000000);
+        test_next("2025-10-26 02:30 Europe/Berlin", "UTC", 1761441000000000, 1761442200000000);
+        /* 02:10 comes again after DST ended at 03:00, while it is 02:30 */
+        test_next("2025-10-26 02:10 Europe/Berlin", "UTC", 1761438600000000, 1761441000000000);
+        test_next("*-*-* 02:10", "Europe/Berlin", 1761438600000000, 1761441000000000);
+
+        test_budget("Fri *-*-13 03:00 UTC", 1483228800000000, 16);
+        test_budget("Mon *-02-29 UTC", 1483228800000000, 100);
+        /* the DST gap is skipped at once, not second by second */
+        test_budget("02:*:* Europe/Berlin", 1459000000000000, 32);
+
+        test_iter("*:0/15", "America/New_York", 1225000000000000, 2000);
+        test_iter("*:0/15 America/New_York", "UTC", 1225000000000000, 2000);
+        test_iter("hourly", "Pacific/Chatham", 3190000000000000, 20000);
+        test_iter("*-*-* 02:30", "Europe/Berlin", 1700000000000000, 1000);
+        test_iter("Sat 02:00 Europe/Berlin", "America/New_York", 12345, 1000);
+        test_iter("2016-03-27 03:17:00", "CET", 12345, 3);
+        test_iter("*:*:0/7 UTC", "UTC", 1459048620000000, 5000);
+
+        test_prev("*-*-31 UTC", "UTC", 1454284800000000, 1454198400000000);
+        test_prev("Fri *-*-13 UTC", "UTC", 1483228800000000, 1463097600000000);
+        test_prev("*-02-29 UTC", "UTC", 1483228800000000, 1456704000000000);
+        test_prev("2016-03-27 03:17:00", "UTC", 1459048620000000, 1459048620000000);
+        test_prev("2016-03-27 03:17:00", "UTC", 1459048619000000, -1);
+        /* 01:08 EST comes after 01:45 EDT, the last quarter is 01:00 EST */
+        test_prev("*:0/15", "America/New_York", 1225606118000000, 1225605600000000);
+        test_prev("2025-10-26 02:30 Europe/Berlin", "UTC", 1761442300000000, 1761442200000000);
+        test_prev("2025-10-26 02:30 Europe/Berlin", "UTC", 1761442000000000, 1761438600000000);
+
+        test_ctx("*:0/15", "America/New_York", 1225000000000000, 2000);
+        test_ctx("*-*-* 02:30", "Europe/Berlin", 1700000000000000, 1000);
+        test_ctx("hourly", "Pacific/Chatham", 3190000000000000, 2000);
+        test_ctx("Sat 02:00 Europe/Berlin", "America/New_York", 12345, 100);
+
+        /* more than fit into the table */
+        test_cache("*:0/15", "America/New_York", 1225000000000000, 6000);
+        test_cache("*-*-* 02:30", "Europe/Berlin", 1700000000000000, 1000);
+        test_cache("Mon *-02-29 UTC", "UTC", 1483228800000000, 10);
+        test_cache("2016-03-27 03:17:00", "CET", 12345, 3);
+
+        test_weekly("Sat 02:00 Europe/Berlin", "UTC", true, 12345, 1000);
+        test_weekly("Mon,Wed 22:00", "America/New_York", true, 1225000000000000, 1000);
+        test_weekly("Sun *:0/15", "Europe/Berlin", true, 1700000000000000, 3000);
+        test_weekly("Mon-Fri 02,03:30", "Europe/Berlin", true, 1711000000000000, 1000);
+        test_weekly("*:0/7", "Pacific/Chatham", true, 3190000000000000, 5000);
+        test_weekly("Sun 23:59 UTC", "UTC", true, 7226582400000000, 100);
+        test_weekly("Sat 02:00:30", "UTC", false, 12345, 10);
+        test_weekly("Sat *-*-01 02:00", "UTC", false, 12345, 10);
+
+        test_many("Europe/Berlin", 1711000000000000);
+        test_many("Europe/Berlin", 1729000000000000);
+        test_many("America/New_York", 1225000000000000);
+
+        test_locate("Sat 23:00 UTC", 86400 * USEC_PER_SEC, 1454284800000000, 0, 1454799600000000);
+        /* window longer than the period of the spec */
+        test_locate("*-*-* 22:00 UTC", 3 * 86400 * USEC_PER_SEC, 1454284800000000, 1, 1454104800000000);
+        test_locate("*-*-* 22:00 UTC", 3600 * USEC_PER_SEC, 1454284800000000, 0, 1454364000000000);
 
         assert_se(calendar_spec_from_string("test", &c) < 0);
         assert_se(calendar_spec_from_string("", &c) < 0);
         assert_se(calendar_spec_from_string("7", &c) < 0);
         assert_se(calendar_spec_from_string("121212:1:2", &c) < 0);
+        assert_se(calendar_spec_from_string("Mond 12:00", &c) < 0);
+        assert_se(calendar_spec_from_string("Sat-Mon 12:00", &c) < 0);
+        assert_se(calendar_spec_from_string("dailyx", &c) < 0);
+        assert_se(calendar_spec_from_string("*:-15", &c) < 0);
+        assert_se(calendar_spec_from_string("*:0/-1", &c) < 0);
+
+        /* Valid, but never matching */
+        assert_se(calendar_spec_from_string("Wed-Sat,Tue 12-10-15 1:2:3", &c) == -EDOM);
+        assert_se(calendar_spec_from_string("*-02-30", &c) == -EDOM);
+        assert_se(calendar_spec_from_string("2019-02-29", &c) == -EDOM);
+        assert_se(calendar_spec_from_string("Mon *-*-31 UTC", &c) >= 0);
+        calendar_spec_free(c);
+        assert_se(calendar_spec_from_string("03:00 Nowhere/Atlantis", &c) < 0);
+        assert_se(calendar_spec_from_string("03:00 ../../etc/passwd", &c) < 0);
 
         return 0;
 }
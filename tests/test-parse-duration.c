@@ -15,9 +15,19 @@
    along with this program.  If not, see <http://www.gnu.org/licenses/>.  */
 
 #include <assert.h>
+#include <errno.h>
 #include <stdio.h>
 #include "parse-duration.h"
 
+static usec_t
+parse (const char *str)
+{
+  usec_t usec;
+
+  assert (parse_duration_usec (str, &usec) == 0);
+  return usec;
+}
+
 int
 main (void)
 {
@@ -26,6 +36,40 @@ main (void)
   assert (parse_duration (" 1: 0") == 3600);
   assert (parse_duration ("  1:0  ") == 3600);
   assert (parse_duration ("01:0:30") == 3630);
+  assert (parse_duration ("013000") == 5400);
+  assert (parse_duration ("1H 30M") == 5400);
+  assert (parse_duration ("250ms") == 0);
+  assert (parse_duration ("foo") == BAD_TIME);
+
+  assert (parse ("1h 30min") == 90 * USEC_PER_MINUTE);
+  assert (parse ("1h30m") == 90 * USEC_PER_MINUTE);
+  assert (parse ("250ms") == 250 * USEC_PER_MSEC);
+  assert (parse ("2w") == 2 * USEC_PER_WEEK);
+  assert (parse ("1 day 2 hours") == 26 * USEC_PER_HOUR);
+  assert (parse ("1.5h") == 90 * USEC_PER_MINUTE);
+  assert (parse (".5s") == 500 * USEC_PER_MSEC);
+  assert (parse ("5us") == 5);
+  assert (parse ("0.1234567s") == 123456);
+  assert (parse ("72:00") == 72 * USEC_PER_HOUR);
+  assert (parse ("00:00:00.25") == 250 * USEC_PER_MSEC);
+  assert (parse ("1:30:15 ") == 5415 * USEC_PER_SEC);
+  assert (parse ("000001") == USEC_PER_SEC);
+
+  usec_t usec;
+  assert (parse_duration_usec ("", &usec) == -EINVAL);
+  assert (parse_duration_usec ("1h30", &usec) == -EINVAL);
+  assert (parse_duration_usec ("1x", &usec) == -EINVAL);
+  assert (parse_duration_usec ("3600", &usec) == -EINVAL);
+  assert (parse_duration_usec ("1.5:00", &usec) == -EINVAL);
+  assert (parse_duration_usec ("1:", &usec) == -EINVAL);
+  assert (parse_duration_usec ("1:00:", &usec) == -EINVAL);
+  assert (parse_duration_usec ("-1h", &usec) == -EINVAL);
+  assert (parse_duration_usec ("40000000w", &usec) == -ERANGE);
+  /* the integer part fits, the fraction does not */
+  assert (parse_duration_usec ("30500568.999999w", &usec) == -ERANGE);
+  assert (parse_duration_usec ("18446744073709551615us", &usec) == -ERANGE);
+  assert (parse_duration_usec ("99999999999999999999us", &usec) == -ERANGE);
+  assert (parse_duration_usec ("5124095577:00", &usec) == -ERANGE);
 
   return 0;
 }
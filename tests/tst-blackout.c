@@ -0,0 +1,157 @@
+#include <assert.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "basics.h"
+#include "common.h"
+
+/* test parsing of blackouts and the lookup of allowed times */
+
+/* Wed 2025-01-01 00:00:00 UTC */
+#define WED (1735689600 * USEC_PER_SEC)
+#define HOUR (3600 * USEC_PER_SEC)
+
+static void
+test_parse(void)
+{
+  _cleanup_(freep) char *str = NULL;
+  RM_Blackout *blackouts = NULL;
+  size_t n;
+
+  assert(rm_blackouts_from_string("Sat 00:00 UTC for 48h; 2025-01-02 UTC .. 2025-01-03 12:00 UTC",
+				  &blackouts, &n) == 0);
+  assert(n == 2);
+  assert(blackouts[0].duration == 48 * HOUR && blackouts[0].end == NULL);
+  assert(blackouts[1].end != NULL);
+
+  assert(rm_blackouts_to_string(blackouts, n, &str) == 0);
+  assert(strcmp(str, "Sat *-*-* 00:00:00 UTC for 48:00; "
+		"2025-01-02 00:00:00 UTC..2025-01-03 12:00:00 UTC") == 0);
+
+  /* into a caller provided buffer */
+  char buf[64];
+  assert(rm_blackout_format_max(&blackouts[0]) <= sizeof(buf));
+  assert(rm_blackout_format(&blackouts[0], buf, sizeof(buf)) == 0);
+  assert(strcmp(buf, "Sat *-*-* 00:00:00 UTC for 48:00") == 0);
+  assert(rm_blackout_format(&blackouts[1], buf, 20) == -ENOBUFS);
+  rm_blackouts_free(blackouts, n);
+
+  assert(rm_blackouts_from_string("03:30", &blackouts, &n) == -EINVAL);
+  assert(rm_blackouts_from_string("03:30 for 0", &blackouts, &n) == -EINVAL);
+  assert(rm_blackouts_from_string("03:30 for", &blackouts, &n) == -EINVAL);
+  assert(rm_blackouts_from_string("*-12-24..2025-01-01", &blackouts, &n) == -EINVAL);
+  assert(rm_blackouts_from_string("2025-01-03 UTC..2025-01-02 UTC", &blackouts, &n) == -EINVAL);
+  assert(rm_blackouts_from_string("03:30 for 1h;", &blackouts, &n) == -EINVAL);
+  assert(rm_blackouts_from_string("*-02-30 for 1h", &blackouts, &n) == -EDOM);
+}
+
+static void
+test_lookup(void)
+{
+  _cleanup_(rm_blackout_index_free) RM_BlackoutIndex idx = {};
+  RM_Blackout *blackouts = NULL;
+  usec_t allowed, until;
+  size_t n;
+
+  assert(rm_blackouts_from_string("Sat 00:00 UTC for 48h; 2025-01-02 UTC..2025-01-03 12:00 UTC; "
+				  "Mon 00:00 UTC for 24h; Tue 00:00 UTC for 24h",
+				  &blackouts, &n) == 0);
+
+  assert(rm_blackout_index_lookup(&idx, blackouts, n, WED, &allowed, &until) == 0);
+  assert(allowed == WED && until == WED + 24 * HOUR);
+  assert(rm_blackout_index_lookup(&idx, blackouts, n, WED + 30 * HOUR, &allowed, &until) == 0);
+  assert(allowed == WED + 60 * HOUR && until == WED + 72 * HOUR);
+  /* Sat, Sun, Mon and Tue are merged into one period */
+  assert(rm_blackout_index_lookup(&idx, blackouts, n, WED + 80 * HOUR, &allowed, &until) == 0);
+  assert(allowed == WED + 168 * HOUR && until == WED + 240 * HOUR);
+  /* far beyond the index */
+  assert(rm_blackout_index_lookup(&idx, blackouts, n, WED + 3 * USEC_PER_YEAR + 1, &allowed, NULL) == 0);
+  assert(rm_blackout_index_lookup(&idx, blackouts, n, WED + 24 * HOUR, &allowed, NULL) == 0);
+  assert(allowed == WED + 60 * HOUR);
+
+  rm_blackouts_free(blackouts, n);
+  rm_blackout_index_free(&idx);
+
+  /* no blackouts at all */
+  assert(rm_blackout_index_lookup(&idx, NULL, 0, WED, &allowed, &until) == 0);
+  assert(allowed == WED && until == USEC_INFINITY);
+  rm_blackout_index_free(&idx);
+
+  /* a blackout which never ends */
+  assert(rm_blackouts_from_string("*-*-* 00:00 UTC for 24h", &blackouts, &n) == 0);
+  assert(rm_blackout_index_lookup(&idx, blackouts, n, WED, &allowed, &until) == -ETIME);
+  rm_blackouts_free(blackouts, n);
+  rm_blackout_index_free(&idx);
+
+  /* a blackout which cannot be expanded */
+  assert(rm_blackouts_from_string("*:*:* UTC for 2s", &blackouts, &n) == 0);
+  assert(rm_blackout_index_lookup(&idx, blackouts, n, WED, &allowed, &until) == -E2BIG);
+  rm_blackouts_free(blackouts, n);
+}
+
+static void
+test_next_window(void)
+{
+  _cleanup_(rm_blackout_index_free) RM_BlackoutIndex idx = {};
+  const usec_t durations[] = {HOUR, 2 * HOUR, 2 * HOUR};
+  RM_Blackout *blackouts = NULL;
+  RM_MaintWindow *windows = NULL;
+  usec_t start, end;
+  size_t n_blackouts, n_windows;
+
+  assert(rm_blackouts_from_string("Sat 00:00 UTC for 48h; 2025-01-02 UTC..2025-01-03 12:00 UTC",
+				  &blackouts, &n_blackouts) == 0);
+
+  assert(rm_windows_from_string("02:00 UTC", durations, 1, &windows, &n_windows) == 0);
+  assert(rm_next_allowed_window(windows, n_windows, &idx, blackouts, n_blackouts,
+				WED, &start, &end) == 0);
+  assert(start == WED + 2 * HOUR && end == WED + 3 * HOUR);
+  /* Thu, Fri, Sat and Sun are blacked out */
+  assert(rm_next_allowed_window(windows, n_windows, &idx, blackouts, n_blackouts,
+				WED + 3 * HOUR, &start, &end) == 0);
+  assert(start == WED + 122 * HOUR && end == WED + 123 * HOUR);
+  /* inside of the window */
+  assert(rm_next_allowed_window(windows, n_windows, &idx, blackouts, n_blackouts,
+				WED + 122 * HOUR + 1, &start, &end) == 0);
+  assert(start == WED + 122 * HOUR + 1 && end == WED + 123 * HOUR);
+  rm_windows_free(windows, n_windows);
+
+  /* only the part of the window after or before a blackout */
+  assert(rm_windows_from_string("Fri 11:00 UTC; Fri 23:00 UTC", durations + 1, 2,
+				&windows, &n_windows) == 0);
+  assert(rm_next_allowed_window(windows, n_windows, &idx, blackouts, n_blackouts,
+				WED, &start, &end) == 0);
+  assert(start == WED + 60 * HOUR && end == WED + 61 * HOUR);
+  assert(rm_next_allowed_window(windows, n_windows, &idx, blackouts, n_blackouts,
+				WED + 61 * HOUR, &start, &end) == 0);
+  assert(start == WED + 71 * HOUR && end == WED + 72 * HOUR);
+  rm_windows_free(windows, n_windows);
+
+  /* no window outside of the blackouts */
+  assert(rm_windows_from_string("Sat,Sun 12:00 UTC", durations, 1, &windows, &n_windows) == 0);
+  assert(rm_next_allowed_window(windows, n_windows, &idx, blackouts, n_blackouts,
+				WED, &start, &end) == -ETIME);
+  rm_windows_free(windows, n_windows);
+
+  /* a window of the maximum duration ends only at the next blackout */
+  const usec_t longest = USEC_INFINITY - 1;
+  assert(rm_windows_from_string("02:00 UTC", &longest, 1, &windows, &n_windows) == 0);
+  assert(rm_next_allowed_window(windows, n_windows, &idx, blackouts, n_blackouts,
+				WED, &start, &end) == 0);
+  assert(start == WED && end == WED + 24 * HOUR);
+  rm_windows_free(windows, n_windows);
+
+  rm_blackouts_free(blackouts, n_blackouts);
+}
+
+int
+main(void)
+{
+  test_parse();
+  test_lookup();
+  test_next_window();
+
+  return 0;
+}
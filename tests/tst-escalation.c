@@ -0,0 +1,50 @@
+#include <assert.h>
+#include <stdbool.h>
+#include <stdlib.h>
+
+#include "basics.h"
+#include "common.h"
+
+/* test the decisions after failed attempts to reboot */
+
+int
+main(void)
+{
+  /* a success ends every escalation */
+  assert(rm_reboot_next_action(true, 1, 0, RM_REBOOTMETHOD_SOFT, true) ==
+	 RM_REBOOTACTION_DONE);
+  assert(rm_reboot_next_action(true, 5, 1, RM_REBOOTMETHOD_HARD, false) ==
+	 RM_REBOOTACTION_DONE);
+
+  /* reboot-retries=2: the first attempt and two retries */
+  assert(rm_reboot_next_action(false, 1, 2, RM_REBOOTMETHOD_HARD, true) ==
+	 RM_REBOOTACTION_RETRY);
+  assert(rm_reboot_next_action(false, 2, 2, RM_REBOOTMETHOD_HARD, true) ==
+	 RM_REBOOTACTION_RETRY);
+  assert(rm_reboot_next_action(false, 3, 2, RM_REBOOTMETHOD_HARD, true) ==
+	 RM_REBOOTACTION_GIVE_UP);
+
+  /* a timed out or killed systemctl counts like any other failure */
+  assert(rm_reboot_next_action(false, 1, 0, RM_REBOOTMETHOD_HARD, true) ==
+	 RM_REBOOTACTION_GIVE_UP);
+
+  /* a soft-reboot falls back to a hard reboot after its retries */
+  assert(rm_reboot_next_action(false, 1, 1, RM_REBOOTMETHOD_SOFT, true) ==
+	 RM_REBOOTACTION_RETRY);
+  assert(rm_reboot_next_action(false, 2, 1, RM_REBOOTMETHOD_SOFT, true) ==
+	 RM_REBOOTACTION_FALLBACK);
+  assert(rm_reboot_next_action(false, 2, 1, RM_REBOOTMETHOD_SOFT, false) ==
+	 RM_REBOOTACTION_GIVE_UP);
+  assert(rm_reboot_next_action(false, 1, 0, RM_REBOOTMETHOD_SOFT, true) ==
+	 RM_REBOOTACTION_FALLBACK);
+
+  /* the delay doubles up to the maximum */
+  assert(rm_reboot_retry_delay(0) == RM_REBOOT_RETRY_DELAY);
+  assert(rm_reboot_retry_delay(1) == RM_REBOOT_RETRY_DELAY);
+  assert(rm_reboot_retry_delay(2) == 2 * RM_REBOOT_RETRY_DELAY);
+  assert(rm_reboot_retry_delay(3) == 4 * RM_REBOOT_RETRY_DELAY);
+  assert(rm_reboot_retry_delay(RM_REBOOT_RETRIES_MAX) == RM_REBOOT_RETRY_DELAY_MAX);
+  assert(rm_reboot_retry_delay(~0U) == RM_REBOOT_RETRY_DELAY_MAX);
+
+  return 0;
+}
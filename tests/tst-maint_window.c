@@ -0,0 +1,131 @@
+#include <assert.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "basics.h"
+#include "common.h"
+
+/* test parsing of maintenance window lists and the order of windows */
+
+/* Wed 2025-01-01 00:00:00 UTC */
+#define WED (1735689600 * USEC_PER_SEC)
+#define HOUR (3600 * USEC_PER_SEC)
+
+static void
+test_parse(void)
+{
+  _cleanup_(freep) usec_t *durations = NULL;
+  _cleanup_(freep) char *start_str = NULL;
+  _cleanup_(freep) char *duration_str = NULL;
+  RM_MaintWindow *windows = NULL;
+  size_t n_durations, n;
+
+  assert(rm_durations_from_string("1h; 6h", &durations, &n_durations) == 0);
+  assert(n_durations == 2);
+  assert(durations[0] == HOUR && durations[1] == 6 * HOUR);
+
+  assert(rm_windows_from_string("Tue,Thu 02:00;Sat 22:00", durations,
+				n_durations, &windows, &n) == 0);
+  assert(n == 2);
+  assert(windows[0].duration == HOUR);
+  assert(windows[1].duration == 6 * HOUR);
+
+  assert(rm_windows_to_string(windows, n, &start_str, &duration_str) == 0);
+  assert(strcmp(start_str, "Tue,Thu *-*-* 02:00:00; Sat *-*-* 22:00:00") == 0);
+  assert(strcmp(duration_str, "01:00; 06:00") == 0);
+
+  /* a single duration applies to all windows */
+  assert(rm_windows_set_durations(windows, n, durations, 1) == 0);
+  assert(windows[1].duration == HOUR);
+  rm_windows_free(windows, n);
+
+  assert(rm_windows_from_string("03:30; 04:00; 05:00", durations,
+				n_durations, &windows, &n) == -ERANGE);
+  assert(rm_windows_from_string("03:30;; 04:00", durations, 1,
+				&windows, &n) == -EINVAL);
+  assert(rm_windows_from_string("03:30; ", durations, 1,
+				&windows, &n) == -EINVAL);
+  assert(rm_windows_from_string("03:30; *-02-30", durations, 1,
+				&windows, &n) == -EDOM);
+  assert(rm_windows_from_string("", durations, 1, &windows, &n) == -EINVAL);
+  assert(rm_windows_set_durations(NULL, 0, durations, 2) == -ERANGE);
+
+  free(durations);
+  durations = NULL;
+  assert(rm_durations_from_string("1h;foo", &durations, &n_durations) == -EINVAL);
+
+  /* sub-second durations survive the round trip */
+  assert(rm_durations_from_string("1h 30min; 250ms", &durations, &n_durations) == 0);
+  assert(durations[0] == 90 * 60 * USEC_PER_SEC && durations[1] == 250 * USEC_PER_MSEC);
+  assert(rm_windows_from_string("Mon 02:00; Tue 02:00", durations,
+				n_durations, &windows, &n) == 0);
+  duration_str = mfree(duration_str);
+  assert(rm_windows_to_string(windows, n, NULL, &duration_str) == 0);
+  assert(strcmp(duration_str, "01:30; 00:00:00.25") == 0);
+  rm_windows_free(windows, n);
+}
+
+static void
+test_queue(void)
+{
+  const usec_t durations[] = {HOUR, 6 * HOUR};
+  _cleanup_(rm_window_queue_free) RM_WindowQueue q = {};
+  RM_MaintWindow *windows = NULL;
+  usec_t start;
+  size_t n, window;
+
+  assert(rm_windows_from_string("Tue,Thu 02:00 UTC; Sat 22:00 UTC",
+				durations, 2, &windows, &n) == 0);
+
+  /* Thu 02:00, Sat 22:00, Tue 02:00, Thu 02:00 */
+  assert(rm_window_queue_init(&q, windows, n, WED) == 0);
+  assert(rm_window_queue_peek(&q, &start, &window));
+  assert(window == 0 && start == WED + 26 * HOUR);
+  assert(rm_window_queue_advance(&q) == 0);
+  assert(rm_window_queue_peek(&q, &start, &window));
+  assert(window == 1 && start == WED + 94 * HOUR);
+  assert(rm_window_queue_advance(&q) == 0);
+  assert(rm_window_queue_peek(&q, &start, &window));
+  assert(window == 0 && start == WED + 146 * HOUR);
+  assert(rm_window_queue_advance(&q) == 0);
+  assert(rm_window_queue_peek(&q, &start, &window));
+  assert(window == 0 && start == WED + 194 * HOUR);
+  rm_window_queue_free(&q);
+
+  /* inside of the Sat window, which started in the past */
+  assert(rm_window_queue_init(&q, windows, n, WED + 99 * HOUR) == 0);
+  assert(rm_window_queue_peek(&q, &start, &window));
+  assert(window == 1 && start == WED + 94 * HOUR);
+  rm_window_queue_free(&q);
+
+  /* just after the end of it */
+  assert(rm_window_queue_init(&q, windows, n, WED + 100 * HOUR) == 0);
+  assert(rm_window_queue_peek(&q, &start, &window));
+  assert(window == 0 && start == WED + 146 * HOUR);
+  rm_window_queue_free(&q);
+
+  rm_windows_free(windows, n);
+
+  /* windows which do not come again are dropped */
+  assert(rm_windows_from_string("2024-06-01 UTC; 2025-01-03 UTC",
+				durations, 1, &windows, &n) == 0);
+  assert(rm_window_queue_init(&q, windows, n, WED) == 0);
+  assert(rm_window_queue_peek(&q, &start, &window));
+  assert(window == 1 && start == WED + 48 * HOUR);
+  assert(rm_window_queue_advance(&q) == 0);
+  assert(!rm_window_queue_peek(&q, &start, &window));
+  assert(rm_window_queue_advance(&q) == -ENOENT);
+
+  rm_windows_free(windows, n);
+}
+
+int
+main(void)
+{
+  test_parse();
+  test_queue();
+
+  return 0;
+}
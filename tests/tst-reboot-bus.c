@@ -0,0 +1,113 @@
+#include <assert.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <systemd/sd-bus.h>
+#include <systemd/sd-id128.h>
+
+#include "basics.h"
+#include "common.h"
+
+/* test rebooting through logind against a stub of it, which serves a
+   direct connection over a socket pair in a thread */
+
+struct stub {
+  int fd;
+  int calls;
+  uint64_t flags;
+  bool deny;
+};
+
+static int
+stub_handler(sd_bus_message *m, void *userdata,
+	     sd_bus_error _unused_(*ret_error))
+{
+  struct stub *stub = userdata;
+  uint64_t flags;
+  int r;
+
+  if (!sd_bus_message_is_method_call(m, RM_LOGIND_MANAGER, "RebootWithFlags"))
+    return 0;
+
+  r = sd_bus_message_read(m, "t", &flags);
+  if (r < 0)
+    return r;
+
+  stub->calls++;
+  stub->flags = flags;
+
+  if (stub->deny)
+    return sd_bus_reply_method_errorf(m, "org.freedesktop.DBus.Error.AccessDenied",
+				      "Access denied");
+  return sd_bus_reply_method_return(m, NULL);
+}
+
+static void *
+stub_logind(void *p)
+{
+  struct stub *stub = p;
+  sd_bus *bus = NULL;
+  sd_id128_t id;
+  int r;
+
+  assert(sd_id128_randomize(&id) >= 0);
+  assert(sd_bus_new(&bus) >= 0);
+  assert(sd_bus_set_fd(bus, stub->fd, stub->fd) >= 0);
+  assert(sd_bus_set_server(bus, 1, id) >= 0);
+  assert(sd_bus_add_object(bus, NULL, RM_LOGIND_PATH, stub_handler, stub) >= 0);
+  assert(sd_bus_start(bus) >= 0);
+
+  /* until the client closes the connection */
+  for (;;)
+    {
+      r = sd_bus_process(bus, NULL);
+      if (r == 0)
+	r = sd_bus_wait(bus, UINT64_MAX);
+      if (r < 0)
+	break;
+    }
+
+  sd_bus_flush_close_unref(bus);
+  return NULL;
+}
+
+int
+main(void)
+{
+  struct stub stub = {};
+  sd_bus *bus = NULL;
+  pthread_t thread;
+  int fds[2];
+
+  assert(socketpair(AF_UNIX, SOCK_STREAM|SOCK_CLOEXEC, 0, fds) == 0);
+  stub.fd = fds[1];
+  assert(pthread_create(&thread, NULL, stub_logind, &stub) == 0);
+
+  assert(sd_bus_new(&bus) >= 0);
+  assert(sd_bus_set_fd(bus, fds[0], fds[0]) >= 0);
+  assert(sd_bus_start(bus) >= 0);
+
+  assert(rm_bus_check_logind(bus) >= 0);
+
+  /* a reboot is never turned into a soft-reboot */
+  assert(rm_bus_reboot(bus, RM_REBOOTMETHOD_HARD) >= 0);
+  assert(stub.calls == 1 && stub.flags == 0);
+
+  assert(rm_bus_reboot(bus, RM_REBOOTMETHOD_SOFT) >= 0);
+  assert(stub.calls == 2 && stub.flags == (UINT64_C(1) << 2));
+
+  assert(rm_bus_reboot(bus, RM_REBOOTMETHOD_UNKNOWN) == -EINVAL);
+  assert(stub.calls == 2);
+
+  /* the caller falls back to systemctl on errors */
+  stub.deny = true;
+  assert(rm_bus_reboot(bus, RM_REBOOTMETHOD_HARD) == -EACCES);
+  assert(stub.calls == 3);
+
+  sd_bus_flush_close_unref(bus);
+  assert(pthread_join(thread, NULL) == 0);
+
+  return 0;
+}
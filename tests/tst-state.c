@@ -0,0 +1,136 @@
+#include <assert.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <systemd/sd-event.h>
+
+#include "basics.h"
+#include "common.h"
+
+/* test saving and restoring the pending reboot */
+
+static char dir[] = "/tmp/tst-state.XXXXXX";
+
+static void
+write_raw(const char *path, const void *data, size_t size)
+{
+  FILE *fp = fopen(path, "w");
+
+  assert(fp != NULL);
+  assert(fwrite(data, 1, size, fp) == size);
+  fclose(fp);
+}
+
+static void
+read_raw(const char *path, void *data, size_t size)
+{
+  FILE *fp = fopen(path, "r");
+
+  assert(fp != NULL);
+  assert(fread(data, 1, size, fp) == size);
+  fclose(fp);
+}
+
+static int
+time_handler(sd_event_source _unused_(*s), uint64_t _unused_(usec),
+	     void _unused_(*userdata))
+{
+  return 0;
+}
+
+/* the state file is gone once the reboot timer elapsed, before
+   the reboot is executed */
+static void
+test_handoff(const char *path)
+{
+  _cleanup_(freep) RM_CTX *ctx = calloc(1, sizeof(RM_CTX));
+  sd_event *loop = NULL;
+  RM_State state;
+
+  assert(ctx != NULL);
+  assert(sd_event_new(&loop) >= 0);
+  assert(sd_event_add_time_relative(loop, &ctx->timer, CLOCK_REALTIME,
+				    USEC_PER_HOUR, 0, time_handler, NULL) >= 0);
+  ctx->reboot_status = RM_REBOOTSTATUS_WAITING_WINDOW;
+  ctx->reboot_method = RM_REBOOTMETHOD_SOFT;
+  ctx->reboot_time = 1735689600 * USEC_PER_SEC;
+
+  rm_state_get(ctx, &state);
+  assert(state.status == RM_REBOOTSTATUS_WAITING_WINDOW &&
+	 state.method == RM_REBOOTMETHOD_SOFT);
+  assert(rm_state_save(path, &state) == 0);
+  assert(access(path, F_OK) == 0);
+
+  /* like time_handler() of rebootmgrd */
+  ctx->timer = sd_event_source_unref(ctx->timer);
+  rm_state_get(ctx, &state);
+  assert(state.status == RM_REBOOTSTATUS_NOT_REQUESTED);
+  assert(rm_state_save(path, &state) == 0);
+  assert(access(path, F_OK) < 0 && errno == ENOENT);
+
+  sd_event_unref(loop);
+}
+
+int
+main(void)
+{
+  _cleanup_(freep) char *path = NULL;
+  RM_State state = {
+    .status = RM_REBOOTSTATUS_WAITING_WINDOW,
+    .method = RM_REBOOTMETHOD_SOFT,
+    .reboot_time = 1735689600 * USEC_PER_SEC,
+    .forced = true,
+    .requester = 0,
+  };
+  RM_State loaded;
+  unsigned char raw[40], bad[41];
+
+  assert(mkdtemp(dir) != NULL);
+  assert(asprintf(&path, "%s/state", dir) > 0);
+
+  assert(rm_state_load(path, &loaded) == -ENOENT);
+
+  assert(rm_state_save(path, &state) == 0);
+  assert(rm_state_load(path, &loaded) == 0);
+  assert(loaded.status == state.status && loaded.method == state.method &&
+	 loaded.reboot_time == state.reboot_time && loaded.forced &&
+	 loaded.requester == 0);
+
+  /* replaced */
+  state.method = RM_REBOOTMETHOD_HARD;
+  state.forced = false;
+  assert(rm_state_save(path, &state) == 0);
+  assert(rm_state_load(path, &loaded) == 0);
+  assert(loaded.method == RM_REBOOTMETHOD_HARD && !loaded.forced);
+
+  /* invalid files are rejected */
+  read_raw(path, raw, sizeof(raw));
+  write_raw(path, raw, sizeof(raw) - 1);
+  assert(rm_state_load(path, &loaded) == -EBADMSG);
+  memcpy(bad, raw, sizeof(raw));
+  bad[40] = 0;
+  write_raw(path, bad, sizeof(bad));
+  assert(rm_state_load(path, &loaded) == -EBADMSG);
+  memcpy(bad, raw, sizeof(raw));
+  bad[0] = 'X';
+  write_raw(path, bad, sizeof(raw));
+  assert(rm_state_load(path, &loaded) == -EBADMSG);
+  memcpy(bad, raw, sizeof(raw));
+  bad[16] = 7; /* method */
+  write_raw(path, bad, sizeof(raw));
+  assert(rm_state_load(path, &loaded) == -EBADMSG);
+
+  /* nothing pending removes the file */
+  state.status = RM_REBOOTSTATUS_NOT_REQUESTED;
+  assert(rm_state_save(path, &state) == 0);
+  assert(access(path, F_OK) < 0 && errno == ENOENT);
+  assert(rm_state_save(path, &state) == 0);
+
+  test_handoff(path);
+
+  assert(rmdir(dir) == 0);
+
+  return 0;
+}
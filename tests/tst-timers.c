@@ -0,0 +1,164 @@
+#include <assert.h>
+#include <errno.h>
+#include <ftw.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+
+#include "basics.h"
+#include "common.h"
+
+/* test reading the timers to avoid from unit files below a fake root */
+
+/* Wed 2025-01-01 00:00:00 UTC */
+#define WED (1735689600 * USEC_PER_SEC)
+#define HOUR (3600 * USEC_PER_SEC)
+
+static char root[] = "/tmp/tst-timers.XXXXXX";
+
+static void
+write_file(const char *name, const char *content)
+{
+  _cleanup_(freep) char *path = NULL;
+  FILE *fp;
+
+  assert(asprintf(&path, "%s/%s", root, name) > 0);
+  *strrchr(path, '/') = '\0';
+  assert(mkdir_p(path, 0755) == 0);
+  path[strlen(path)] = '/';
+
+  fp = fopen(path, "w");
+  assert(fp != NULL);
+  fputs(content, fp);
+  fclose(fp);
+}
+
+static int
+rm(const char *path, const struct stat _unused_(*sbuf),
+   int _unused_(type), struct FTW _unused_(*ftwb))
+{
+  return remove(path);
+}
+
+static void
+test_parse(void)
+{
+  _cleanup_(freep) char *str = NULL;
+  _cleanup_(freep) char *template = NULL;
+  RM_AvoidTimer *timers = NULL;
+  size_t n;
+
+  assert(rm_avoid_timers_from_string("backup.timer for 2h; btrfs-scrub@-.timer",
+				     &timers, &n) == 0);
+  assert(n == 2);
+  assert(strcmp(timers[0].name, "backup.timer") == 0 && timers[0].margin == 2 * HOUR);
+  assert(strcmp(timers[1].name, "btrfs-scrub@-.timer") == 0 &&
+	 timers[1].margin == RM_TIMER_MARGIN_DEFAULT);
+
+  assert(rm_avoid_timers_to_string(timers, n, &str) == 0);
+  assert(strcmp(str, "backup.timer for 02:00; btrfs-scrub@-.timer for 01:00") == 0);
+
+  assert(rm_avoid_timers_match(timers, n, "backup.timer"));
+  assert(rm_avoid_timers_match(timers, n, "backup.timer.d"));
+  assert(rm_avoid_timers_match(timers, n, "btrfs-scrub@.timer.d"));
+  assert(!rm_avoid_timers_match(timers, n, "backup.service"));
+  assert(!rm_avoid_timers_match(timers, n, "backup.timer~"));
+  rm_avoid_timers_free(timers, n);
+
+  assert(rm_unit_template("btrfs-scrub@-.timer", &template) == 1);
+  assert(strcmp(template, "btrfs-scrub@.timer") == 0);
+  assert(rm_unit_template("btrfs-scrub@.timer", &template) == 0);
+  assert(rm_unit_template("backup.timer", &template) == 0);
+
+  assert(rm_avoid_timers_from_string("backup.service", &timers, &n) == -EINVAL);
+  assert(rm_avoid_timers_from_string("../backup.timer", &timers, &n) == -EINVAL);
+  assert(rm_avoid_timers_from_string("backup.timer for 0", &timers, &n) == -EINVAL);
+  assert(rm_avoid_timers_from_string("backup.timer for ever", &timers, &n) < 0);
+}
+
+static void
+test_blackouts(void)
+{
+  _cleanup_(rm_blackout_index_free) RM_BlackoutIndex idx = {};
+  _cleanup_(freep) char *str = NULL;
+  RM_AvoidTimer *timers = NULL;
+  RM_Blackout *blackouts = NULL;
+  RM_MaintWindow *windows = NULL;
+  const usec_t duration = 2 * HOUR;
+  size_t n, n_blackouts, n_timer_blackouts = 0, n_windows;
+  usec_t start, end;
+
+  /* the drop-in in /etc replaces the one of the same name in /usr,
+     and resets the OnCalendar= of the unit */
+  write_file("usr/lib/systemd/system/backup.timer",
+	     "[Unit]\nDescription=Backup\n\n[Timer]\nOnCalendar=daily\nOnCalendar = Sun 04:00\n");
+  write_file("usr/lib/systemd/system/backup.timer.d/override.conf",
+	     "[Timer]\nOnCalendar=Mon 05:00\n");
+  write_file("usr/lib/systemd/system/backup.timer.d/zz.conf",
+	     "# later\n[Timer]\nOnCalendar=Sat 03:00 UTC\n");
+  write_file("etc/systemd/system/backup.timer.d/override.conf",
+	     "[Timer]\nOnCalendar=\nOnCalendar=*-*-* 01:30 UTC\n");
+  /* instances use the template */
+  write_file("usr/lib/systemd/system/btrfs-scrub@.timer",
+	     "[Timer]\nOnCalendar=bogus\nOnCalendar=monthly\n[Install]\nOnCalendar=daily\n");
+  /* masked */
+  write_file("usr/lib/systemd/system/masked.timer", "[Timer]\nOnCalendar=daily\n");
+  write_file("etc/systemd/system/masked.timer", "");
+  /* would block all reboots */
+  write_file("usr/lib/systemd/system/always.timer", "[Timer]\nOnCalendar=minutely\n");
+
+  assert(rm_blackouts_from_string("2025-12-24..2025-12-27", &blackouts, &n_blackouts) == 0);
+  assert(rm_avoid_timers_from_string("backup.timer for 2h; btrfs-scrub@-.timer; "
+				     "missing.timer; masked.timer; always.timer",
+				     &timers, &n) == 0);
+
+  assert(rm_timer_blackouts_update(root, timers, n, &blackouts, &n_blackouts,
+				   &n_timer_blackouts) == 0);
+  assert(n_blackouts == 4 && n_timer_blackouts == 3);
+  assert(rm_blackouts_to_string(blackouts, n_blackouts, &str) == 0);
+  assert(strcmp(str, "2025-12-24 00:00:00..2025-12-27 00:00:00; "
+		"*-*-* 01:30:00 UTC for 02:00; Sat *-*-* 03:00:00 UTC for 02:00; "
+		"*-*-01 00:00:00 for 01:00") == 0);
+  str = mfree(str);
+
+  /* only the part of the window before the backup */
+  assert(rm_windows_from_string("01:00 UTC", &duration, 1, &windows, &n_windows) == 0);
+  assert(rm_next_allowed_window(windows, n_windows, &idx, blackouts, n_blackouts,
+				WED + 2 * HOUR, &start, &end) == 0);
+  assert(start == WED + 25 * HOUR && end == WED + 25 * HOUR + HOUR / 2);
+  rm_windows_free(windows, n_windows);
+  rm_blackout_index_free(&idx);
+
+  /* the blackouts of the timers are replaced, the configured kept */
+  assert(rm_timer_blackouts_update(root, timers, 1, &blackouts, &n_blackouts,
+				   &n_timer_blackouts) == 0);
+  assert(n_blackouts == 3 && n_timer_blackouts == 2);
+  write_file("etc/systemd/system/backup.timer", "");
+  assert(rm_timer_blackouts_update(root, timers, 1, &blackouts, &n_blackouts,
+				   &n_timer_blackouts) == 0);
+  assert(n_blackouts == 1 && n_timer_blackouts == 0);
+  assert(rm_blackouts_to_string(blackouts, n_blackouts, &str) == 0);
+  assert(strcmp(str, "2025-12-24 00:00:00..2025-12-27 00:00:00") == 0);
+
+  rm_avoid_timers_free(timers, n);
+  rm_blackouts_free(blackouts, n_blackouts);
+}
+
+int
+main(void)
+{
+  /* the unit files use local time, do not depend on the host */
+  assert(setenv("TZ", "UTC", 1) == 0);
+  tzset();
+
+  assert(mkdtemp(root) != NULL);
+
+  test_parse();
+  test_blackouts();
+
+  nftw(root, rm, 12, FTW_DEPTH|FTW_MOUNT|FTW_PHYS);
+
+  return 0;
+}